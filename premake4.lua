@@ -171,8 +171,7 @@ tutos = {
     
     "tuto_rayons",
     "tuto_englobant",
-    "tuto_bvh",
-    "tuto_ray",
+    "pipeline",
     
 }
 
@@ -199,6 +198,49 @@ project("mesh_viewer")
     files { gkit_dir .. "/tutos/material_data.h"}
 
 
+-- description des tutos lancer de rayons, partagent le bvh et les sources
+rt_files = { 
+    gkit_dir .. "/tutos/bvh.cpp", gkit_dir .. "/tutos/bvh.h", 
+    gkit_dir .. "/tutos/bvh_quality.cpp", gkit_dir .. "/tutos/bvh_quality.h", 
+    gkit_dir .. "/tutos/ao.cpp", gkit_dir .. "/tutos/ao.h", 
+    gkit_dir .. "/tutos/denoise.cpp", gkit_dir .. "/tutos/denoise.h", 
+    gkit_dir .. "/tutos/texture_cache.cpp", gkit_dir .. "/tutos/texture_cache.h", 
+    gkit_dir .. "/tutos/cluster_bvh.cpp", gkit_dir .. "/tutos/cluster_bvh.h", 
+    gkit_dir .. "/tutos/render_tile.cpp", gkit_dir .. "/tutos/render_tile.h", 
+    gkit_dir .. "/tutos/temporal.cpp", gkit_dir .. "/tutos/temporal.h", 
+    gkit_dir .. "/tutos/lightcuts.cpp", gkit_dir .. "/tutos/lightcuts.h", 
+    gkit_dir .. "/tutos/photon_map.cpp", gkit_dir .. "/tutos/photon_map.h", 
+    gkit_dir .. "/tutos/lightmap.cpp", gkit_dir .. "/tutos/lightmap.h", 
+    gkit_dir .. "/tutos/heightfield.cpp", gkit_dir .. "/tutos/heightfield.h", 
+    gkit_dir .. "/tutos/intersector.cpp", gkit_dir .. "/tutos/intersector.h", 
+    gkit_dir .. "/tutos/grid.cpp", gkit_dir .. "/tutos/grid.h", 
+    gkit_dir .. "/tutos/kdtree.cpp", gkit_dir .. "/tutos/kdtree.h", 
+    gkit_dir .. "/tutos/sources.h" 
+}
+
+rt_tutos = {
+    "tuto_bvh",
+    "tuto_ray",
+    "rt_bench",
+    "tuto_clusters",
+    "rt_farm",
+    "rt_batch",
+    "rt_temporal",
+    "rt_lightmap",
+    "rt_terrain",
+}
+
+for i, name in ipairs(rt_tutos) do
+    project(name)
+        language "C++"
+        kind "ConsoleApp"
+        targetdir "bin"
+        files ( gkit_files )
+        files ( rt_files )
+        files { gkit_dir .. "/tutos/" .. name..'.cpp' }
+end
+
+
 -- description des tutos openGL avances / M2
 tutosM2 = {
     "tuto_time",
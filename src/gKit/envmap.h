@@ -7,6 +7,7 @@
 #include "vec.h"
 #include "color.h"
 #include "image.h"
+#include "image_io.h"
 
 //! representation d'une cubemap / envmap.
 struct Envmap
@@ -201,10 +202,10 @@ struct Envmap
     }
     
     // mapping direction vers pixel [0 .. w]x[0 .. h]
-    Vector envmap_pixel( const Vector& d ) { Vector texel= envmap_texel(d); return Vector(texel.x, texel.y * m_width, texel.z * m_width); }
+    Vector envmap_pixel( const Vector& d ) const { Vector texel= envmap_texel(d); return Vector(texel.x, texel.y * m_width, texel.z * m_width); }
     
     // mapping direction vers texel [0 .. 1]x[0 .. 1]
-    Vector envmap_texel( const Vector& d )
+    Vector envmap_texel( const Vector& d ) const
     {
         float sm, tm;
         int face= -1;
@@ -265,11 +266,11 @@ struct Envmap
     }
 
     // mapping texel vers direction
-    Vector envmap_pixel_direction( const Vector& d ) { return envmap_texel_direction(int(d.x), d.y / m_width, d.z / m_width); }
+    Vector envmap_pixel_direction( const Vector& d ) const { return envmap_texel_direction(int(d.x), d.y / m_width, d.z / m_width); }
     
-    Vector envmap_texel_direction( const Vector& d ) { return envmap_texel_direction(int(d.x), d.y, d.z); }
+    Vector envmap_texel_direction( const Vector& d ) const { return envmap_texel_direction(int(d.x), d.y, d.z); }
     
-    Vector envmap_texel_direction( const int face, const float s, const float t )
+    Vector envmap_texel_direction( const int face, const float s, const float t ) const
     {
         // retrouve le point sur le cube [-1 .. 1]
         float sm= 2 * s -1;
@@ -0,0 +1,262 @@
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <algorithm>
+
+#include "files.h"
+#include "image_io.h"
+#include "image_hdr.h"
+#include "envmap_prefilter.h"
+
+
+// niveau suivant, filtre boite 2x2 sur chaque face
+static Envmap downsample( const Envmap& envmap )
+{
+    int w= std::max(1, envmap.width() / 2);
+    Envmap tmp(w);
+    for(int face= 0; face < 6; face++)
+    for(int y= 0; y < w; y++)
+    for(int x= 0; x < w; x++)
+        tmp(face, x, y)= (envmap(face, 2*x, 2*y) + envmap(face, 2*x +1, 2*y) + envmap(face, 2*x, 2*y +1) + envmap(face, 2*x +1, 2*y +1)) * 0.25f;
+    
+    return tmp;
+}
+
+// filtrage trilineaire dans la chaine de mipmaps
+static Color texture_lod( const std::vector<Envmap>& chain, const Vector& d, const float lod )
+{
+    float l= std::max(0.f, std::min(lod, float(chain.size() -1)));
+    int l0= int(l);
+    float f= l - l0;
+    
+    Color color= chain[l0].texture(d);
+    if(f > 0 && l0 +1 < int(chain.size()))
+        color= color * (1 - f) + chain[l0 +1].texture(d) * f;
+    return color;
+}
+
+// suite de hammersley, 2eme dimension, inverse des bits de i
+static float radical_inverse( unsigned int i )
+{
+    i= (i << 16) | (i >> 16);
+    i= ((i & 0x55555555u) << 1) | ((i & 0xAAAAAAAAu) >> 1);
+    i= ((i & 0x33333333u) << 2) | ((i & 0xCCCCCCCCu) >> 2);
+    i= ((i & 0x0F0F0F0Fu) << 4) | ((i & 0xF0F0F0F0u) >> 4);
+    i= ((i & 0x00FF00FFu) << 8) | ((i & 0xFF00FF00u) >> 8);
+    return float(i) * 2.3283064365386963e-10f;
+}
+
+
+// directions d'un niveau, dans le repere local de la direction miroir (0, 0, 1), rangees par composantes.
+struct Lobe
+{
+    std::vector<float> x, y, z;     // directions
+    std::vector<float> weights;     // poids de chaque direction
+    std::vector<float> lods;        // niveau de l'envmap a lire pour chaque direction
+};
+
+static Lobe lobe( const float roughness, const int samples, const bool ggx, const int width, const int levels )
+{
+    Lobe lobe;
+    float alpha= std::max(roughness * roughness, 1e-3f);
+    float a2= alpha * alpha;
+    float exponent= 2 / a2 - 2;
+    
+    // angle solide d'un texel du niveau 0
+    float texel= float(4 * M_PI) / float(6 * width * width);
+    
+    for(int i= 0; i < samples; i++)
+    {
+        float u1= (i + 0.5f) / float(samples);
+        float u2= radical_inverse(i);
+        float phi= float(2 * M_PI) * u1;
+        
+        float cos_theta, pdf;
+        if(ggx)
+            cos_theta= std::sqrt((1 - u2) / (1 + (a2 - 1) * u2));
+        else
+            cos_theta= std::pow(u2, 1 / (exponent + 1));
+        float sin_theta= std::sqrt(std::max(0.f, 1 - cos_theta * cos_theta));
+        Vector m= Vector(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta);
+        
+        Vector l;
+        float weight;
+        if(ggx)
+        {
+            // m est la demi direction, reflechit v= n= (0, 0, 1)
+            l= Vector(2 * m.z * m.x, 2 * m.z * m.y, 2 * m.z * m.z - 1);
+            weight= l.z;        // cos theta_l
+            
+            float k= (a2 - 1) * cos_theta * cos_theta + 1;
+            float d= a2 / (float(M_PI) * k * k);
+            pdf= d / 4;         // d * cos theta_m / (4 * dot(v, m)), avec dot(v, m) == cos theta_m
+        }
+        else
+        {
+            l= m;
+            weight= 1;
+            pdf= (exponent + 1) / float(2 * M_PI) * std::pow(cos_theta, exponent);
+        }
+        
+        if(weight <= 0)
+            continue;
+        
+        // niveau de l'envmap : angle solide couvert par la direction / angle solide d'un texel
+        float solid_angle= 1 / (float(samples) * pdf);
+        float lod= 0.5f * std::log2(solid_angle / texel) + 1;
+        
+        lobe.x.push_back(l.x);
+        lobe.y.push_back(l.y);
+        lobe.z.push_back(l.z);
+        lobe.weights.push_back(weight);
+        lobe.lods.push_back(std::max(0.f, std::min(lod, float(levels -1))));
+    }
+    
+    return lobe;
+}
+
+
+std::vector<Envmap> envmap_prefilter( const Envmap& envmap, const int samples, const bool ggx )
+{
+    std::vector<Envmap> chain;
+    if(envmap.empty())
+        return chain;
+    
+    // mipmaps de l'envmap, filtre boite, pour les lectures filtrees
+    chain.push_back(envmap);
+    while(chain.back().width() > 1)
+        chain.push_back(downsample(chain.back()));
+    
+    const int levels= int(chain.size());
+    std::vector<Envmap> filtered(levels);
+    filtered[0]= envmap;
+    
+    for(int level= 1; level < levels; level++)
+    {
+        const int w= chain[level].width();
+        filtered[level]= Envmap(w);
+        
+        Lobe directions= lobe(float(level) / float(levels -1), samples, ggx, envmap.width(), levels);
+        const int n= int(directions.weights.size());
+        float total= 0;
+        for(int i= 0; i < n; i++)
+            total+= directions.weights[i];
+        
+    #pragma omp parallel for schedule(dynamic, 1)
+        for(int row= 0; row < 6 * w; row++)
+        {
+            const int face= row / w;
+            const int y= row % w;
+            
+            std::vector<float> dx(n), dy(n), dz(n);
+            for(int x= 0; x < w; x++)
+            {
+                // repere autour de la direction du texel, cf "building an orthonormal basis, revisited", Duff 2017
+                Vector r= normalize(envmap.envmap_texel_direction(face, (x + 0.5f) / w, (y + 0.5f) / w));
+                float sign= std::copysign(1.0f, r.z);
+                float a= -1.0f / (sign + r.z);
+                float b= r.x * r.y * a;
+                Vector t= Vector(1.0f + sign * r.x * r.x * a, sign * b, -sign * r.x);
+                Vector s= Vector(b, sign + r.y * r.y * a, -r.y);
+                
+                // transforme toutes les directions du lobe, vectorise
+            #pragma omp simd
+                for(int i= 0; i < n; i++)
+                {
+                    dx[i]= directions.x[i] * t.x + directions.y[i] * s.x + directions.z[i] * r.x;
+                    dy[i]= directions.x[i] * t.y + directions.y[i] * s.y + directions.z[i] * r.y;
+                    dz[i]= directions.x[i] * t.z + directions.y[i] * s.z + directions.z[i] * r.z;
+                }
+                
+                Color color= Black();
+                for(int i= 0; i < n; i++)
+                    color= color + texture_lod(chain, Vector(dx[i], dy[i], dz[i]), directions.lods[i]) * directions.weights[i];
+                
+                filtered[level](face, x, y)= Color(color / total, 1);
+            }
+        }
+    }
+    
+    return filtered;
+}
+
+
+int write_prefiltered_cubemap( const std::vector<Envmap>& levels, const char *format )
+{
+    char tmp[1024];
+    for(int i= 0; i < int(levels.size()); i++)
+    {
+        snprintf(tmp, sizeof(tmp), format, i);
+        if(write_cubemap(levels[i], tmp) < 0)
+            return -1;
+    }
+    
+    return 0;
+}
+
+
+std::vector<Envmap> read_prefiltered_cubemap( const char *filename, const int samples, const bool ggx )
+{
+    double source= timestamp(filename);
+    if(source < 0)
+    {
+        printf("[error] loading cubemap '%s'...\n", filename);
+        return std::vector<Envmap>();
+    }
+    
+    // nom des fichiers du cache, depend du lobe et du nombre de directions
+    char format[1024];
+    snprintf(format, sizeof(format), "%s.%s%d.%%02d.hdr", filename, ggx ? "ggx" : "phong", samples);
+    // description du cache : date de la cubemap utilisee pour le calculer, taille du niveau 0 et nombre de niveaux
+    char header[1024];
+    snprintf(header, sizeof(header), "%s.%s%d.txt", filename, ggx ? "ggx" : "phong", samples);
+    
+    // relit le cache, s'il a ete calcule sur cette version de la cubemap, sans charger la cubemap
+    std::vector<Envmap> levels;
+    double date= -1;
+    int width= 0;
+    int count= 0;
+    if(FILE *in= fopen(header, "rt"))
+    {
+        if(fscanf(in, "%lf %d %d", &date, &width, &count) != 3)
+            count= 0;
+        fclose(in);
+    }
+    
+    if(count > 0 && date == source)
+    {
+        char tmp[1024];
+        for(int i= 0; i < count; i++)
+        {
+            snprintf(tmp, sizeof(tmp), format, i);
+            Envmap level= read_cubemap(tmp);
+            if(level.empty() || level.width() != std::max(1, width >> i))
+                break;
+            
+            levels.push_back(level);
+        }
+        
+        if(int(levels.size()) == count)
+            return levels;
+        
+        printf("[warning] prefiltered cubemap '%s': incomplete cache, rebuilding...\n", filename);
+    }
+    
+    Envmap envmap= read_cubemap(filename);
+    if(envmap.empty())
+        return std::vector<Envmap>();
+    
+    // recalcule les niveaux
+    printf("prefiltering cubemap '%s'...\n", filename);
+    levels= envmap_prefilter(envmap, samples, ggx);
+    if(!levels.empty() && write_prefiltered_cubemap(levels, format) == 0)
+    {
+        if(FILE *out= fopen(header, "wt"))
+        {
+            fprintf(out, "%.0f %d %d\n", source, levels[0].width(), int(levels.size()));
+            fclose(out);
+        }
+    }
+    return levels;
+}
@@ -0,0 +1,33 @@
+
+#ifndef _ENVMAP_PREFILTER_H
+#define _ENVMAP_PREFILTER_H
+
+#include <vector>
+
+#include "envmap.h"
+
+
+/*! prefiltre une envmap pour les reflets glossy, renvoie une chaine de mipmaps complete, jusqu'aux faces 1x1.
+    le niveau 0 est l'envmap, le niveau i est filtre avec la rugosite i / (levels -1) et peut etre utilise 
+    avec textureLod(cubemap, reflect(v, n), roughness * (levels -1)).
+    
+    ggx= true : lobe GGX, approximation n = v = r, cf "real shading in unreal engine 4", Karis 2013,
+    ggx= false : lobe de Phong autour de la direction miroir, exposant 2 / alpha^2 - 2, alpha= roughness^2.
+    
+    samples directions par texel, choisies selon le lobe, suite de Hammersley. chaque direction lit un niveau 
+    plus ou moins filtre de l'envmap, en fonction de sa densite, cf "GPU-based importance sampling", Colbert, Krivanek 2007, 
+    ce qui permet d'utiliser peu de directions sans artefacts.
+    les valeurs sont filtrees telles quelles, utiliser Envmap::linear() avant pour une envmap ldr.
+*/
+std::vector<Envmap> envmap_prefilter( const Envmap& envmap, const int samples= 64, const bool ggx= true );
+
+//! enregistre les niveaux, un fichier par niveau, cf write_cubemap(). format est un nom de fichier avec un %d pour l'indice du niveau, "sky_ggx%02d.hdr", par exemple.
+int write_prefiltered_cubemap( const std::vector<Envmap>& levels, const char *format );
+
+/*! charge une cubemap, cf read_cubemap(), et renvoie ses niveaux prefiltres, cf envmap_prefilter().
+    les niveaux sont conserves sur disque, a cote de la cubemap, avec un fichier texte qui decrit le cache, et ne sont recalcules que si un fichier manque 
+    ou si la cubemap a ete modifiee. la cubemap n'est chargee que pour recalculer les niveaux.
+*/
+std::vector<Envmap> read_prefiltered_cubemap( const char *filename, const int samples= 64, const bool ggx= true );
+
+#endif
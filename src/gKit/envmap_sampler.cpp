@@ -0,0 +1,179 @@
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+#include "envmap_sampler.h"
+
+
+// aire de la projection sur la sphere du rectangle [0 .. x]x[0 .. y] d'une face du cube a distance 1 du centre.
+static float area_element( const float x, const float y )
+{
+    return std::atan2(x * y, std::sqrt(x * x + y * y + 1));
+}
+
+float envmap_texel_solid_angle( const int x, const int y, const int width )
+{
+    // coins du texel sur la face [-1 .. 1]x[-1 .. 1]
+    float x0= 2 * float(x) / float(width) -1;
+    float y0= 2 * float(y) / float(width) -1;
+    float x1= 2 * float(x +1) / float(width) -1;
+    float y1= 2 * float(y +1) / float(width) -1;
+    return area_element(x0, y0) - area_element(x0, y1) - area_element(x1, y0) + area_element(x1, y1);
+}
+
+std::vector<float> envmap_solid_angles( const int width )
+{
+    // evalue une seule fois l'aire de chaque coin des texels
+    const int w= width;
+    std::vector<float> corners((w +1) * (w +1));
+#pragma omp parallel for schedule(static)
+    for(int y= 0; y <= w; y++)
+    for(int x= 0; x <= w; x++)
+        corners[y * (w +1) + x]= area_element(2 * float(x) / float(w) -1, 2 * float(y) / float(w) -1);
+    
+    std::vector<float> solid_angles(w * w);
+    for(int y= 0; y < w; y++)
+    for(int x= 0; x < w; x++)
+        solid_angles[y * w + x]= corners[y * (w +1) + x] - corners[(y +1) * (w +1) + x] - corners[y * (w +1) + x +1] + corners[(y +1) * (w +1) + x +1];
+    
+    return solid_angles;
+}
+
+
+// normalise n valeurs et construit leur fonction de repartition, n+1 valeurs. renvoie la somme des valeurs.
+// une repartition uniforme est utilisee si toutes les valeurs sont nulles.
+static float build_cdf( const float *values, const int n, float *cdf )
+{
+    double sum= 0;
+    cdf[0]= 0;
+    for(int i= 0; i < n; i++)
+    {
+        sum= sum + values[i];
+        cdf[i +1]= float(sum);
+    }
+    
+    for(int i= 1; i <= n; i++)
+        cdf[i]= (sum > 0) ? float(cdf[i] / sum) : float(i) / float(n);
+    cdf[n]= 1;
+    
+    return float(sum);
+}
+
+// renvoie l'indice i tel que cdf[i] <= u < cdf[i+1], et la position de u dans cet intervalle, dans [0 .. 1).
+static int sample_cdf( const float *cdf, const int n, float& u )
+{
+    int i= int(std::upper_bound(cdf, cdf + n +1, u) - cdf) -1;
+    i= std::max(0, std::min(n -1, i));
+    
+    float width= cdf[i +1] - cdf[i];
+    u= (width > 0) ? (u - cdf[i]) / width : 0.5f;
+    u= std::max(0.f, std::min(u, 0.99999994f));
+    return i;
+}
+
+
+void EnvmapSampler::build( const Envmap& envmap )
+{
+    m_envmap= &envmap;
+    m_width= envmap.width();
+    if(envmap.empty())
+        return;
+    
+    const int w= m_width;
+    m_texels.assign(6 * w * w, 0);
+    m_columns.assign(6 * w * (w +1), 0);
+    m_rows.assign(6 * (w +1), 0);
+    m_faces.assign(7, 0);
+    
+    // poids des texels, luminance * angle solide
+    std::vector<float> solid_angles= envmap_solid_angles(w);
+    std::vector<float> rows(6 * w);
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int j= 0; j < 6 * w; j++)
+    {
+        int face= j / w;
+        int y= j % w;
+        
+        float *weights= &m_texels[j * w];
+        for(int x= 0; x < w; x++)
+        {
+            Color color= envmap(face, x, y);
+            float luminance= 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;
+            weights[x]= std::max(0.f, luminance) * solid_angles[y * w + x];
+        }
+        
+        rows[j]= build_cdf(weights, w, &m_columns[j * (w +1)]);
+    }
+    
+    float faces[6];
+    for(int face= 0; face < 6; face++)
+        faces[face]= build_cdf(&rows[face * w], w, &m_rows[face * (w +1)]);
+    float total= build_cdf(faces, 6, m_faces.data());
+    
+    // probabilite de chaque texel
+    for(int i= 0; i < int(m_texels.size()); i++)
+        m_texels[i]= (total > 0) ? m_texels[i] / total : 1.f / float(m_texels.size());
+}
+
+
+Vector EnvmapSampler::sample( const float u1, const float u2, float& pdf ) const
+{
+    const int w= m_width;
+    assert(w > 0);
+    
+    // choisit une face, une ligne, puis un texel, u1 est re-utilise apres chaque choix
+    float u= u1;
+    int face= sample_cdf(m_faces.data(), 6, u);
+    int y= sample_cdf(&m_rows[face * (w +1)], w, u);
+    float fy= u;
+    
+    u= u2;
+    int x= sample_cdf(&m_columns[(face * w + y) * (w +1)], w, u);
+    float fx= u;
+    
+    // position dans le texel
+    float s= (x + fx) / float(w);
+    float t= (y + fy) / float(w);
+    Vector d= normalize(m_envmap->envmap_texel_direction(face, s, t));
+    
+    // densite par rapport aux angles solides
+    float sm= 2 * s -1;
+    float tm= 2 * t -1;
+    float k= 1 + sm * sm + tm * tm;
+    pdf= m_texels[(face * w + y) * w + x] * float(w * w) * k * std::sqrt(k) / 4;
+    return d;
+}
+
+
+int EnvmapSampler::texel( const Vector& d, float& sm, float& tm ) const
+{
+    const int w= m_width;
+    Vector texel= m_envmap->envmap_texel(d);
+    int face= int(texel.x);
+    int x= std::max(0, std::min(w -1, int(texel.y * w)));
+    int y= std::max(0, std::min(w -1, int(texel.z * w)));
+    
+    sm= 2 * texel.y -1;
+    tm= 2 * texel.z -1;
+    return (face * w + y) * w + x;
+}
+
+float EnvmapSampler::pdf( const Vector& d ) const
+{
+    float sm, tm;
+    int id= texel(d, sm, tm);
+    
+    float k= 1 + sm * sm + tm * tm;
+    return m_texels[id] * float(m_width * m_width) * k * std::sqrt(k) / 4;
+}
+
+Color EnvmapSampler::radiance( const Vector& d ) const
+{
+    float sm, tm;
+    int id= texel(d, sm, tm);
+    
+    const int w= m_width;
+    int face= id / (w * w);
+    return (*m_envmap)(face, id % w, (id / w) % w);
+}
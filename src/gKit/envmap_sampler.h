@@ -0,0 +1,60 @@
+
+#ifndef _ENVMAP_SAMPLER_H
+#define _ENVMAP_SAMPLER_H
+
+#include <vector>
+
+#include "vec.h"
+#include "color.h"
+#include "envmap.h"
+
+
+/*! echantillonnage preferentiel d'une cubemap / envmap : genere des directions proportionnellement a la luminance des texels
+    et a l'angle solide qu'ils couvrent.
+    
+    les tables sont construites une seule fois : choix de la face, puis d'une ligne de la face, puis d'un texel de la ligne, 
+    chaque choix est une recherche dichotomique dans une fonction de repartition, O(log n).
+    la direction est choisie uniformement dans le texel (sur la face du cube), la densite tient compte de la deformation 
+    entre la face du cube et la sphere : d omega = ds dt / (1 + s^2 + t^2)^(3/2) pour s, t dans [-1 .. 1].
+    
+    l'envmap est consideree constante par texel, cf radiance(), pour que les densites renvoyees par sample() et pdf() soient exactes.
+    l'envmap doit rester valide pendant l'utilisation de l'echantillonneur.
+*/
+struct EnvmapSampler
+{
+    EnvmapSampler( ) : m_envmap(nullptr), m_faces(), m_rows(), m_columns(), m_texels(), m_width(0) {}
+    EnvmapSampler( const Envmap& envmap ) : m_envmap(nullptr), m_faces(), m_rows(), m_columns(), m_texels(), m_width(0) { build(envmap); }
+    
+    //! construit les fonctions de repartition.
+    void build( const Envmap& envmap );
+    
+    //! renvoie vrai si l'echantillonneur est initialise.
+    bool empty( ) const { return m_width == 0; }
+    
+    //! genere une direction, u1, u2 uniformes dans [0 .. 1), renvoie aussi sa densite de proba par rapport aux angles solides.
+    Vector sample( const float u1, const float u2, float& pdf ) const;
+    
+    //! renvoie la densite de proba de la direction d, pour combiner plusieurs strategies d'echantillonnage, par exemple.
+    float pdf( const Vector& d ) const;
+    
+    //! renvoie l'emission de l'envmap dans la direction d, la valeur du texel, sans filtrage.
+    Color radiance( const Vector& d ) const;
+    
+protected:
+    //! retrouve le texel et la position sur la face [-1 .. 1]x[-1 .. 1] d'une direction.
+    int texel( const Vector& d, float& sm, float& tm ) const;
+    
+    const Envmap *m_envmap;
+    std::vector<float> m_faces;         //!< repartition des faces, 6+1 valeurs
+    std::vector<float> m_rows;          //!< repartition des lignes de chaque face, 6 * (w+1) valeurs
+    std::vector<float> m_columns;       //!< repartition des texels de chaque ligne, 6 * w * (w+1) valeurs
+    std::vector<float> m_texels;        //!< probabilite de chaque texel, 6 * w * w valeurs
+    int m_width;
+};
+
+//! renvoie l'angle solide couvert par le texel (x, y) d'une face de largeur width.
+float envmap_texel_solid_angle( const int x, const int y, const int width );
+//! renvoie l'angle solide couvert par chaque texel d'une face de largeur width, identique pour les 6 faces, indice y * width + x.
+std::vector<float> envmap_solid_angles( const int width );
+
+#endif
@@ -0,0 +1,125 @@
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+#include "envmap_sh.h"
+#include "envmap_sampler.h"
+
+
+// fonctions de base, direction normalisee
+static void sh_basis( const Vector& d, float y[9] )
+{
+    y[0]= 0.282095f;
+    y[1]= 0.488603f * d.y;
+    y[2]= 0.488603f * d.z;
+    y[3]= 0.488603f * d.x;
+    y[4]= 1.092548f * d.x * d.y;
+    y[5]= 1.092548f * d.y * d.z;
+    y[6]= 0.315392f * (3 * d.z * d.z - 1);
+    y[7]= 1.092548f * d.x * d.z;
+    y[8]= 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+// convolution par le cosinus, A_l pour chaque coefficient
+static const float sh_cosine[9]= {
+    float(M_PI), 
+    float(2 * M_PI / 3), float(2 * M_PI / 3), float(2 * M_PI / 3), 
+    float(M_PI / 4), float(M_PI / 4), float(M_PI / 4), float(M_PI / 4), float(M_PI / 4) 
+};
+
+
+Color EnvmapSH::radiance( const Vector& d ) const
+{
+    float y[9];
+    sh_basis(normalize(d), y);
+    
+    Color color= Black();
+    for(int i= 0; i < count(); i++)
+        color= color + coefficients[i] * y[i];
+    return Color(color, 1);
+}
+
+Color EnvmapSH::irradiance( const Vector& n ) const
+{
+    float y[9];
+    sh_basis(normalize(n), y);
+    
+    Color color= Black();
+    for(int i= 0; i < count(); i++)
+        color= color + coefficients[i] * (sh_cosine[i] * y[i]);
+    return Color(color, 1);
+}
+
+std::vector<vec3> EnvmapSH::irradiance_coefficients( ) const
+{
+    // constantes des fonctions de base, cf sh_basis()
+    const float basis[9]= { 0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f };
+    
+    std::vector<vec3> c(9);
+    for(int i= 0; i < count(); i++)
+    {
+        Color k= coefficients[i] * (sh_cosine[i] * basis[i]);
+        c[i]= vec3(k.r, k.g, k.b);
+    }
+    return c;
+}
+
+
+EnvmapSH envmap_sh( const Envmap& envmap, const int order )
+{
+    assert(order == 2 || order == 3);
+    EnvmapSH sh;
+    sh.order= order;
+    if(envmap.empty())
+        return sh;
+    
+    const int w= envmap.width();
+    const int n= sh.count();
+    
+    // angle solide des texels, identique pour les 6 faces
+    std::vector<float> solid_angles= envmap_solid_angles(w);
+    
+    // sommes partielles par ligne, le resultat ne depend pas du nombre de threads
+    std::vector<double> rows(6 * w * n * 3, 0);
+#pragma omp parallel for schedule(dynamic, 4)
+    for(int j= 0; j < 6 * w; j++)
+    {
+        int face= j / w;
+        int y= j % w;
+        
+        float sum[27]= { };
+        for(int x= 0; x < w; x++)
+        {
+            Vector d= normalize(envmap.envmap_texel_direction(face, (x + 0.5f) / w, (y + 0.5f) / w));
+            Color color= envmap(face, x, y) * solid_angles[y * w + x];
+            
+            // evalue toujours les 9 fonctions, la boucle est deroulee par le compilateur
+            float b[9];
+            sh_basis(d, b);
+            for(int i= 0; i < 9; i++)
+            {
+                sum[3*i]+= color.r * b[i];
+                sum[3*i +1]+= color.g * b[i];
+                sum[3*i +2]+= color.b * b[i];
+            }
+        }
+        
+        for(int i= 0; i < 3 * n; i++)
+            rows[j * n * 3 + i]= sum[i];
+    }
+    
+    for(int i= 0; i < n; i++)
+    {
+        double r= 0, g= 0, b= 0;
+        for(int j= 0; j < 6 * w; j++)
+        {
+            r+= rows[(j * n + i) * 3];
+            g+= rows[(j * n + i) * 3 +1];
+            b+= rows[(j * n + i) * 3 +2];
+        }
+        sh.coefficients[i]= Color(float(r), float(g), float(b));
+    }
+    
+    return sh;
+}
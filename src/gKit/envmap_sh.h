@@ -0,0 +1,44 @@
+
+#ifndef _ENVMAP_SH_H
+#define _ENVMAP_SH_H
+
+#include <vector>
+
+#include "vec.h"
+#include "color.h"
+#include "envmap.h"
+
+
+/*! projection d'une envmap sur les harmoniques spheriques, ordre 2 (4 coefficients) ou 3 (9 coefficients).
+    l'irradiance d'une surface d'orientation n s'evalue en temps constant, cf irradiance(),
+    cf "an efficient representation for irradiance environment maps", Ramamoorthi, Hanrahan 2001.
+    
+    ordre des coefficients : (l, m)= (0, 0), (1, -1), (1, 0), (1, 1), (2, -2), (2, -1), (2, 0), (2, 1), (2, 2).
+*/
+struct EnvmapSH
+{
+    int order;                      //!< nombre de bandes, 2 ou 3
+    Color coefficients[9];          //!< projection de la radiance de l'envmap, L_lm
+    
+    EnvmapSH( ) : order(0), coefficients() {}
+    
+    //! renvoie le nombre de coefficients.
+    int count( ) const { return order * order; }
+    
+    //! renvoie la radiance reconstruite dans la direction d, version basse frequence de l'envmap.
+    Color radiance( const Vector& d ) const;
+    
+    //! renvoie l'irradiance recue par une surface de normale n. pour une matiere diffuse, la lumiere reflechie est albedo / pi * irradiance(n).
+    Color irradiance( const Vector& n ) const;
+    
+    /*! renvoie 9 coefficients, convolues par le cosinus et multiplies par les constantes des fonctions de base, a transmettre a un shader, cf program_uniform().
+        E(n)= c[0] + c[1]*n.y + c[2]*n.z + c[3]*n.x + c[4]*n.x*n.y + c[5]*n.y*n.z + c[6]*(3*n.z*n.z - 1) + c[7]*n.x*n.z + c[8]*(n.x*n.x - n.y*n.y)
+        les coefficients de la bande 2 sont nuls pour une projection d'ordre 2.
+    */
+    std::vector<vec3> irradiance_coefficients( ) const;
+};
+
+//! projette une envmap sur les harmoniques spheriques, order 2 ou 3. utilise l'angle solide de chaque texel.
+EnvmapSH envmap_sh( const Envmap& envmap, const int order= 3 );
+
+#endif
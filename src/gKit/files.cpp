@@ -0,0 +1,20 @@
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "files.h"
+
+
+double timestamp( const char *filename )
+{
+#ifndef _MSC_VER
+    struct stat info;
+    if(stat(filename, &info) < 0)
+        return -1;
+#else
+    struct _stat64 info;
+    if(_stat64(filename, &info) < 0)
+        return -1;
+#endif
+    return double(info.st_mtime);
+}
@@ -0,0 +1,16 @@
+#ifndef _FILES_H
+#define _FILES_H
+
+
+//! \addtogroup utils utilitaires pour les fichiers
+//@{
+
+//! \file
+//! informations sur les fichiers, pour conserver des donnees pre-calculees sur disque.
+
+//! renvoie la date de derniere modification d'un fichier, ou -1 s'il n'existe pas.
+double timestamp( const char *filename );
+
+//@}
+
+#endif
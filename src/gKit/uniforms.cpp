@@ -100,6 +100,13 @@ void program_uniform( const GLuint program, const char *uniform, const Vector& v
     glUniform3fv( location(program, uniform), 1, &v.x );
 }
 
+void program_uniform( const GLuint program, const char *uniform, const std::vector<vec3>& v )
+{
+    if(v.empty())
+        return;
+    glUniform3fv( location(program, uniform), GLsizei(v.size()), &v.front().x );
+}
+
 void program_uniform( const GLuint program, const char *uniform, const vec4& v )
 {
     glUniform4fv( location(program, uniform), 1, &v.x );
@@ -3,6 +3,7 @@
 #define _UNIFORMS_H
 
 #include <string>
+#include <vector>
 
 #include "glcore.h"
 
@@ -34,6 +35,9 @@ void program_uniform( const GLuint program, const char *uniform, const Point& v
 //! affecte une valeur a un uniform du shader program. Vector.
 void program_uniform( const GLuint program, const char *uniform, const Vector& v );
 
+//! affecte un tableau de valeurs a un uniform du shader program. vec3 [].
+void program_uniform( const GLuint program, const char *uniform, const std::vector<vec3>& v );
+
 //! affecte une valeur a un uniform du shader program. vec4.
 void program_uniform( const GLuint program, const char *uniform, const vec4& v );
 //! affecte une valeur a un uniform du shader program. Color.
@@ -22,6 +22,8 @@ uniform sampler2D ntexture;
 uniform sampler2D vtexture;
 
 uniform vec2 pixel;
+uniform vec3 source_position;
+uniform vec3 source_normal;
 
 out vec4 fragment_color;
 
@@ -31,8 +33,9 @@ void main( )
     vec3 qn= texture(ntexture, texcoord).xyz;
     float v= texture(vtexture, texcoord).x;
     
-    vec3 p= texture(ptexture, pixel).xyz;
-    vec3 n= texture(ntexture, pixel).xyz;
+    // point selectionne, les textures sont calculees progressivement et ne contiennent pas forcement le pixel selectionne
+    vec3 p= source_position;
+    vec3 n= source_normal;
     
     vec3 d= q - p;
     float cos_theta_p= max(0, dot(normalize(n), normalize(d)));
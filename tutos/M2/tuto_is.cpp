@@ -1,6 +1,13 @@
 
 #include <cfloat>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 
 #include "app.h"
 
@@ -177,10 +184,50 @@ GLuint make_texture( const int unit, const int width, const int height )
 }
 
 
+// rendu progressif, en arriere plan : l'image est decoupee en blocs, calcules par plusieurs threads, d'abord en basse resolution, 
+// 1 pixel sur 8x8, puis 1 sur 4x4, 1 sur 2x2 et enfin tous les pixels. chaque passe re-calcule tous ses pixels, les passes en basse 
+// resolution ne coutent qu'un tiers de la derniere.
+const int tile_size= 32;
+const int tile_levels= 4;
+// nombre maximum de blocs transferes par image, limite le temps passe dans render()
+const int tile_uploads= 64;
+
+// repere de la camera et point selectionne, copies dans chaque bloc : les threads ne lisent jamais l'orbiter
+struct TileFrame
+{
+    Point d0;
+    Vector dx0, dy0;
+    Point d1;
+    Vector dx1, dy1;
+    
+    Point point;
+    Vector normal;
+};
+
+// bloc de pixels a calculer, 1 pixel sur (1 << level) en x et en y
+struct TileJob
+{
+    int x, y;
+    int width, height;
+    int level;
+    int generation;         // les blocs d'une camera precedente sont ignores
+    TileFrame frame;
+};
+
+// bloc calcule : position, normale et visibilite des pixels
+struct TileResult
+{
+    TileJob job;
+    std::vector<Color> p;
+    std::vector<Color> n;
+    std::vector<Color> v;
+};
+
+
 struct IS : public App
 {
     // constructeur : donner les dimensions de l'image, et eventuellement la version d'openGL.
-    IS( const char *filename ) : App(1024, 640) 
+    IS( const char *filename ) : App(1024, 640), m_threads(), m_jobs(), m_next_job(0), m_results(), m_pending(), m_tiles(), m_generation(0), m_quit(false), m_pbo(), m_pbo_index(0)
     {
         m_mesh= read_mesh(filename);
         if(m_mesh == Mesh::error())
@@ -206,9 +253,15 @@ struct IS : public App
         m_ntexture= make_texture(1, window_width(), window_height());
         m_vtexture= make_texture(2, window_width(), window_height());
         
-        m_hitp= Image(window_width(), window_height());
-        m_hitn= Image(window_width(), window_height());
-        m_hitv= Image(window_width(), window_height());
+        // 2 buffers de transfert, utilises a tour de role : remplir l'un pendant que openGL copie l'autre dans les textures
+        glGenBuffers(2, m_pbo);
+        for(int i= 0; i < 2; i++)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[i]);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, 3 * tile_uploads * tile_size * tile_size * sizeof(Color), nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        m_pbo_index= 0;
         
         glGenVertexArrays(1, &m_vao);
         glBindVertexArray(m_vao);
@@ -216,6 +269,12 @@ struct IS : public App
         m_program= read_program("tutos/M2/is.glsl");
         program_print_errors(m_program);
         
+        // threads de calcul, le thread principal reste disponible pour openGL
+        int threads= std::max(1, int(std::thread::hardware_concurrency()) -1);
+        for(int i= 0; i < threads; i++)
+            m_threads.emplace_back(&IS::worker, this);
+        printf("%d render threads\n", threads);
+        
         // etat openGL par defaut
         glClearColor(0.2f, 0.2f, 0.2f, 1.f);        // couleur par defaut de la fenetre
         
@@ -258,7 +317,6 @@ struct IS : public App
         m_camera.projection(window_width(), window_height(), 45);
         
         static int mode= 0;
-        static vec2 texcoord= vec2(0, 0);
         if(key_state(' '))
         {
             clear_key_state(' ');
@@ -269,10 +327,9 @@ struct IS : public App
                 int mx, my;
                 SDL_GetMouseState(&mx, &my);
                 vec2 pixel= vec2(mx, window_height() - my -1);
-                texcoord= vec2(pixel.x / m_hitp.width(), pixel.y / m_hitp.height());
                 printf("pixel %f %f\n", pixel.x, pixel.y);
                 
-                // go
+                // selectionne le point visible dans le pixel
                 Point d0;
                 Vector dx0, dy0;
                 m_camera.frame(0, d0, dx0, dy0);
@@ -281,74 +338,42 @@ struct IS : public App
                 Vector dx1, dy1;
                 m_camera.frame(1, d1, dx1, dy1);
                 
-                // pixel
                 Point o= d0 + pixel.x*dx0 + pixel.y*dy0;
                 Point e= d1 + pixel.x*dx1 + pixel.y*dy1;
-
-                Point point;
-                Vector normal;
                 
                 Ray ray(o, e);
                 Hit hit;
                 if(intersect(ray, hit))
                 {
-                    point= hit.p;
-                    normal= hit.n;
-                    
-                    // frame
-                #pragma omp parallel for schedule(dynamic, 16)
-                    for(int y= 0; y < m_hitp.height(); y++)
-                    for(int x= 0; x < m_hitp.width(); x++)
-                    {
-                        // clear
-                        m_hitp(x, y)= Black();
-                        m_hitn(x, y)= Black();
-                        m_hitv(x, y)= Black();
-                        
-                        Point o= d0 + x*dx0 + y*dy0;
-                        Point e= d1 + x*dx1 + y*dy1;
-                        
-                        Ray ray(o, e);
-                        Hit hit;
-                        if(intersect(ray, hit))
-                        {
-                            m_hitp(x, y)= Color(hit.p.x, hit.p.y, hit.p.z);
-                            m_hitn(x, y)= Color(hit.n.x, hit.n.y, hit.n.z);
-                            
-                            Ray shadow(hit.p + hit.n * 0.001f, point + normal * 0.001f);
-                            Hit shadow_hit;
-                            int v= 1;
-                            if(intersect(shadow, shadow_hit))
-                                v= 0;
-                            
-                            m_hitv(x, y)= Color(v, v, v);
-                        }
-                    }
+                    m_point= hit.p;
+                    m_normal= hit.n;
                     
-                    // transferre les donnees
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, m_ptexture);
-                    glTexSubImage2D(GL_TEXTURE_2D, 0, 
-                        0, 0, m_hitp.width(), m_hitp.height(),
-                        GL_RGBA, GL_FLOAT, m_hitp.data());
-                    
-                    glActiveTexture(GL_TEXTURE0 +1);
-                    glBindTexture(GL_TEXTURE_2D, m_ntexture);
-                    glTexSubImage2D(GL_TEXTURE_2D, 0, 
-                        0, 0, m_hitn.width(), m_hitn.height(),
-                        GL_RGBA, GL_FLOAT, m_hitn.data());
-                    
-                    glActiveTexture(GL_TEXTURE0 +2);
-                    glBindTexture(GL_TEXTURE_2D, m_vtexture);
-                    glTexSubImage2D(GL_TEXTURE_2D, 0, 
-                        0, 0, m_hitv.width(), m_hitv.height(),
-                        GL_RGBA, GL_FLOAT, m_hitv.data());
+                    // recalcule l'image en arriere plan
+                    restart();
                 }
+                else
+                    mode= 0;
             }
+            else
+                // arrete le calcul de l'image
+                cancel();
         }
         
         if(mode == 1)
         {
+            // la camera a change, recommence le calcul de l'image, en basse resolution
+            Transform view= m_camera.view();
+            if(memcmp(&view, &m_view, sizeof(Transform)) != 0)
+                restart();
+            
+            // transfere les blocs termines
+            upload();
+            
+            // position du point selectionne dans l'image
+            Transform viewport= m_camera.viewport() * m_camera.projection() * m_camera.view();
+            Point q= viewport(m_point);
+            vec2 texcoord= vec2(q.x / window_width(), q.y / window_height());
+            
             glBindVertexArray(m_vao);
             glUseProgram(m_program);
             
@@ -356,6 +381,8 @@ struct IS : public App
             program_uniform(m_program, "ntexture", 1);
             program_uniform(m_program, "vtexture", 2);
             program_uniform(m_program, "pixel", texcoord);
+            program_uniform(m_program, "source_position", m_point);
+            program_uniform(m_program, "source_normal", m_normal);
             program_uniform(m_program, "mode", mode);
             
             glActiveTexture(GL_TEXTURE0);
@@ -388,10 +415,221 @@ struct IS : public App
     
     int quit( )
     {
+        // arrete les threads de calcul
+        {
+            std::lock_guard<std::mutex> lock(m_jobs_mutex);
+            m_quit= true;
+        }
+        m_jobs_ready.notify_all();
+        for(std::thread& thread : m_threads)
+            thread.join();
+        m_threads.clear();
+        
+        glDeleteBuffers(2, m_pbo);
         m_mesh.release();
         return 0;
     }
-
+    
+    
+    // abandonne les blocs en cours de calcul
+    void cancel( )
+    {
+        std::lock_guard<std::mutex> lock(m_jobs_mutex);
+        m_generation++;
+        m_jobs.clear();
+        m_next_job= 0;
+    }
+    
+    // prepare les blocs de la nouvelle image, du plus grossier au plus fin, et reveille les threads
+    void restart( )
+    {
+        m_view= m_camera.view();
+        
+        TileFrame frame;
+        m_camera.frame(0, frame.d0, frame.dx0, frame.dy0);
+        m_camera.frame(1, frame.d1, frame.dx1, frame.dy1);
+        frame.point= m_point;
+        frame.normal= m_normal;
+        
+        {
+            std::lock_guard<std::mutex> lock(m_jobs_mutex);
+            // les threads abandonnent les blocs de la generation precedente
+            m_generation++;
+            
+            m_jobs.clear();
+            m_next_job= 0;
+            for(int level= tile_levels -1; level >= 0; level--)
+            for(int y= 0; y < window_height(); y+= tile_size)
+            for(int x= 0; x < window_width(); x+= tile_size)
+            {
+                TileJob job;
+                job.x= x;
+                job.y= y;
+                job.width= std::min(tile_size, window_width() - x);
+                job.height= std::min(tile_size, window_height() - y);
+                job.level= level;
+                job.generation= m_generation;
+                job.frame= frame;
+                m_jobs.push_back(job);
+            }
+        }
+        m_jobs_ready.notify_all();
+        
+        // les blocs en attente de transfert sont perimes
+        m_pending.clear();
+        m_tiles.assign(m_jobs.size() / tile_levels, tile_levels);
+    }
+    
+    // thread de calcul : recupere un bloc, le calcule et le place dans la liste des resultats
+    void worker( )
+    {
+        for(;;)
+        {
+            TileJob job;
+            {
+                std::unique_lock<std::mutex> lock(m_jobs_mutex);
+                m_jobs_ready.wait(lock, [this]( ) { return m_quit || m_next_job < m_jobs.size(); });
+                if(m_quit)
+                    return;
+                
+                job= m_jobs[m_next_job++];
+            }
+            
+            TileResult result;
+            if(!trace(job, result))
+                continue;
+            
+            std::lock_guard<std::mutex> lock(m_results_mutex);
+            m_results.push_back(std::move(result));
+        }
+    }
+    
+    // calcule un bloc, renvoie faux si la camera a change pendant le calcul
+    bool trace( const TileJob& job, TileResult& result ) const
+    {
+        const TileFrame& frame= job.frame;
+        const int step= 1 << job.level;
+        
+        result.job= job;
+        result.p.assign(job.width * job.height, Black());
+        result.n.assign(job.width * job.height, Black());
+        result.v.assign(job.width * job.height, Black());
+        
+        for(int y= 0; y < job.height; y+= step)
+        {
+            if(m_generation != job.generation)
+                return false;
+            
+            for(int x= 0; x < job.width; x+= step)
+            {
+                Color p= Black();
+                Color n= Black();
+                Color v= Black();
+                
+                int px= job.x + x;
+                int py= job.y + y;
+                Point o= frame.d0 + px*frame.dx0 + py*frame.dy0;
+                Point e= frame.d1 + px*frame.dx1 + py*frame.dy1;
+                
+                Ray ray(o, e);
+                Hit hit;
+                if(intersect(ray, hit))
+                {
+                    p= Color(hit.p.x, hit.p.y, hit.p.z);
+                    n= Color(hit.n.x, hit.n.y, hit.n.z);
+                    
+                    Ray shadow(hit.p + hit.n * 0.001f, frame.point + frame.normal * 0.001f);
+                    Hit shadow_hit;
+                    if(!intersect(shadow, shadow_hit))
+                        v= Color(1, 1, 1);
+                }
+                
+                // basse resolution, recopie le pixel dans son bloc de step x step pixels
+                for(int by= y; by < std::min(y + step, job.height); by++)
+                for(int bx= x; bx < std::min(x + step, job.width); bx++)
+                {
+                    int i= by * job.width + bx;
+                    result.p[i]= p;
+                    result.n[i]= n;
+                    result.v[i]= v;
+                }
+            }
+        }
+        
+        return true;
+    }
+    
+    // transfere les blocs termines dans les textures, en passant par un des buffers de transfert
+    void upload( )
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_results_mutex);
+            for(TileResult& result : m_results)
+            {
+                if(result.job.generation != m_generation)
+                    continue;
+                
+                // les blocs ne sont pas forcement termines dans l'ordre, ne remplace pas un bloc par un bloc plus grossier
+                int tile= (result.job.y / tile_size) * ((window_width() + tile_size -1) / tile_size) + result.job.x / tile_size;
+                if(result.job.level >= m_tiles[tile])
+                    continue;
+                
+                m_tiles[tile]= result.job.level;
+                m_pending.push_back(std::move(result));
+            }
+            m_results.clear();
+        }
+        
+        if(m_pending.empty())
+            return;
+        
+        // les blocs les plus anciens d'abord, un bloc plus fin remplace le bloc grossier de la meme region
+        int n= std::min(int(m_pending.size()), tile_uploads);
+        
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo[m_pbo_index]);
+        size_t size= 3 * tile_uploads * tile_size * tile_size * sizeof(Color);
+        Color *data= (Color *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if(data == nullptr)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return;
+        }
+        
+        std::vector<size_t> offsets(n);
+        size_t offset= 0;
+        for(int i= 0; i < n; i++)
+        {
+            const TileResult& result= m_pending[i];
+            size_t count= result.p.size();
+            offsets[i]= offset;
+            std::copy(result.p.begin(), result.p.end(), data + offset);
+            std::copy(result.n.begin(), result.n.end(), data + offset + count);
+            std::copy(result.v.begin(), result.v.end(), data + offset + 2*count);
+            offset+= 3 * count;
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        
+        // copie les blocs dans les textures, depuis le buffer de transfert
+        const GLuint textures[3]= { m_ptexture, m_ntexture, m_vtexture };
+        for(int k= 0; k < 3; k++)
+        {
+            glActiveTexture(GL_TEXTURE0 + k);
+            glBindTexture(GL_TEXTURE_2D, textures[k]);
+            for(int i= 0; i < n; i++)
+            {
+                const TileJob& job= m_pending[i].job;
+                size_t count= job.width * job.height;
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 
+                    job.x, job.y, job.width, job.height,
+                    GL_RGBA, GL_FLOAT, (const GLvoid *) ((offsets[i] + k * count) * sizeof(Color)));
+            }
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        
+        m_pending.erase(m_pending.begin(), m_pending.begin() + n);
+        m_pbo_index= (m_pbo_index +1) % 2;
+    }
+    
     
     // recuperer les sources de lumiere du mesh : triangles associee a une matiere qui emet de la lumiere, material.emission != 0
     int build_sources( )
@@ -410,7 +648,7 @@ struct IS : public App
         return (int) m_sources.size();
     }
 
-    bool direct( const Ray& ray )
+    bool direct( const Ray& ray ) const
     {
         for(size_t i= 0; i < m_sources.size(); i++)
         {
@@ -434,8 +672,8 @@ struct IS : public App
     }
 
 
-    // calcule l'intersection d'un rayon et de tous les triangles
-    bool intersect( const Ray& ray, Hit& hit )
+    // calcule l'intersection d'un rayon et de tous les triangles, utilisee par plusieurs threads en meme temps
+    bool intersect( const Ray& ray, Hit& hit ) const
     {
         hit.t= ray.tmax;
         for(size_t i= 0; i < m_triangles.size(); i++)
@@ -464,9 +702,26 @@ protected:
     std::vector<Triangle> m_triangles;
     std::vector<Source> m_sources;
 
-    Image m_hitp;
-    Image m_hitn;
-    Image m_hitv;
+    // point selectionne, et camera de l'image en cours de calcul
+    Point m_point;
+    Vector m_normal;
+    Transform m_view;
+    
+    // threads de calcul et blocs a calculer
+    std::vector<std::thread> m_threads;
+    std::mutex m_jobs_mutex;
+    std::condition_variable m_jobs_ready;
+    std::vector<TileJob> m_jobs;
+    size_t m_next_job;
+    
+    // blocs calcules, et blocs en attente de transfert
+    std::mutex m_results_mutex;
+    std::vector<TileResult> m_results;
+    std::vector<TileResult> m_pending;
+    std::vector<int> m_tiles;           // resolution de chaque bloc transfere
+    
+    std::atomic<int> m_generation;
+    bool m_quit;
 
     GLuint m_vao;
     GLuint m_program;
@@ -474,6 +729,9 @@ protected:
     GLuint m_ptexture;
     GLuint m_ntexture;
     GLuint m_vtexture;
+    
+    GLuint m_pbo[2];
+    int m_pbo_index;
 };
 
 
@@ -0,0 +1,96 @@
+//! \file ao.cpp
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+#include "ao.h"
+#include "sources.h"
+
+
+Image render_ao( const Mesh& mesh, const BVH& bvh, const Transform& view, const Transform& projection, const int width, const int height, const AOParams& params )
+{
+    Image image(width, height, Black());
+
+    // longueur des rayons d'occultation
+    float distance= params.distance;
+    if(distance <= 0)
+    {
+        Point pmin, pmax;
+        mesh.bounds(pmin, pmax);
+        distance= length(Vector(pmin, pmax)) / 10;
+    }
+
+    Transform inv= Inverse(Viewport(width, height) * projection * view);
+    const int tile= std::max(1, params.tile);
+    const int tiles_x= (width + tile -1) / tile;
+    const int tiles_y= (height + tile -1) / tile;
+    const int samples= std::max(1, params.samples);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int t= 0; t < tiles_x * tiles_y; t++)
+    {
+        const int xmin= (t % tiles_x) * tile;
+        const int ymin= (t / tiles_x) * tile;
+        const int xmax= std::min(width, xmin + tile);
+        const int ymax= std::min(height, ymin + tile);
+
+        // un generateur par bloc, l'image ne depend pas de l'ordre d'execution des threads
+        std::default_random_engine rng(t);
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+        // rayons d'occultation du bloc, samples rayons par pixel visible
+        std::vector<Ray> rays;
+        std::vector<int> pixels;
+        rays.reserve(tile * tile * samples);
+        pixels.reserve(tile * tile);
+
+        for(int py= ymin; py < ymax; py++)
+        for(int px= xmin; px < xmax; px++)
+        {
+            float x= px + u01(rng);
+            float y= py + u01(rng);
+            Ray ray(inv(Point(x, y, 0)), inv(Point(x, y, 1)));
+
+            Hit hit= bvh.intersect(ray);
+            if(!hit)
+                continue;
+
+            const TriangleData& triangle= mesh.triangle(hit.triangle_id);
+            Point p= point(hit, ray);
+            Vector pn= normal(hit, triangle);
+            if(dot(pn, ray.d) > 0)
+                pn= -pn;
+
+            World world(pn);
+            Point o= p + 0.0001f * distance * pn;
+            for(int i= 0; i < samples; i++)
+            {
+                Ray occlusion(o, world(sample_cosine(u01(rng), u01(rng))));
+                occlusion.tmax= distance;       // direction normalisee, tmax est la distance le long du rayon
+                rays.push_back(occlusion);
+            }
+
+            pixels.push_back(py * width + px);
+        }
+
+        // parcours du bvh pour tous les rayons du bloc
+        std::vector<int> occluded;
+        bvh.occluded(rays, occluded);
+
+        // cos theta / pi et la densite des directions se simplifient, il ne reste que la visibilite moyenne
+        for(int k= 0; k < int(pixels.size()); k++)
+        {
+            int visible= 0;
+            for(int i= 0; i < samples; i++)
+                if(!occluded[k * samples + i])
+                    visible++;
+
+            float ao= float(visible) / float(samples);
+            image(size_t(pixels[k]))= Color(ao, ao, ao, 1);
+        }
+    }
+
+    return image;
+}
@@ -0,0 +1,30 @@
+//! \file ao.h occultation ambiante, visibilite moyenne de l'hemisphere autour de chaque point visible.
+
+#ifndef _AO_H
+#define _AO_H
+
+#include "mat.h"
+#include "mesh.h"
+#include "image.h"
+
+#include "bvh.h"
+
+
+//! parametres de l'occultation ambiante.
+struct AOParams
+{
+    int samples;            //!< nombre de directions par pixel
+    float distance;         //!< longueur des rayons, les triangles plus eloignes n'occultent pas le point. 0 pour utiliser 1/10 de la diagonale de la scene
+    int tile;               //!< taille des blocs de pixels, les rayons d'occultation d'un bloc parcourent le bvh ensemble
+
+    AOParams( ) : samples(16), distance(0), tile(16) {}
+};
+
+/*! calcule l'occultation ambiante du point visible de chaque pixel, directions distribuees selon cos theta / pi.
+    l'estimateur se reduit a la proportion de rayons sans intersection, 1 pour un point completement visible, 0 pour les pixels sans intersection.
+    view, projection et viewport sont les transformations de la camera, cf Orbiter::view() et Orbiter::projection().
+    renvoie une image en valeurs lineaires, a enregistrer avec write_image_hdr().
+ */
+Image render_ao( const Mesh& mesh, const BVH& bvh, const Transform& view, const Transform& projection, const int width, const int height, const AOParams& params= AOParams() );
+
+#endif
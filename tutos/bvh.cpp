@@ -0,0 +1,181 @@
+//! \file bvh.cpp
+
+#include <cassert>
+#include <algorithm>
+
+#include "bvh.h"
+
+
+Node make_node( const BBox& bounds, const int left, const int right )
+{
+    Node node { bounds, left, right };
+    assert(node.internal());    // verifie que c'est bien un noeud...
+    return node;
+}
+
+Node make_leaf( const BBox& bounds, const int begin, const int end )
+{
+    Node node { bounds, -begin, -end };
+    assert(node.leaf());        // verifie que c'est bien une feuille...
+    return node;
+}
+
+
+struct triangle_less1
+{
+    int axis;
+    float cut;
+
+    triangle_less1( const int _axis, const float _cut ) : axis(_axis), cut(_cut) {}
+
+    bool operator() ( const Triangle& triangle ) const
+    {
+        // re-construit l'englobant du triangle
+        return triangle.bounds().centroid(axis) < cut;
+    }
+};
+
+
+int BVH::build( const Mesh& mesh )
+{
+    BBox bounds;
+    mesh.bounds(bounds.pmin, bounds.pmax);
+
+    // recupere les triangles
+    std::vector<Triangle> data;
+    data.reserve(mesh.triangle_count());
+    for(int id= 0; id < mesh.triangle_count(); id++)
+        data.emplace_back(mesh.triangle(id), id);
+
+    assert(data.size());
+
+    return build(bounds, data);
+}
+
+int BVH::build( const BBox& _bounds, const std::vector<Triangle>& _triangles )
+{
+    triangles= _triangles;  // copie les triangles pour les trier
+    nodes.clear();          // efface les noeuds
+    nodes.reserve(triangles.size());
+
+    // construit l'arbre...
+    root= build(_bounds, 0, triangles.size());
+    // et renvoie la racine
+    return root;
+}
+
+int BVH::build( const BBox& bounds, const int begin, const int end )
+{
+    if(end - begin <= 2)
+    {
+        // inserer une feuille et renvoyer son indice
+        int index= nodes.size();
+        nodes.push_back(make_leaf(bounds, begin, end));
+        return index;
+    }
+
+    // axe le plus etire de l'englobant
+    Vector d= Vector(bounds.pmin, bounds.pmax);
+    int axis;
+    if(d.x > d.y && d.x > d.z)  // x plus grand que y et z ?
+        axis= 0;
+    else if(d.y > d.z)          // y plus grand que z ? (et que x implicitement)
+        axis= 1;
+    else                        // x et y ne sont pas les plus grands...
+        axis= 2;
+
+    // coupe l'englobant au milieu
+    float cut= bounds.centroid(axis);
+
+    // repartit les triangles
+    Triangle *pm= std::partition(triangles.data() + begin, triangles.data() + end, triangle_less1(axis, cut));
+    int m= std::distance(triangles.data(), pm);
+
+    // la repartition des triangles peut echouer, et tous les triangles sont dans la meme partie...
+    // forcer quand meme un decoupage en 2 ensembles
+    if(m == begin || m == end)
+        m= (begin + end) / 2;
+    assert(m != begin);
+    assert(m != end);
+
+    // construire le fils gauche
+    // les triangles se trouvent dans [begin .. m)
+    BBox bounds_left= triangles[begin].bounds();
+    for(int i= begin+1; i < m; i++)
+        bounds_left.insert(triangles[i].bounds());
+    int left= build(bounds_left, begin, m);
+
+    // on recommence pour le fils droit
+    // les triangles se trouvent dans [m .. end)
+    BBox bounds_right= triangles[m].bounds();
+    for(int i= m+1; i < end; i++)
+        bounds_right.insert(triangles[i].bounds());
+    int right= build(bounds_right, m, end);
+
+    int index= nodes.size();
+    nodes.push_back(make_node(bounds, left, right));
+    return index;
+}
+
+
+void BVH::occluded( const std::vector<Ray>& rays, std::vector<int>& occluded ) const
+{
+    const int n= int(rays.size());
+    occluded.assign(n, 0);
+    if(root < 0 || n == 0)
+        return;
+
+    std::vector<Vector> invd(n);
+    for(int i= 0; i < n; i++)
+        invd[i]= Vector(1 / rays[i].d.x, 1 / rays[i].d.y, 1 / rays[i].d.z);
+
+    // rayons actifs de chaque noeud a visiter : les indices [begin .. end) de ids.
+    // les fils d'un noeud referencent les rayons actifs de leur pere, parcours en profondeur d'abord,
+    // les indices au dela de end ne sont plus utilises lorsque le noeud est visite et sont recycles.
+    // la taille de ids reste proportionnelle a n * la profondeur de l'arbre.
+    struct Entry { int index; int begin; int end; };
+    std::vector<Entry> stack;
+    std::vector<int> ids(n);
+    for(int i= 0; i < n; i++)
+        ids[i]= i;
+
+    stack.push_back( {root, 0, n} );
+    while(!stack.empty())
+    {
+        Entry entry= stack.back();
+        stack.pop_back();
+
+        // conserve les rayons sans intersection qui touchent l'englobant du noeud
+        const Node& node= nodes[entry.index];
+        int begin= entry.end;
+        if(int(ids.size()) < begin + entry.end - entry.begin)
+            ids.resize(2 * (begin + entry.end - entry.begin));
+
+        int *active= ids.data();
+        int end= begin;
+        for(int k= entry.begin; k < entry.end; k++)
+        {
+            int i= active[k];
+            if(!occluded[i] && node.bounds.intersect(rays[i], invd[i], rays[i].tmax))
+                active[end++]= i;
+        }
+        if(begin == end)
+            continue;
+
+        if(node.leaf())
+        {
+            for(int t= node.leaf_begin(); t < node.leaf_end(); t++)
+            for(int k= begin; k < end; k++)
+            {
+                int i= active[k];
+                if(!occluded[i] && triangles[t].intersect(rays[i], rays[i].tmax))
+                    occluded[i]= 1;
+            }
+        }
+        else
+        {
+            stack.push_back( {node.internal_right(), begin, end} );
+            stack.push_back( {node.internal_left(), begin, end} );
+        }
+    }
+}
@@ -0,0 +1,310 @@
+//! \file bvh.h rayons, triangles et arbre de boites englobantes, partages par les tutos de lancer de rayons.
+
+#ifndef _BVH_H
+#define _BVH_H
+
+#include <cassert>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+#include "vec.h"
+#include "mesh.h"
+
+
+//! rayon, origine o, direction d, intersections valides dans l'intervalle [0 tmax].
+struct Ray
+{
+    Point o;
+    float pad;
+    Vector d;
+    float tmax;
+
+    Ray( ) : o(), d(), tmax(0) {}
+    Ray( const Point& _o, const Point& _e ) : o(_o), d(Vector(_o, _e)), tmax(1) {}
+    Ray( const Point& _o, const Vector& _d ) : o(_o), d(_d), tmax(FLT_MAX) {}
+};
+
+
+//! intersection rayon / triangle.
+struct Hit
+{
+    int triangle_id;
+    float t;
+    float u, v;
+
+    Hit( ) : triangle_id(-1), t(0), u(0), v(0) {}       // pas d'intersection
+    Hit( const int _id, const float _t, const float _u, const float _v ) : triangle_id(_id), t(_t), u(_u), v(_v) {}
+
+    operator bool( ) const { return (triangle_id != -1); }      // renvoie vrai si l'intersection est initialisee...
+};
+
+//! renvoie la normale interpolee d'un triangle.
+inline Vector normal( const Hit& hit, const TriangleData& triangle )
+{
+    return normalize((1 - hit.u - hit.v) * Vector(triangle.na) + hit.u * Vector(triangle.nb) + hit.v * Vector(triangle.nc));
+}
+
+//! renvoie le point d'intersection sur le triangle.
+inline Point point( const Hit& hit, const TriangleData& triangle )
+{
+    return (1 - hit.u - hit.v) * Point(triangle.a) + hit.u * Point(triangle.b) + hit.v * Point(triangle.c);
+}
+
+//! renvoie le point d'intersection sur le rayon
+inline Point point( const Hit& hit, const Ray& ray )
+{
+    return ray.o + hit.t * ray.d;
+}
+
+
+//! boite englobante alignee sur les axes.
+struct BBox
+{
+    Point pmin, pmax;
+
+    BBox( ) : pmin(), pmax() {}
+
+    BBox( const Point& p ) : pmin(p), pmax(p) {}
+    BBox& insert( const Point& p ) { pmin= min(pmin, p); pmax= max(pmax, p); return *this; }
+    BBox& insert( const BBox& box ) { pmin= min(pmin, box.pmin); pmax= max(pmax, box.pmax); return *this; }
+
+    float centroid( const int axis ) const { return (pmin(axis) + pmax(axis)) / 2; }
+
+    //! renvoie l'aire de la boite, ou 0 si elle est vide.
+    float area( ) const
+    {
+        Vector d= Vector(pmin, pmax);
+        if(d.x < 0 || d.y < 0 || d.z < 0)
+            return 0;
+        return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+    }
+
+    //! intersection avec le rayon dans l'intervalle [0 htmax], invd= 1 / ray.d.
+    bool intersect( const Ray& ray, const Vector& invd, const float htmax ) const
+    {
+        Point rmin= pmin;
+        Point rmax= pmax;
+        if(ray.d.x < 0) std::swap(rmin.x, rmax.x);
+        if(ray.d.y < 0) std::swap(rmin.y, rmax.y);
+        if(ray.d.z < 0) std::swap(rmin.z, rmax.z);
+        Vector dmin= (rmin - ray.o) * invd;
+        Vector dmax= (rmax - ray.o) * invd;
+
+        float tmin= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, 0.f)));
+        float tmax= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, htmax)));
+        return (tmin <= tmax);
+    }
+};
+
+
+//! triangle "intersectable".
+struct Triangle
+{
+    Point p;            // sommet a du triangle
+    Vector e1, e2;      // aretes ab, ac du triangle
+    int id;             // indice du triangle dans le mesh
+
+    Triangle( const Point& _a, const Point& _b, const Point& _c, const int _id ) : p(_a), e1(Vector(_a, _b)), e2(Vector(_a, _c)), id(_id) {}
+    Triangle( const TriangleData& data, const int _id ) : p(data.a), e1(Vector(data.a, data.b)), e2(Vector(data.a, data.c)), id(_id) {}
+
+    //! renvoie l'englobant du triangle.
+    BBox bounds( ) const
+    {
+        BBox bbox(p);
+        bbox.insert(p + e1);
+        bbox.insert(p + e2);
+        return bbox;
+    }
+
+    /* calcule l'intersection ray/triangle
+        cf "fast, minimum storage ray-triangle intersection"
+        http://www.graphics.cornell.edu/pubs/1997/MT97.pdf
+
+        renvoie faux s'il n'y a pas d'intersection valide (une intersection peut exister mais peut ne pas se trouver dans l'intervalle [0 htmax] du rayon.)
+        renvoie vrai + les coordonnees barycentriques (u, v) du point d'intersection + sa position le long du rayon (t).
+        convention barycentrique : p(u, v)= (1 - u - v) * a + u * b + v * c
+    */
+    Hit intersect( const Ray &ray, const float htmax ) const
+    {
+        Vector pvec= cross(ray.d, e2);
+        float det= dot(e1, pvec);
+
+        float inv_det= 1 / det;
+        Vector tvec(p, ray.o);
+
+        float u= dot(tvec, pvec) * inv_det;
+        if(u < 0 || u > 1) return Hit();
+
+        Vector qvec= cross(tvec, e1);
+        float v= dot(ray.d, qvec) * inv_det;
+        if(v < 0 || u + v > 1) return Hit();
+
+        float t= dot(e2, qvec) * inv_det;
+        if(!(t >= 0 && t <= htmax)) return Hit();       // rejette aussi t= nan, triangle degenere
+
+        return Hit(id, t, u, v);           // p(u, v)= (1 - u - v) * a + u * b + v * c
+    }
+};
+
+
+//! noeud de l'arbre / BVH.
+struct Node
+{
+    BBox bounds;
+    int left;
+    int right;
+
+    bool internal( ) const { return right > 0; }                        // renvoie vrai si le noeud est un noeud interne
+    int internal_left( ) const { assert(internal()); return left; }     // renvoie le fils gauche du noeud interne
+    int internal_right( ) const { assert(internal()); return right; }   // renvoie le fils droit
+
+    bool leaf( ) const { return right < 0; }                            // renvoie vrai si le noeud est une feuille
+    int leaf_begin( ) const { assert(leaf()); return -left; }           // renvoie le premier objet de la feuille
+    int leaf_end( ) const { assert(leaf()); return -right; }            // renvoie le dernier objet
+};
+
+//! creation d'un noeud interne.
+Node make_node( const BBox& bounds, const int left, const int right );
+//! creation d'une feuille.
+Node make_leaf( const BBox& bounds, const int begin, const int end );
+
+
+//! statistiques de parcours d'un rayon : noeuds visites, tests rayon / englobant et rayon / triangle.
+struct RayStats
+{
+    int nodes;
+    int boxes;
+    int triangles;
+
+    RayStats( ) : nodes(0), boxes(0), triangles(0) {}
+
+    void node( ) { nodes++; }
+    void box( ) { boxes++; }
+    void triangle( ) { triangles++; }
+};
+
+//! pas de statistiques, les compteurs disparaissent a la compilation.
+struct NoStats
+{
+    void node( ) {}
+    void box( ) {}
+    void triangle( ) {}
+};
+
+
+//! arbre de boites englobantes, construit en coupant l'englobant des triangles au milieu de son axe le plus etire.
+struct BVH
+{
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    int root;
+
+    BVH( ) : nodes(), triangles(), root(-1) {}
+    BVH( const Mesh& mesh ) : nodes(), triangles(), root(-1) { build(mesh); }
+
+    //! construit un bvh pour les triangles d'un mesh.
+    int build( const Mesh& mesh );
+    //! construit un bvh pour l'ensemble de triangles.
+    int build( const BBox& bounds, const std::vector<Triangle>& triangles );
+
+    //! renvoie l'intersection la plus proche de l'origine du rayon dans l'intervalle [0 ray.tmax].
+    Hit intersect( const Ray& ray ) const
+    {
+        NoStats stats;
+        return intersect(ray, stats);
+    }
+
+    //! renvoie vrai s'il n'y a pas d'intersection dans l'intervalle [0 ray.tmax], ie les extremites du rayon sont visibles l'une depuis l'autre.
+    bool visible( const Ray& ray ) const
+    {
+        NoStats stats;
+        return visible(ray, stats);
+    }
+
+    /*! visibilite pour un groupe de rayons, les rayons d'un bloc de pixels, par exemple.
+        renvoie occluded[i] != 0 s'il existe une intersection dans l'intervalle [0 rays[i].tmax].
+        les rayons parcourent l'arbre ensemble, chaque noeud est charge une seule fois pour tous les rayons qui touchent son englobant, 
+        et un rayon arrete son parcours des qu'une intersection est trouvee.
+     */
+    void occluded( const std::vector<Ray>& rays, std::vector<int>& occluded ) const;
+
+    //! intersection la plus proche, et comptage des operations realisees par le parcours, cf RayStats.
+    template < typename Stats >
+    Hit intersect( const Ray& ray, Stats& stats ) const
+    {
+        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+        Hit hit;
+        hit.t= ray.tmax;
+        intersect(root, ray, invd, hit, stats);
+        return hit;
+    }
+
+    //! visibilite, et comptage des operations realisees par le parcours, cf RayStats.
+    template < typename Stats >
+    bool visible( const Ray& ray, Stats& stats ) const
+    {
+        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+        return visible(root, ray, invd, stats);
+    }
+
+    //! renvoie la memoire utilisee par l'arbre et les triangles, en octets.
+    size_t memory( ) const { return nodes.size() * sizeof(Node) + triangles.size() * sizeof(Triangle); }
+
+protected:
+    int build( const BBox& bounds, const int begin, const int end );
+
+    template < typename Stats >
+    void intersect( const int index, const Ray& ray, const Vector& invd, Hit& hit, Stats& stats ) const
+    {
+        const Node& node= nodes[index];
+        stats.box();
+        if(node.bounds.intersect(ray, invd, hit.t))
+        {
+            stats.node();
+            if(node.leaf())
+            {
+                for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
+                {
+                    stats.triangle();
+                    if(Hit h= triangles[i].intersect(ray, hit.t))
+                        hit= h;
+                }
+            }
+            else // if(node.internal())
+            {
+                intersect(node.internal_left(), ray, invd, hit, stats);
+                intersect(node.internal_right(), ray, invd, hit, stats);
+            }
+        }
+    }
+
+    template < typename Stats >
+    bool visible( const int index, const Ray& ray, const Vector& invd, Stats& stats ) const
+    {
+        const Node& node= nodes[index];
+        stats.box();
+        if(node.bounds.intersect(ray, invd, ray.tmax))
+        {
+            stats.node();
+            if(node.leaf())
+            {
+                for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
+                {
+                    stats.triangle();
+                    if(triangles[i].intersect(ray, ray.tmax))
+                        // pas la peine de continuer, il y a un triangle entre les extremites du rayon
+                        return false;
+                }
+            }
+            else // if(node.internal())
+            {
+                return visible(node.internal_left(), ray, invd, stats) && visible(node.internal_right(), ray, invd, stats);
+            }
+        }
+
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,139 @@
+//! \file bvh_quality.cpp
+
+#include <cstdio>
+#include <algorithm>
+
+#include "bvh_quality.h"
+
+
+BVHQuality bvh_quality( const BVH& bvh, const float box_cost, const float triangle_cost )
+{
+    BVHQuality quality;
+    if(bvh.root < 0)
+        return quality;
+
+    float root_area= bvh.nodes[bvh.root].bounds.area();
+    if(root_area <= 0)
+        root_area= 1;
+
+    float overlap_area= 0;
+    float internal_area= 0;
+    double depth_sum= 0;
+
+    // parcours en profondeur, pile explicite
+    struct Entry { int index; int depth; };
+    std::vector<Entry> stack;
+    stack.push_back( {bvh.root, 0} );
+    while(!stack.empty())
+    {
+        Entry entry= stack.back();
+        stack.pop_back();
+
+        const Node& node= bvh.nodes[entry.index];
+        float p= node.bounds.area() / root_area;         // probabilite de toucher l'englobant du noeud
+        quality.predicted_nodes+= p;
+
+        if(node.leaf())
+        {
+            int n= node.leaf_end() - node.leaf_begin();
+            quality.predicted_triangles+= p * n;
+
+            quality.leaves++;
+            depth_sum+= entry.depth;
+            quality.depth_max= std::max(quality.depth_max, entry.depth);
+
+            if(int(quality.depths.size()) <= entry.depth)
+                quality.depths.resize(entry.depth +1, 0);
+            quality.depths[entry.depth]++;
+
+            if(int(quality.leaf_sizes.size()) <= n)
+                quality.leaf_sizes.resize(n +1, 0);
+            quality.leaf_sizes[n]++;
+        }
+        else
+        {
+            // les englobants des 2 fils sont testes si le rayon touche l'englobant du noeud
+            quality.predicted_boxes+= 2 * p;
+            quality.nodes++;
+
+            const BBox& left= bvh.nodes[node.internal_left()].bounds;
+            const BBox& right= bvh.nodes[node.internal_right()].bounds;
+            BBox both;
+            both.pmin= max(left.pmin, right.pmin);
+            both.pmax= min(left.pmax, right.pmax);
+
+            overlap_area+= both.area();
+            internal_area+= node.bounds.area();
+
+            stack.push_back( {node.internal_left(), entry.depth +1} );
+            stack.push_back( {node.internal_right(), entry.depth +1} );
+        }
+    }
+
+    // + le test de l'englobant de la racine
+    quality.predicted_boxes+= 1;
+
+    quality.sah= box_cost * quality.predicted_boxes + triangle_cost * quality.predicted_triangles;
+    quality.overlap= internal_area > 0 ? overlap_area / internal_area : 0;
+    quality.depth_avg= quality.leaves > 0 ? float(depth_sum / quality.leaves) : 0;
+    return quality;
+}
+
+
+void bvh_measure( const BVH& bvh, const std::vector<Ray>& rays, BVHQuality& quality, const float box_cost, const float triangle_cost )
+{
+    const int n= int(rays.size());
+
+    long int count= 0;
+    long int nodes= 0;
+    long int boxes= 0;
+    long int triangles= 0;
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+: count, nodes, boxes, triangles)
+    for(int i= 0; i < n; i++)
+    {
+        RayStats stats;
+        bvh.intersect(rays[i], stats);
+
+        // ne compte que les rayons qui touchent la racine, comme la prediction
+        if(stats.nodes > 0)
+        {
+            count++;
+            nodes+= stats.nodes;
+            boxes+= stats.boxes;
+            triangles+= stats.triangles;
+        }
+    }
+
+    quality.measured_rays= int(count);
+    if(count == 0)
+        return;
+
+    quality.measured_nodes= float(nodes) / float(count);
+    quality.measured_boxes= float(boxes) / float(count);
+    quality.measured_triangles= float(triangles) / float(count);
+    quality.measured_cost= box_cost * quality.measured_boxes + triangle_cost * quality.measured_triangles;
+}
+
+
+void bvh_print( const BVHQuality& quality )
+{
+    printf("bvh: %d nodes, %d leaves\n", quality.nodes, quality.leaves);
+    printf("  sah cost %.2f, overlap %.2f%%\n", quality.sah, quality.overlap * 100);
+    printf("  depth avg %.2f, max %d\n", quality.depth_avg, quality.depth_max);
+
+    printf("  leaves per depth:");
+    for(int i= 0; i < int(quality.depths.size()); i++)
+        printf(" %d", quality.depths[i]);
+    printf("\n");
+
+    printf("  leaves per size:");
+    for(int i= 0; i < int(quality.leaf_sizes.size()); i++)
+        printf(" [%d] %d", i, quality.leaf_sizes[i]);
+    printf("\n");
+
+    printf("  predicted per ray: %.2f nodes, %.2f boxes, %.2f triangles, cost %.2f\n",
+        quality.predicted_nodes, quality.predicted_boxes, quality.predicted_triangles, quality.sah);
+    if(quality.measured_rays > 0)
+        printf("  measured per ray: %.2f nodes, %.2f boxes, %.2f triangles, cost %.2f (%d rays)\n",
+            quality.measured_nodes, quality.measured_boxes, quality.measured_triangles, quality.measured_cost, quality.measured_rays);
+}
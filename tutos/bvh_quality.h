@@ -0,0 +1,53 @@
+//! \file bvh_quality.h mesures de qualite d'un bvh : cout SAH, recouvrement des fils, profondeur et taille des feuilles.
+
+#ifndef _BVH_QUALITY_H
+#define _BVH_QUALITY_H
+
+#include <vector>
+
+#include "bvh.h"
+
+
+/*! qualite d'un arbre.
+    les predictions utilisent la surface area heuristic : un rayon qui touche l'englobant d'un noeud touche l'englobant d'un fils avec une probabilite
+    egale au rapport de leurs aires. les valeurs predites sont le nombre moyen d'operations par rayon qui touche l'englobant de la racine, sans
+    tenir compte de l'arret du parcours sur l'intersection la plus proche.
+ */
+struct BVHQuality
+{
+    int nodes;                          //!< nombre de noeuds internes
+    int leaves;                         //!< nombre de feuilles
+
+    float sah;                          //!< cout SAH total, box_cost * boxes + triangle_cost * triangles
+    float overlap;                      //!< somme des aires d'intersection des fils / somme des aires des noeuds internes
+
+    int depth_max;                      //!< profondeur maximale d'une feuille
+    float depth_avg;                    //!< profondeur moyenne des feuilles
+    std::vector<int> depths;            //!< nombre de feuilles par profondeur
+    std::vector<int> leaf_sizes;        //!< nombre de feuilles par nombre de triangles
+
+    float predicted_nodes;              //!< noeuds visites par rayon, predits
+    float predicted_boxes;              //!< tests rayon / englobant par rayon, predits
+    float predicted_triangles;          //!< tests rayon / triangle par rayon, predits
+
+    int measured_rays;                  //!< nombre de rayons mesures qui touchent la racine, 0 si aucune mesure
+    float measured_nodes;               //!< noeuds visites par rayon, mesures
+    float measured_boxes;               //!< tests rayon / englobant par rayon, mesures
+    float measured_triangles;           //!< tests rayon / triangle par rayon, mesures
+    float measured_cost;                //!< cout mesure, box_cost * boxes + triangle_cost * triangles
+
+    BVHQuality( ) : nodes(0), leaves(0), sah(0), overlap(0), depth_max(0), depth_avg(0), depths(), leaf_sizes(),
+        predicted_nodes(0), predicted_boxes(0), predicted_triangles(0),
+        measured_rays(0), measured_nodes(0), measured_boxes(0), measured_triangles(0), measured_cost(0) {}
+};
+
+//! evalue la qualite de l'arbre, parcourt les noeuds de bvh.nodes depuis la racine. box_cost et triangle_cost ponderent les tests.
+BVHQuality bvh_quality( const BVH& bvh, const float box_cost= 1, const float triangle_cost= 1 );
+
+//! mesure le nombre moyen d'operations realisees par les rayons qui touchent la racine, a comparer aux predictions.
+void bvh_measure( const BVH& bvh, const std::vector<Ray>& rays, BVHQuality& quality, const float box_cost= 1, const float triangle_cost= 1 );
+
+//! affiche un resume.
+void bvh_print( const BVHQuality& quality );
+
+#endif
@@ -0,0 +1,780 @@
+//! \file cluster_bvh.cpp
+
+#include <cmath>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+
+#include "cluster_bvh.h"
+
+
+// identifiant du format de fichier
+static const char cluster_magic[8]= "gkclus1";
+
+
+static int seek( FILE *file, const int64_t offset )
+{
+#ifdef _MSC_VER
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, offset, SEEK_SET);
+#endif
+}
+
+static int64_t tell( FILE *file )
+{
+#ifdef _MSC_VER
+    return _ftelli64(file);
+#else
+    return ftello(file);
+#endif
+}
+
+
+// triangle en cours de repartition dans les clusters, positions des sommets et indice dans le fichier .obj
+struct ClusterTriangle
+{
+    vec3 a, b, c;
+    int id;
+};
+
+
+// etape 1 : lit les positions et ecrit les indices des sommets des triangles dans le fichier temporaire
+static int read_triangles( const char *obj_filename, FILE *out, std::vector<vec3>& positions, int64_t& count )
+{
+    FILE *in= fopen(obj_filename, "rt");
+    if(in == NULL)
+    {
+        printf("[error] loading mesh '%s'...\n", obj_filename);
+        return -1;
+    }
+
+    printf("loading mesh '%s'...\n", obj_filename);
+
+    std::vector<int> idp;
+    count= 0;
+
+    char line_buffer[1024];
+    bool error= true;
+    for(;;)
+    {
+        // charge une ligne du fichier
+        if(fgets(line_buffer, sizeof(line_buffer), in) == NULL)
+        {
+            error= false;       // fin du fichier, pas d'erreur detectee
+            break;
+        }
+
+        // force la fin de la ligne, au cas ou
+        line_buffer[sizeof(line_buffer) -1]= 0;
+
+        // saute les espaces en debut de ligne
+        char *line= line_buffer;
+        while(*line && isspace(*line))
+            line++;
+
+        if(line[0] == 'v' && line[1] == ' ')    // position x y z
+        {
+            float x, y, z;
+            if(sscanf(line, "v %f %f %f", &x, &y, &z) != 3)
+                break;
+            positions.push_back( vec3(x, y, z) );
+        }
+
+        else if(line[0] == 'f')         // triangle a b c, les sommets sont numerotes a partir de 1 ou de la fin du tableau (< 0)
+        {
+            idp.clear();
+
+            int next;
+            for(line= line +1; ; line= line + next)
+            {
+                int idt, idn;
+                idp.push_back(0);       // 0: invalid index
+
+                next= 0;
+                if(sscanf(line, " %d/%d/%d %n", &idp.back(), &idt, &idn, &next) == 3)
+                    continue;
+                else if(sscanf(line, " %d/%d %n", &idp.back(), &idt, &next) == 2)
+                    continue;
+                else if(sscanf(line, " %d//%d %n", &idp.back(), &idn, &next) == 2)
+                    continue;
+                else if(sscanf(line, " %d %n", &idp.back(), &next) == 1)
+                    continue;
+                else if(next == 0)      // fin de ligne
+                    break;
+            }
+
+            bool valid= true;
+            for(int v= 2; v +1 < (int) idp.size(); v++)
+            {
+                int idv[3]= { 0, v -1, v };
+                int triangle[3];
+                for(int i= 0; i < 3; i++)
+                {
+                    int k= idv[i];
+                    triangle[i]= (idp[k] < 0) ? (int) positions.size() + idp[k] : idp[k] -1;
+                }
+
+                if(triangle[0] < 0 || triangle[1] < 0 || triangle[2] < 0)
+                    continue;   // error
+                if(triangle[0] >= (int) positions.size() || triangle[1] >= (int) positions.size() || triangle[2] >= (int) positions.size())
+                {
+                    // sommet inexistant, fichier tronque ou mal forme
+                    valid= false;
+                    break;
+                }
+                if(count == INT_MAX)
+                {
+                    printf("[error] too many triangles...\n");
+                    fclose(in);
+                    return -1;
+                }
+
+                fwrite(triangle, sizeof(int), 3, out);
+                count++;
+            }
+
+            if(!valid)
+                break;
+        }
+    }
+
+    fclose(in);
+
+    if(error)
+    {
+        printf("[error] loading mesh '%s'...\n%s\n\n", obj_filename, line_buffer);
+        return -1;
+    }
+
+    printf("mesh '%s': %d positions, %ld triangles\n", obj_filename, int(positions.size()), long(count));
+    return 0;
+}
+
+
+// grille reguliere sur l'englobant des sommets, cellules a peu pres cubiques
+struct ClusterGrid
+{
+    Point pmin;
+    Vector scale;
+    int size[3];
+
+    ClusterGrid( const BBox& bounds, const int64_t cells ) : pmin(bounds.pmin), scale()
+    {
+        Vector d= Vector(bounds.pmin, bounds.pmax);
+        // objets plats, une seule cellule dans l'epaisseur
+        float e= std::max(length(d) * 1e-3f, 1e-6f);
+        d= Vector(std::max(d.x, e), std::max(d.y, e), std::max(d.z, e));
+
+        float cell= std::cbrt(d.x * d.y * d.z / float(std::max(int64_t(1), cells)));
+        for(int i= 0; i < 3; i++)
+            size[i]= std::max(1, std::min(1024, int(std::ceil(d(i) / cell))));
+
+        scale= Vector(size[0] / d.x, size[1] / d.y, size[2] / d.z);
+    }
+
+    int count( ) const { return size[0] * size[1] * size[2]; }
+    int index( const int x, const int y, const int z ) const { return (z * size[1] + y) * size[0] + x; }
+
+    //! cellule contenant le point.
+    int cell( const Point& p ) const
+    {
+        Vector d= (p - pmin) * scale;
+        int x= std::max(0, std::min(size[0] -1, int(d.x)));
+        int y= std::max(0, std::min(size[1] -1, int(d.y)));
+        int z= std::max(0, std::min(size[2] -1, int(d.z)));
+        return index(x, y, z);
+    }
+};
+
+
+// etape 2 : decoupe recursivement la grille en 2 regions contenant le meme nombre de triangles, jusqu'a respecter la taille des clusters
+static void partition( const ClusterGrid& grid, const std::vector<int>& counts, const int lo[3], const int hi[3], const int cluster_size,
+    std::vector<int>& cell_clusters, std::vector<int64_t>& cluster_counts )
+{
+    // nombre de triangles par tranche de la region, sur chaque axe
+    std::vector<int64_t> slices[3];
+    for(int i= 0; i < 3; i++)
+        slices[i].assign(hi[i] - lo[i], 0);
+
+    int64_t total= 0;
+    for(int z= lo[2]; z < hi[2]; z++)
+    for(int y= lo[1]; y < hi[1]; y++)
+    for(int x= lo[0]; x < hi[0]; x++)
+    {
+        int n= counts[grid.index(x, y, z)];
+        slices[0][x - lo[0]]+= n;
+        slices[1][y - lo[1]]+= n;
+        slices[2][z - lo[2]]+= n;
+        total+= n;
+    }
+
+    if(total == 0)
+        return;
+
+    // axe le plus long de la region, en nombre de cellules
+    int axis= 0;
+    for(int i= 1; i < 3; i++)
+        if(hi[i] - lo[i] > hi[axis] - lo[axis])
+            axis= i;
+
+    if(total <= cluster_size || hi[axis] - lo[axis] == 1)
+    {
+        // nouveau cluster
+        int id= int(cluster_counts.size());
+        cluster_counts.push_back(total);
+        for(int z= lo[2]; z < hi[2]; z++)
+        for(int y= lo[1]; y < hi[1]; y++)
+        for(int x= lo[0]; x < hi[0]; x++)
+            cell_clusters[grid.index(x, y, z)]= id;
+        return;
+    }
+
+    // coupe sur la tranche mediane
+    int64_t sum= 0;
+    int m= lo[axis] +1;
+    for(int i= lo[axis]; i < hi[axis] -1; i++)
+    {
+        sum+= slices[axis][i - lo[axis]];
+        m= i +1;
+        if(2 * sum >= total)
+            break;
+    }
+
+    int left_hi[3]= { hi[0], hi[1], hi[2] };
+    int right_lo[3]= { lo[0], lo[1], lo[2] };
+    left_hi[axis]= m;
+    right_lo[axis]= m;
+    partition(grid, counts, lo, left_hi, cluster_size, cell_clusters, cluster_counts);
+    partition(grid, counts, right_lo, hi, cluster_size, cell_clusters, cluster_counts);
+}
+
+
+// ecrit les triangles en attente a leur place dans le fichier temporaire des clusters
+static void flush( FILE *out, std::vector< std::vector<ClusterTriangle> >& buffers, const std::vector<int64_t>& offsets, std::vector<int64_t>& written )
+{
+    for(int i= 0; i < int(buffers.size()); i++)
+    {
+        if(buffers[i].empty())
+            continue;
+
+        seek(out, (offsets[i] + written[i]) * int64_t(sizeof(ClusterTriangle)));
+        fwrite(buffers[i].data(), sizeof(ClusterTriangle), buffers[i].size(), out);
+        written[i]+= buffers[i].size();
+        buffers[i].clear();
+    }
+}
+
+
+int build_clusters( const char *obj_filename, const char *filename, const int cluster_size, const size_t buffer )
+{
+    std::string indices_filename= std::string(filename) + ".tmp0";
+    std::string triangles_filename= std::string(filename) + ".tmp1";
+
+    // etape 1 : positions en memoire, indices des triangles dans un fichier temporaire
+    FILE *indices= fopen(indices_filename.c_str(), "w+b");
+    if(indices == NULL)
+    {
+        printf("[error] writing '%s'...\n", indices_filename.c_str());
+        return -1;
+    }
+
+    std::vector<vec3> positions;
+    int64_t count= 0;
+    if(read_triangles(obj_filename, indices, positions, count) < 0 || count == 0)
+    {
+        fclose(indices);
+        remove(indices_filename.c_str());
+        return -1;
+    }
+
+    BBox bounds= BBox(Point(positions[0]));
+    for(int i= 1; i < int(positions.size()); i++)
+        bounds.insert(Point(positions[i]));
+
+    // relit les triangles par blocs
+    const int block_size= 65536;
+    std::vector<int> block(3 * block_size);
+    auto centroid= [&]( const int *triangle ) {
+        return (Point(positions[triangle[0]]) + Point(positions[triangle[1]]) + Point(positions[triangle[2]])) / 3;
+    };
+
+    // etape 2 : compte les triangles par cellule, environ 16 triangles par cellule
+    ClusterGrid grid(bounds, std::min(count / 16, int64_t(1) << 22));
+    std::vector<int> counts(grid.count(), 0);
+
+    seek(indices, 0);
+    for(int64_t begin= 0; begin < count; begin+= block_size)
+    {
+        int n= int(std::min(int64_t(block_size), count - begin));
+        if(fread(block.data(), sizeof(int), 3 * n, indices) != size_t(3 * n))
+        {
+            printf("[error] reading '%s'...\n", indices_filename.c_str());
+            fclose(indices);
+            remove(indices_filename.c_str());
+            return -1;
+        }
+
+        for(int i= 0; i < n; i++)
+            counts[grid.cell(centroid(&block[3 * i]))]++;
+    }
+
+    std::vector<int> cell_clusters(grid.count(), -1);
+    std::vector<int64_t> cluster_counts;
+    {
+        int lo[3]= { 0, 0, 0 };
+        partition(grid, counts, lo, grid.size, cluster_size, cell_clusters, cluster_counts);
+    }
+
+    const int clusters= int(cluster_counts.size());
+    printf("clusters: grid %dx%dx%d, %d clusters\n", grid.size[0], grid.size[1], grid.size[2], clusters);
+
+    // etape 3 : repartit les triangles dans les clusters, les triangles d'un cluster sont consecutifs dans le fichier temporaire
+    FILE *tmp= fopen(triangles_filename.c_str(), "w+b");
+    if(tmp == NULL)
+    {
+        printf("[error] writing '%s'...\n", triangles_filename.c_str());
+        fclose(indices);
+        remove(indices_filename.c_str());
+        return -1;
+    }
+
+    std::vector<int64_t> offsets(clusters +1, 0);
+    for(int i= 0; i < clusters; i++)
+        offsets[i +1]= offsets[i] + cluster_counts[i];
+
+    std::vector< std::vector<ClusterTriangle> > buffers(clusters);
+    std::vector<int64_t> written(clusters, 0);
+    size_t pending= 0;
+    const size_t max_pending= std::max(size_t(block_size), buffer / sizeof(ClusterTriangle));
+
+    seek(indices, 0);
+    for(int64_t begin= 0; begin < count; begin+= block_size)
+    {
+        int n= int(std::min(int64_t(block_size), count - begin));
+        if(fread(block.data(), sizeof(int), 3 * n, indices) != size_t(3 * n))
+        {
+            printf("[error] reading '%s'...\n", indices_filename.c_str());
+            fclose(tmp);
+            fclose(indices);
+            remove(triangles_filename.c_str());
+            remove(indices_filename.c_str());
+            return -1;
+        }
+
+        for(int i= 0; i < n; i++)
+        {
+            const int *triangle= &block[3 * i];
+            int id= cell_clusters[grid.cell(centroid(triangle))];
+            buffers[id].push_back( { positions[triangle[0]], positions[triangle[1]], positions[triangle[2]], int(begin + i) } );
+        }
+
+        pending+= n;
+        if(pending >= max_pending)
+        {
+            flush(tmp, buffers, offsets, written);
+            pending= 0;
+        }
+    }
+    flush(tmp, buffers, offsets, written);
+
+    fclose(indices);
+    remove(indices_filename.c_str());
+    // les positions ne sont plus necessaires
+    positions= std::vector<vec3>();
+
+    // etape 4 : construit le bvh de chaque cluster et l'ecrit dans le fichier final
+    FILE *out= fopen(filename, "wb");
+    if(out == NULL)
+    {
+        printf("[error] writing clusters '%s'...\n", filename);
+        fclose(tmp);
+        remove(triangles_filename.c_str());
+        return -1;
+    }
+
+    // entete : identifiant, nombre de clusters et de triangles, englobant, position de la table des clusters, completee a la fin
+    int64_t table= 0;
+    fwrite(cluster_magic, sizeof(cluster_magic), 1, out);
+    fwrite(&clusters, sizeof(int), 1, out);
+    fwrite(&count, sizeof(int64_t), 1, out);
+    fwrite(&bounds, sizeof(BBox), 1, out);
+    int64_t table_position= tell(out);
+    fwrite(&table, sizeof(int64_t), 1, out);
+
+    struct ClusterInfo { BBox bounds; int64_t offset; int nodes; int triangles; int root; };
+    std::vector<ClusterInfo> infos(clusters);
+
+    std::vector<ClusterTriangle> data;
+    std::vector<Triangle> triangles;
+    std::vector<int> ids;
+    for(int c= 0; c < clusters; c++)
+    {
+        int n= int(cluster_counts[c]);
+        data.resize(n);
+        seek(tmp, offsets[c] * int64_t(sizeof(ClusterTriangle)));
+        if(fread(data.data(), sizeof(ClusterTriangle), n, tmp) != size_t(n))
+        {
+            printf("[error] reading '%s'...\n", triangles_filename.c_str());
+            fclose(out);
+            fclose(tmp);
+            remove(triangles_filename.c_str());
+            remove(filename);
+            return -1;
+        }
+
+        triangles.clear();
+        for(int i= 0; i < n; i++)
+            triangles.emplace_back(Point(data[i].a), Point(data[i].b), Point(data[i].c), i);
+
+        BBox cluster_bounds= triangles[0].bounds();
+        for(int i= 1; i < n; i++)
+            cluster_bounds.insert(triangles[i].bounds());
+
+        BVH bvh;
+        bvh.build(cluster_bounds, triangles);
+
+        // les triangles sont tries par la construction, Triangle::id devient l'indice du triangle dans le cluster
+        ids.resize(n);
+        for(int i= 0; i < n; i++)
+        {
+            ids[i]= data[bvh.triangles[i].id].id;
+            bvh.triangles[i].id= i;
+        }
+
+        infos[c]= { cluster_bounds, tell(out), int(bvh.nodes.size()), n, bvh.root };
+        fwrite(bvh.nodes.data(), sizeof(Node), bvh.nodes.size(), out);
+        fwrite(bvh.triangles.data(), sizeof(Triangle), bvh.triangles.size(), out);
+        fwrite(ids.data(), sizeof(int), ids.size(), out);
+    }
+
+    fclose(tmp);
+    remove(triangles_filename.c_str());
+
+    // table des clusters
+    table= tell(out);
+    for(int c= 0; c < clusters; c++)
+    {
+        fwrite(&infos[c].bounds, sizeof(BBox), 1, out);
+        fwrite(&infos[c].offset, sizeof(int64_t), 1, out);
+        fwrite(&infos[c].nodes, sizeof(int), 1, out);
+        fwrite(&infos[c].triangles, sizeof(int), 1, out);
+        fwrite(&infos[c].root, sizeof(int), 1, out);
+    }
+
+    seek(out, table_position);
+    fwrite(&table, sizeof(int64_t), 1, out);
+
+    bool error= ferror(out);
+    fclose(out);
+    if(error)
+    {
+        printf("[error] writing clusters '%s'...\n", filename);
+        remove(filename);
+        return -1;
+    }
+
+    printf("clusters '%s': %d clusters, %ld triangles\n", filename, clusters, long(count));
+    return 0;
+}
+
+
+// intersection rayon / englobant, renvoie aussi la distance d'entree dans la boite
+static bool intersect_bounds( const BBox& bounds, const Ray& ray, const Vector& invd, const float htmax, float& t )
+{
+    Point rmin= bounds.pmin;
+    Point rmax= bounds.pmax;
+    if(ray.d.x < 0) std::swap(rmin.x, rmax.x);
+    if(ray.d.y < 0) std::swap(rmin.y, rmax.y);
+    if(ray.d.z < 0) std::swap(rmin.z, rmax.z);
+    Vector dmin= (rmin - ray.o) * invd;
+    Vector dmax= (rmax - ray.o) * invd;
+
+    float tmin= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, 0.f)));
+    float tmax= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, htmax)));
+    t= tmin;
+    return (tmin <= tmax);
+}
+
+
+ClusterBVH::ClusterBVH( const char *filename, const size_t budget ) : m_clusters(), m_nodes(), m_ids(), m_root(-1), m_bounds(), m_triangle_count(0),
+    m_file(nullptr), m_file_lock(), m_entries(), m_lru(), m_lock(),
+    m_budget(budget), m_memory(0), m_peak(0), m_hits(0), m_misses(0), m_loads(0), m_evictions(0), m_bytes(0)
+{
+    FILE *in= fopen(filename, "rb");
+    if(in == NULL)
+    {
+        printf("[error] loading clusters '%s'...\n", filename);
+        return;
+    }
+
+    char magic[8];
+    int clusters= 0;
+    int64_t table= 0;
+    bool error= (fread(magic, sizeof(magic), 1, in) != 1 || memcmp(magic, cluster_magic, sizeof(magic)) != 0)
+        || fread(&clusters, sizeof(int), 1, in) != 1
+        || fread(&m_triangle_count, sizeof(int64_t), 1, in) != 1
+        || fread(&m_bounds, sizeof(BBox), 1, in) != 1
+        || fread(&table, sizeof(int64_t), 1, in) != 1
+        || clusters <= 0 || seek(in, table) != 0;
+
+    m_clusters.resize(error ? 0 : clusters);
+    for(int c= 0; c < int(m_clusters.size()) && !error; c++)
+    {
+        Cluster& cluster= m_clusters[c];
+        error= fread(&cluster.bounds, sizeof(BBox), 1, in) != 1
+            || fread(&cluster.offset, sizeof(int64_t), 1, in) != 1
+            || fread(&cluster.nodes, sizeof(int), 1, in) != 1
+            || fread(&cluster.triangles, sizeof(int), 1, in) != 1
+            || fread(&cluster.root, sizeof(int), 1, in) != 1;
+    }
+
+    if(error)
+    {
+        printf("[error] loading clusters '%s'...\n", filename);
+        m_clusters.clear();
+        fclose(in);
+        return;
+    }
+
+    m_file= in;
+
+    // construit l'arbre des clusters, coupe l'ensemble des centres sur la mediane de l'axe le plus etire, un cluster par feuille
+    m_ids.resize(clusters);
+    for(int i= 0; i < clusters; i++)
+        m_ids[i]= i;
+    m_nodes.reserve(2 * clusters);
+
+    m_root= build(0, clusters);
+
+    printf("clusters '%s': %d clusters, %ld triangles\n", filename, clusters, long(m_triangle_count));
+}
+
+ClusterBVH::~ClusterBVH( )
+{
+    if(m_file)
+        fclose(m_file);
+}
+
+
+int ClusterBVH::build( const int begin, const int end )
+{
+    BBox bounds= m_clusters[m_ids[begin]].bounds;
+    BBox centers(bounds.pmin + bounds.pmax);
+    for(int i= begin +1; i < end; i++)
+    {
+        const BBox& box= m_clusters[m_ids[i]].bounds;
+        bounds.insert(box);
+        centers.insert(box.pmin + box.pmax);
+    }
+
+    if(end - begin == 1)
+    {
+        // inserer une feuille et renvoyer son indice
+        int index= m_nodes.size();
+        m_nodes.push_back(make_leaf(bounds, begin, end));
+        return index;
+    }
+
+    // axe le plus etire de l'englobant des centres
+    Vector d= Vector(centers.pmin, centers.pmax);
+    int axis;
+    if(d.x > d.y && d.x > d.z)
+        axis= 0;
+    else if(d.y > d.z)
+        axis= 1;
+    else
+        axis= 2;
+
+    // coupe sur la mediane
+    int m= (begin + end) / 2;
+    const std::vector<Cluster>& clusters= m_clusters;
+    std::nth_element(m_ids.data() + begin, m_ids.data() + m, m_ids.data() + end,
+        [&]( const int a, const int b ) { return clusters[a].bounds.centroid(axis) < clusters[b].bounds.centroid(axis); });
+
+    int left= build(begin, m);
+    int right= build(m, end);
+
+    int index= m_nodes.size();
+    m_nodes.push_back(make_node(bounds, left, right));
+    return index;
+}
+
+
+void ClusterBVH::clusters( const Ray& ray, std::vector< std::pair<float, int> >& hits ) const
+{
+    hits.clear();
+    if(m_root < 0)
+        return;
+
+    Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+
+    int stack[64];
+    int top= 0;
+    stack[top++]= m_root;
+    while(top > 0)
+    {
+        const Node& node= m_nodes[stack[--top]];
+        float t;
+        if(!intersect_bounds(node.bounds, ray, invd, ray.tmax, t))
+            continue;
+
+        if(node.leaf())
+            hits.push_back( std::make_pair(t, m_ids[node.leaf_begin()]) );
+        else
+        {
+            assert(top +2 <= 64);
+            stack[top++]= node.internal_right();
+            stack[top++]= node.internal_left();
+        }
+    }
+
+    // les clusters les plus proches en premier
+    std::sort(hits.begin(), hits.end());
+}
+
+
+Hit ClusterBVH::intersect( const Ray& ray, Vector& n )
+{
+    std::vector< std::pair<float, int> > hits;
+    clusters(ray, hits);
+
+    Hit hit;
+    hit.t= ray.tmax;
+    for(int i= 0; i < int(hits.size()); i++)
+    {
+        // les clusters suivants sont derriere l'intersection, inutile de les charger
+        if(hits[i].first > hit.t)
+            break;
+
+        std::shared_ptr<const ClusterData> data= cluster(hits[i].second);
+        if(data == nullptr)
+            continue;
+
+        Ray r= ray;
+        r.tmax= hit.t;
+        if(Hit h= data->bvh.intersect(r))
+        {
+            const Triangle& triangle= data->bvh.triangles[h.triangle_id];
+            n= cross(triangle.e1, triangle.e2);
+
+            hit= h;
+            hit.triangle_id= data->ids[h.triangle_id];
+        }
+    }
+
+    return hit;
+}
+
+
+bool ClusterBVH::visible( const Ray& ray )
+{
+    std::vector< std::pair<float, int> > hits;
+    clusters(ray, hits);
+
+    for(int i= 0; i < int(hits.size()); i++)
+    {
+        std::shared_ptr<const ClusterData> data= cluster(hits[i].second);
+        if(data != nullptr && !data->bvh.visible(ray))
+            return false;
+    }
+
+    return true;
+}
+
+
+std::shared_ptr<const ClusterData> ClusterBVH::cluster( const int id )
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it= m_entries.find(id);
+        if(it != m_entries.end())
+        {
+            // deplace le cluster en tete de la liste lru
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+            m_hits++;
+            return it->second.data;
+        }
+
+        m_misses++;
+    }
+
+    // le cluster est lu sans bloquer les autres threads, sauf ceux qui chargent aussi un cluster
+    std::shared_ptr<const ClusterData> data= load(id);
+    if(data == nullptr)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto it= m_entries.find(id);
+    if(it != m_entries.end())
+    {
+        // un autre thread a charge le meme cluster
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        return it->second.data;
+    }
+
+    m_lru.push_front(id);
+    m_entries[id]= { data, m_lru.begin() };
+    m_memory+= data->memory();
+    m_peak= std::max(m_peak, m_memory);
+
+    evict();
+    // le cluster est conserve par le shared_ptr, meme s'il vient d'etre evince
+    return data;
+}
+
+
+std::shared_ptr<const ClusterData> ClusterBVH::load( const int id )
+{
+    const Cluster& cluster= m_clusters[id];
+
+    std::shared_ptr<ClusterData> data= std::make_shared<ClusterData>();
+    data->bvh.nodes.resize(cluster.nodes);
+    data->bvh.triangles.resize(cluster.triangles, Triangle(Point(), Point(), Point(), -1));
+    data->bvh.root= cluster.root;
+    data->ids.resize(cluster.triangles);
+
+    {
+        std::lock_guard<std::mutex> lock(m_file_lock);
+        bool error= seek(m_file, cluster.offset) != 0
+            || fread(data->bvh.nodes.data(), sizeof(Node), cluster.nodes, m_file) != size_t(cluster.nodes)
+            || fread(data->bvh.triangles.data(), sizeof(Triangle), cluster.triangles, m_file) != size_t(cluster.triangles)
+            || fread(data->ids.data(), sizeof(int), cluster.triangles, m_file) != size_t(cluster.triangles);
+        if(error)
+        {
+            printf("[error] loading cluster %d...\n", id);
+            return nullptr;
+        }
+
+        m_bytes+= cluster.nodes * sizeof(Node) + cluster.triangles * (sizeof(Triangle) + sizeof(int));
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_loads++;
+    return data;
+}
+
+
+void ClusterBVH::evict( )
+{
+    // conserve au moins le dernier cluster insere
+    while(m_memory > m_budget && m_lru.size() > 1)
+    {
+        int id= m_lru.back();
+        m_lru.pop_back();
+
+        auto it= m_entries.find(id);
+        m_memory-= it->second.data->memory();
+        m_entries.erase(it);
+        m_evictions++;
+    }
+}
+
+
+void ClusterBVH::print( ) const
+{
+    printf("cluster cache: %d clusters, %d loads, %ld hits, %ld misses, %ld evictions, %.2fMB read\n",
+        cluster_count(), int(m_loads), m_hits, m_misses, m_evictions, m_bytes / 1024.0 / 1024.0);
+    printf("  memory %.2fMB, peak %.2fMB, budget %.2fMB\n", m_memory / 1024.0 / 1024.0, m_peak / 1024.0 / 1024.0, m_budget / 1024.0 / 1024.0);
+}
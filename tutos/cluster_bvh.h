@@ -0,0 +1,122 @@
+//! \file cluster_bvh.h lancer de rayons sur des objets plus gros que la memoire : clusters de triangles sur disque, charges a la demande.
+
+#ifndef _CLUSTER_BVH_H
+#define _CLUSTER_BVH_H
+
+#include <cstdio>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "bvh.h"
+
+
+/*! decoupe les triangles d'un fichier .obj en clusters spatiaux et les enregistre dans un fichier binaire, avec le bvh de chaque cluster.
+    le fichier .obj est lu ligne par ligne, sans construire de Mesh : seules les positions des sommets restent en memoire pendant la construction,
+    les triangles sont ecrits dans des fichiers temporaires et repartis par paquets de taille limitee par buffer, en octets.
+
+    les clusters sont les regions d'une grille reguliere, decoupee recursivement en 2 jusqu'a ce que chaque region contienne
+    moins de cluster_size triangles, ou une seule cellule de la grille.
+    renvoie 0 si le fichier est cree, -1 en cas d'erreur.
+ */
+int build_clusters( const char *obj_filename, const char *filename, const int cluster_size= 65536, const size_t buffer= size_t(256) * 1024 * 1024 );
+
+
+//! cluster charge en memoire : bvh des triangles et indices des triangles dans le fichier .obj.
+struct ClusterData
+{
+    BVH bvh;                    //!< Triangle::id est l'indice du triangle dans le cluster
+    std::vector<int> ids;       //!< indice du triangle dans le fichier .obj
+
+    //! renvoie la memoire utilisee par le cluster, en octets.
+    size_t memory( ) const { return bvh.memory() + ids.size() * sizeof(int); }
+};
+
+
+/*! bvh a 2 niveaux sur les clusters d'un fichier cree par build_clusters() : l'arbre des englobants des clusters reste en memoire,
+    les clusters sont charges lors de leur premiere utilisation par un rayon, et les plus recemment utilises sont conserves dans la limite d'un budget memoire.
+    les clusters touches par un rayon sont visites dans l'ordre de leur distance a l'origine du rayon, un cluster plus loin que l'intersection
+    la plus proche n'est pas charge.
+
+    peut etre utilise par plusieurs threads.
+ */
+struct ClusterBVH
+{
+    //! ouvre un fichier de clusters, budget en octets.
+    ClusterBVH( const char *filename, const size_t budget= size_t(1024) * 1024 * 1024 );
+    ~ClusterBVH( );
+
+    //! renvoie vrai si le fichier est ouvert.
+    bool valid( ) const { return m_file != nullptr; }
+    //! renvoie le nombre de clusters.
+    int cluster_count( ) const { return int(m_clusters.size()); }
+    //! renvoie le nombre de triangles.
+    int64_t triangle_count( ) const { return m_triangle_count; }
+    //! renvoie l'englobant de l'objet.
+    const BBox& bounds( ) const { return m_bounds; }
+
+    //! renvoie l'intersection la plus proche dans l'intervalle [0 ray.tmax], hit.triangle_id est l'indice du triangle dans le fichier .obj,
+    //! et n la normale geometrique du triangle, non normalisee.
+    Hit intersect( const Ray& ray, Vector& n );
+    //! renvoie vrai s'il n'y a pas d'intersection dans l'intervalle [0 ray.tmax].
+    bool visible( const Ray& ray );
+
+    //! affiche les statistiques d'utilisation du cache.
+    void print( ) const;
+
+protected:
+    struct Cluster
+    {
+        BBox bounds;
+        int64_t offset;     // position des donnees dans le fichier
+        int nodes;
+        int triangles;
+        int root;
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<const ClusterData> data;
+        std::list<int>::iterator lru;
+    };
+
+    //! construit l'arbre des clusters [begin .. end) de m_ids, renvoie sa racine.
+    int build( const int begin, const int end );
+    //! renvoie les clusters touches par le rayon, tries par distance.
+    void clusters( const Ray& ray, std::vector< std::pair<float, int> >& hits ) const;
+    //! renvoie un cluster, le charge s'il n'est pas dans le cache.
+    std::shared_ptr<const ClusterData> cluster( const int id );
+    //! lit un cluster dans le fichier.
+    std::shared_ptr<const ClusterData> load( const int id );
+    //! supprime les clusters les moins recemment utilises pour respecter le budget.
+    void evict( );
+
+    std::vector<Cluster> m_clusters;
+    std::vector<Node> m_nodes;          // arbre des englobants des clusters, les feuilles referencent m_ids
+    std::vector<int> m_ids;
+    int m_root;
+    BBox m_bounds;
+    int64_t m_triangle_count;
+
+    FILE *m_file;
+    std::mutex m_file_lock;
+
+    std::unordered_map<int, Entry> m_entries;
+    std::list<int> m_lru;               // clusters, du plus recent au plus ancien
+    std::mutex m_lock;
+
+    size_t m_budget;
+    size_t m_memory;
+    size_t m_peak;
+    long int m_hits;
+    long int m_misses;
+    long int m_loads;
+    long int m_evictions;
+    int64_t m_bytes;
+};
+
+#endif
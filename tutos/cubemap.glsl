@@ -24,14 +24,20 @@ void main( )
 #ifdef FRAGMENT_SHADER
 uniform vec3 camera_position;
 uniform samplerCube texture0;
-
-const float alpha= 400;
-const float k= 0.8;
+uniform vec3 sh[9];     // irradiance, cf EnvmapSH::irradiance_coefficients()
+uniform float diffuse_weight;     // part du diffus, 0 : reflet seul
+uniform float roughness;          // rugosite du reflet, 0 : reflet miroir
 
 in vec3 vertex_position;
 in vec3 vertex_normal;
 out vec4 fragment_color;
 
+vec3 irradiance( const vec3 n )
+{
+    return sh[0] + sh[1]*n.y + sh[2]*n.z + sh[3]*n.x
+        + sh[4]*n.x*n.y + sh[5]*n.y*n.z + sh[6]*(3*n.z*n.z - 1) + sh[7]*n.x*n.z + sh[8]*(n.x*n.x - n.y*n.y);
+}
+
 void main( )
 {
     vec3 v= vertex_position - camera_position;
@@ -39,17 +45,16 @@ void main( )
     //~ vec3 color= texture(texture0, n).rgb;   // couleur dans la direction de la normale
     
     vec3 m= reflect(v, n);
-    vec3 color= texture(texture0, m).rgb;       // couleur dans la direction du reflet miroir
+    //~ vec3 mirror= texture(texture0, m).rgb;      // couleur dans la direction du reflet miroir
     
-    //~ // ou approximation pour un modele blinn - phong, cf shaders et brdfs...
-    //~ float size= textureSize(texture0, 0).x;
-    //~ float dlevel= floor(log2(size)) +1;
-    //~ vec3 diffuse= textureLod(texture0, n, dlevel).rgb;
-
-    //~ float glevel= max(0, log2(size * sqrt(3)) - 0.5 * log2(alpha+1));
-    //~ vec3 glossy= textureLod(texture0, m, glevel).rgb;
-
-    //~ vec3 color= k * diffuse + (1 - k) * glossy;
+    // reflet glossy, les niveaux de la cubemap sont prefiltres, cf envmap_prefilter(), le niveau 0 donne le reflet miroir
+    float levels= textureQueryLevels(texture0);
+    vec3 glossy= textureLod(texture0, m, roughness * (levels - 1)).rgb;
+    
+    // + diffus, albedo / pi * irradiance
+    const float pi= 3.14159265;
+    vec3 diffuse= irradiance(n) / pi;
+    vec3 color= diffuse_weight * diffuse + (1 - diffuse_weight) * glossy;
     
     fragment_color= vec4(color, 1);
 }
@@ -0,0 +1,225 @@
+//! \file denoise.cpp
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "denoise.h"
+
+
+// les donnees sont stockees par composante (SoA), une ligne de pixels est un tableau de float contigu,
+// ce qui permet au compilateur de vectoriser la boucle interne du filtre, cf #pragma omp simd.
+
+// taille des blocs de pixels traites par un thread
+const int tile_width= 64;
+const int tile_height= 8;
+
+// noyau b3 spline 1d, le noyau 5x5 est le produit h[i] * h[j]
+const float kernel[5]= { 1.f / 16, 1.f / 4, 3.f / 8, 1.f / 4, 1.f / 16 };
+
+
+struct DenoiseGuides
+{
+    std::vector<float> nx, ny, nz;      // normales
+    std::vector<float> px, py, pz;      // positions
+};
+
+struct DenoiseSignal
+{
+    std::vector<float> r, g, b;         // irradiance, couleur / albedo
+    std::vector<float> v;               // variance de la luminance
+
+    DenoiseSignal( const int n ) : r(n), g(n), b(n), v(n) {}
+};
+
+
+static float luminance( const float r, const float g, const float b )
+{
+    return 0.2126f * r + 0.7152f * g + 0.0722f * b;
+}
+
+
+// estimation spatiale de la variance de la luminance, voisinage 5x5
+static void estimate_variance( DenoiseSignal& signal, const int width, const int height )
+{
+    std::vector<float> l(width * height);
+    for(int i= 0; i < width * height; i++)
+        l[i]= luminance(signal.r[i], signal.g[i], signal.b[i]);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int y= 0; y < height; y++)
+    for(int x= 0; x < width; x++)
+    {
+        float m1= 0;
+        float m2= 0;
+        int n= 0;
+        for(int j= std::max(0, y -2); j <= std::min(height -1, y +2); j++)
+        for(int i= std::max(0, x -2); i <= std::min(width -1, x +2); i++)
+        {
+            float q= l[j * width + i];
+            m1= m1 + q;
+            m2= m2 + q * q;
+            n++;
+        }
+
+        m1= m1 / n;
+        m2= m2 / n;
+        signal.v[y * width + x]= std::max(0.f, m2 - m1 * m1);
+    }
+}
+
+
+// une passe du filtre, pas de step pixels entre les echantillons du noyau.
+static void filter_tile( const DenoiseGuides& guides, const DenoiseSignal& in, DenoiseSignal& out,
+    const int width, const int height, const int step, const DenoiseParams& params,
+    const int xmin, const int ymin, const int xmax, const int ymax )
+{
+    const float inv_sigma_plane= 1 / params.sigma_plane;
+    const int n= xmax - xmin;
+
+    float sum_r[tile_width];
+    float sum_g[tile_width];
+    float sum_b[tile_width];
+    float sum_v[tile_width];
+    float sum_w[tile_width];
+
+    // arret sur la luminance de chaque pixel du bloc
+    float lp[tile_width];
+    float inv_sigma_l[tile_width];
+
+    for(int y= ymin; y < ymax; y++)
+    {
+        const int row= y * width;
+        for(int k= 0; k < n; k++)
+        {
+            int p= row + xmin + k;
+            sum_r[k]= 0; sum_g[k]= 0; sum_b[k]= 0; sum_v[k]= 0; sum_w[k]= 0;
+
+            lp[k]= luminance(in.r[p], in.g[p], in.b[p]);
+            inv_sigma_l[k]= 1 / (params.sigma_luminance * std::sqrt(in.v[p]) + 1e-4f);
+        }
+
+        for(int j= -2; j <= 2; j++)
+        {
+            const int qrow= std::min(height -1, std::max(0, y + j * step)) * width;
+            for(int i= -2; i <= 2; i++)
+            {
+                const float h= kernel[j +2] * kernel[i +2];
+                const int dx= i * step;
+
+            #pragma omp simd
+                for(int k= 0; k < n; k++)
+                {
+                    const int x= xmin + k;
+                    const int p= row + x;
+                    const int q= qrow + std::min(width -1, std::max(0, x + dx));
+
+                    // luminance
+                    float lq= luminance(in.r[q], in.g[q], in.b[q]);
+                    float el= std::abs(lp[k] - lq) * inv_sigma_l[k];
+
+                    // normales, |np - nq|^2 / 2 == 1 - cos pour des normales unitaires, et reste valide pour les pixels sans intersection, normale nulle
+                    float dnx= guides.nx[q] - guides.nx[p];
+                    float dny= guides.ny[q] - guides.ny[p];
+                    float dnz= guides.nz[q] - guides.nz[p];
+                    float en= (dnx * dnx + dny * dny + dnz * dnz) * 0.5f * params.sigma_normal;
+
+                    // distance de q au plan tangent en p, relative a la distance entre p et q
+                    float dpx= guides.px[q] - guides.px[p];
+                    float dpy= guides.py[q] - guides.py[p];
+                    float dpz= guides.pz[q] - guides.pz[p];
+                    float d2= dpx * dpx + dpy * dpy + dpz * dpz;
+                    float plane= std::abs(guides.nx[p] * dpx + guides.ny[p] * dpy + guides.nz[p] * dpz);
+                    float ep= plane * inv_sigma_plane / std::sqrt(d2 + 1e-12f);
+
+                    // une seule exponentielle pour les 3 termes
+                    float w= h * std::exp(-(el + en + ep));
+
+                    sum_r[k]+= w * in.r[q];
+                    sum_g[k]+= w * in.g[q];
+                    sum_b[k]+= w * in.b[q];
+                    sum_v[k]+= w * w * in.v[q];
+                    sum_w[k]+= w;
+                }
+            }
+        }
+
+        for(int k= 0; k < n; k++)
+        {
+            int p= row + xmin + k;
+            // le poids du pixel central est toujours > 0
+            float inv_w= 1 / sum_w[k];
+            out.r[p]= sum_r[k] * inv_w;
+            out.g[p]= sum_g[k] * inv_w;
+            out.b[p]= sum_b[k] * inv_w;
+            out.v[p]= sum_v[k] * inv_w * inv_w;
+        }
+    }
+}
+
+
+Image denoise( const Image& color, const Image& normal, const Image& position, const Image& albedo, const DenoiseParams& params )
+{
+    const int width= color.width();
+    const int height= color.height();
+    const int size= width * height;
+    assert(normal.width() == width && normal.height() == height);
+    assert(position.width() == width && position.height() == height);
+    assert(albedo.width() == width && albedo.height() == height);
+
+    // prepare les donnees
+    DenoiseGuides guides;
+    guides.nx.resize(size); guides.ny.resize(size); guides.nz.resize(size);
+    guides.px.resize(size); guides.py.resize(size); guides.pz.resize(size);
+
+    DenoiseSignal signal(size);
+    for(int i= 0; i < size; i++)
+    {
+        Color n= normal(size_t(i));
+        Color p= position(size_t(i));
+        guides.nx[i]= n.r; guides.ny[i]= n.g; guides.nz[i]= n.b;
+        guides.px[i]= p.r; guides.py[i]= p.g; guides.pz[i]= p.b;
+
+        // filtre l'eclairage, sans la couleur des matieres
+        Color c= color(size_t(i));
+        Color a= albedo(size_t(i));
+        signal.r[i]= c.r / std::max(a.r, 1e-3f);
+        signal.g[i]= c.g / std::max(a.g, 1e-3f);
+        signal.b[i]= c.b / std::max(a.b, 1e-3f);
+    }
+
+    estimate_variance(signal, width, height);
+
+    // decoupe l'image en blocs
+    int tiles_x= (width + tile_width -1) / tile_width;
+    int tiles_y= (height + tile_height -1) / tile_height;
+    int tiles= tiles_x * tiles_y;
+
+    DenoiseSignal tmp(size);
+    for(int iteration= 0; iteration < params.iterations; iteration++)
+    {
+        const int step= 1 << iteration;
+
+    #pragma omp parallel for schedule(dynamic, 1)
+        for(int t= 0; t < tiles; t++)
+        {
+            int xmin= (t % tiles_x) * tile_width;
+            int ymin= (t / tiles_x) * tile_height;
+            filter_tile(guides, signal, tmp, width, height, step, params,
+                xmin, ymin, std::min(width, xmin + tile_width), std::min(height, ymin + tile_height));
+        }
+
+        std::swap(signal, tmp);
+    }
+
+    // re-applique la couleur des matieres
+    Image image(width, height);
+    for(int i= 0; i < size; i++)
+    {
+        Color a= albedo(size_t(i));
+        image(size_t(i))= Color(signal.r[i] * std::max(a.r, 1e-3f), signal.g[i] * std::max(a.g, 1e-3f), signal.b[i] * std::max(a.b, 1e-3f));
+    }
+
+    return image;
+}
@@ -0,0 +1,33 @@
+//! \file denoise.h filtre a trous guide par les buffers auxiliaires du lancer de rayons.
+
+#ifndef _DENOISE_H
+#define _DENOISE_H
+
+#include "image.h"
+
+
+//! parametres du filtre.
+struct DenoiseParams
+{
+    int iterations;             //!< nombre de passes, la passe i utilise un pas de 2^i pixels, 5 passes couvrent un voisinage de 125x125 pixels
+    float sigma_luminance;      //!< arret sur les differences de luminance, en nombre d'ecarts types locaux
+    float sigma_normal;         //!< arret sur les normales, equivalent a pow(dot(np, nq), sigma_normal)
+    float sigma_plane;          //!< arret sur la distance au plan tangent, relative a la distance entre les points
+
+    DenoiseParams( ) : iterations(5), sigma_luminance(4), sigma_normal(128), sigma_plane(0.1f) {}
+};
+
+/*! filtre a trous, "edge-avoiding a-trous wavelet transform for fast global illumination filtering", Dammertz 2010,
+    avec l'arret sur la luminance guide par la variance de "spatiotemporal variance-guided filtering", Schied 2017.
+
+    les buffers auxiliaires decrivent le point visible de chaque pixel :
+        - normal : normale (x, y, z) dans r, g, b, nulle pour les pixels sans intersection,
+        - position : position (x, y, z) dans r, g, b,
+        - albedo : couleur diffuse de la matiere, le filtre travaille sur color / albedo, pour ne pas flouter les textures.
+
+    color est l'image bruitee, en valeurs lineaires, avant la correction gamma.
+    renvoie l'image filtree.
+ */
+Image denoise( const Image& color, const Image& normal, const Image& position, const Image& albedo, const DenoiseParams& params= DenoiseParams() );
+
+#endif
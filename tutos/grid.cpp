@@ -0,0 +1,269 @@
+//! \file grid.cpp
+
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+#include "grid.h"
+
+
+int GridIntersector::build( const Mesh& mesh )
+{
+    m_triangles.clear();
+    m_grids.clear();
+    m_cells.clear();
+    m_references.clear();
+
+    m_triangles.reserve(mesh.triangle_count());
+    for(int id= 0; id < mesh.triangle_count(); id++)
+        m_triangles.emplace_back(mesh.triangle(id), id);
+    if(m_triangles.empty())
+        return -1;
+
+    BBox bounds= m_triangles[0].bounds();
+    for(const Triangle& triangle : m_triangles)
+        bounds.insert(triangle.bounds());
+
+    // elargit un peu l'englobant, les triangles sur les faces de l'englobant restent a l'interieur de la grille
+    Vector margin= 0.0001f * Vector(bounds.pmin, bounds.pmax) + Vector(0.00001f, 0.00001f, 0.00001f);
+    bounds.pmin= bounds.pmin - margin;
+    bounds.pmax= bounds.pmax + margin;
+
+    std::vector<int> ids(m_triangles.size());
+    for(unsigned i= 0; i < ids.size(); i++)
+        ids[i]= i;
+
+    // grille principale
+    make_grid(bounds, ids);
+
+    // sous grilles des cellules trop remplies
+    const Grid top= m_grids[0];
+    for(int z= 0; z < top.dims[2]; z++)
+    for(int y= 0; y < top.dims[1]; y++)
+    for(int x= 0; x < top.dims[0]; x++)
+    {
+        int index= top.first + (z * top.dims[1] + y) * top.dims[0] + x;
+        Cell cell= m_cells[index];
+        if(cell.end - cell.begin <= m_threshold)
+            continue;
+
+        BBox cell_bounds;
+        cell_bounds.pmin= top.bounds.pmin + Vector(x * top.cell.x, y * top.cell.y, z * top.cell.z);
+        cell_bounds.pmax= cell_bounds.pmin + top.cell;
+
+        // copie les triangles de la cellule, make_grid() modifie m_references
+        std::vector<int> cell_ids(m_references.begin() + cell.begin, m_references.begin() + cell.end);
+        int subgrid= make_grid(cell_bounds, cell_ids);
+        m_cells[index].subgrid= subgrid;
+    }
+
+    return 0;
+}
+
+int GridIntersector::make_grid( const BBox& bounds, const std::vector<int>& ids )
+{
+    Grid grid;
+    grid.bounds= bounds;
+    grid.first= int(m_cells.size());
+
+    // resolution : density triangles par cellule, en moyenne, cellules a peu pres cubiques
+    Vector extent= Vector(bounds.pmin, bounds.pmax);
+    float extent_max= std::max(extent.x, std::max(extent.y, extent.z));
+    // les scenes plates ont un volume nul...
+    Vector e= Vector(std::max(extent.x, extent_max * 0.001f), std::max(extent.y, extent_max * 0.001f), std::max(extent.z, extent_max * 0.001f));
+    float k= std::cbrt(m_density * float(ids.size()) / (e.x * e.y * e.z));
+    for(int i= 0; i < 3; i++)
+        grid.dims[i]= std::max(1, std::min(int(e(i) * k), 128));
+
+    grid.cell= Vector(extent.x / grid.dims[0], extent.y / grid.dims[1], extent.z / grid.dims[2]);
+    grid.inv_cell= Vector(grid.cell.x > 0 ? 1 / grid.cell.x : 0, grid.cell.y > 0 ? 1 / grid.cell.y : 0, grid.cell.z > 0 ? 1 / grid.cell.z : 0);
+
+    // cellules touchees par l'englobant de chaque triangle
+    auto cells= [&]( const Triangle& triangle, int cmin[3], int cmax[3] )
+    {
+        BBox box= triangle.bounds();
+        for(int i= 0; i < 3; i++)
+        {
+            cmin[i]= std::max(0, std::min(int((box.pmin(i) - bounds.pmin(i)) * grid.inv_cell(i)), grid.dims[i] -1));
+            cmax[i]= std::max(0, std::min(int((box.pmax(i) - bounds.pmin(i)) * grid.inv_cell(i)), grid.dims[i] -1));
+        }
+    };
+
+    // compte les references de chaque cellule...
+    const int n= grid.dims[0] * grid.dims[1] * grid.dims[2];
+    std::vector<int> counts(n +1, 0);
+    for(int id : ids)
+    {
+        int cmin[3], cmax[3];
+        cells(m_triangles[id], cmin, cmax);
+        for(int z= cmin[2]; z <= cmax[2]; z++)
+        for(int y= cmin[1]; y <= cmax[1]; y++)
+        for(int x= cmin[0]; x <= cmax[0]; x++)
+            counts[(z * grid.dims[1] + y) * grid.dims[0] + x]++;
+    }
+
+    // ... les range les unes a la suite des autres...
+    const int offset= int(m_references.size());
+    int total= 0;
+    for(int i= 0; i < n; i++)
+    {
+        Cell cell;
+        cell.begin= offset + total;
+        cell.end= cell.begin;
+        cell.subgrid= -1;
+        m_cells.push_back(cell);
+        total+= counts[i];
+    }
+
+    // ... et les remplit
+    m_references.resize(offset + total);
+    for(int id : ids)
+    {
+        int cmin[3], cmax[3];
+        cells(m_triangles[id], cmin, cmax);
+        for(int z= cmin[2]; z <= cmax[2]; z++)
+        for(int y= cmin[1]; y <= cmax[1]; y++)
+        for(int x= cmin[0]; x <= cmax[0]; x++)
+        {
+            Cell& cell= m_cells[grid.first + (z * grid.dims[1] + y) * grid.dims[0] + x];
+            m_references[cell.end++]= id;
+        }
+    }
+
+    m_grids.push_back(grid);
+    return int(m_grids.size()) -1;
+}
+
+
+bool GridIntersector::walk( const Grid& grid, const Ray& ray, const Vector& invd, const float tmin, const float tmax, const bool any, Hit& hit ) const
+{
+    // intervalle du rayon dans la grille
+    Point rmin= grid.bounds.pmin;
+    Point rmax= grid.bounds.pmax;
+    if(ray.d.x < 0) std::swap(rmin.x, rmax.x);
+    if(ray.d.y < 0) std::swap(rmin.y, rmax.y);
+    if(ray.d.z < 0) std::swap(rmin.z, rmax.z);
+    Vector dmin= (rmin - ray.o) * invd;
+    Vector dmax= (rmax - ray.o) * invd;
+
+    float t0= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, tmin)));
+    float t1= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, tmax)));
+    if(t0 > t1)
+        return false;
+
+    // cellule d'entree et parametres du 3d-dda
+    Point p= ray.o + t0 * ray.d;
+    int cell[3];
+    int step[3];
+    int end[3];
+    float next[3];
+    float delta[3];
+    for(int i= 0; i < 3; i++)
+    {
+        cell[i]= std::max(0, std::min(int((p(i) - grid.bounds.pmin(i)) * grid.inv_cell(i)), grid.dims[i] -1));
+        if(ray.d(i) > 0)
+        {
+            step[i]= 1;
+            end[i]= grid.dims[i];
+            next[i]= (grid.bounds.pmin(i) + (cell[i] +1) * grid.cell(i) - ray.o(i)) * invd(i);
+            delta[i]= grid.cell(i) * invd(i);
+        }
+        else if(ray.d(i) < 0)
+        {
+            step[i]= -1;
+            end[i]= -1;
+            next[i]= (grid.bounds.pmin(i) + cell[i] * grid.cell(i) - ray.o(i)) * invd(i);
+            delta[i]= -grid.cell(i) * invd(i);
+        }
+        else
+        {
+            step[i]= 0;
+            end[i]= -1;
+            next[i]= FLT_MAX;
+            delta[i]= FLT_MAX;
+        }
+    }
+
+    float t= t0;
+    for(;;)
+    {
+        // sortie de la cellule
+        int axis= 0;
+        if(next[1] < next[axis]) axis= 1;
+        if(next[2] < next[axis]) axis= 2;
+        float texit= std::min(next[axis], t1);
+
+        const Cell& c= m_cells[grid.first + (cell[2] * grid.dims[1] + cell[1]) * grid.dims[0] + cell[0]];
+        if(c.subgrid >= 0)
+        {
+            if(walk(m_grids[c.subgrid], ray, invd, t, texit, any, hit))
+                return true;
+        }
+        else
+        {
+            for(int i= c.begin; i < c.end; i++)
+            {
+                // un triangle peut etre teste plusieurs fois, s'il touche plusieurs cellules
+                if(Hit h= m_triangles[m_references[i]].intersect(ray, hit ? hit.t : ray.tmax))
+                {
+                    hit= h;
+                    if(any)
+                        return true;
+                }
+            }
+        }
+
+        // l'intersection la plus proche peut se trouver dans une cellule suivante, si le triangle touche plusieurs cellules
+        if(hit && hit.t <= texit)
+            return true;
+
+        if(next[axis] >= t1)
+            return false;
+
+        // cellule suivante
+        cell[axis]+= step[axis];
+        if(cell[axis] == end[axis])
+            return false;
+        t= next[axis];
+        next[axis]+= delta[axis];
+    }
+}
+
+Hit GridIntersector::intersect( const Ray& ray ) const
+{
+    Hit hit;
+    if(m_grids.empty())
+        return hit;
+
+    Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    walk(m_grids[0], ray, invd, 0, ray.tmax, false, hit);
+    return hit;
+}
+
+bool GridIntersector::occluded( const Ray& ray ) const
+{
+    Hit hit;
+    if(m_grids.empty())
+        return false;
+
+    Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    return walk(m_grids[0], ray, invd, 0, ray.tmax, true, hit);
+}
+
+
+IntersectorStats GridIntersector::stats( ) const
+{
+    IntersectorStats s;
+    s.triangles= int(m_triangles.size());
+    s.nodes= int(m_cells.size());
+    for(const Cell& cell : m_cells)
+        if(cell.subgrid < 0 && cell.end > cell.begin)
+        {
+            s.leaves++;
+            s.references+= cell.end - cell.begin;
+        }
+
+    s.memory= m_triangles.size() * sizeof(Triangle) + m_grids.size() * sizeof(Grid) + m_cells.size() * sizeof(Cell) + m_references.size() * sizeof(int);
+    return s;
+}
@@ -0,0 +1,58 @@
+//! \file grid.h grille reguliere a 2 niveaux, parcourue par un 3d-dda.
+
+#ifndef _GRID_H
+#define _GRID_H
+
+#include <vector>
+
+#include "intersector.h"
+
+
+/*! grille reguliere a 2 niveaux : la grille principale decoupe l'englobant de la scene en cellules cubiques, environ density triangles par cellule,
+    et les cellules qui contiennent plus de threshold triangles sont decoupees a leur tour par une sous grille.
+    les rayons parcourent les cellules dans l'ordre, cf "a fast voxel traversal algorithm for ray tracing", Amanatides, Woo, 1987,
+    et s'arretent dans la premiere cellule qui contient une intersection.
+    adaptee aux scenes dont les triangles sont repartis uniformement, de tailles comparables.
+ */
+class GridIntersector : public Intersector
+{
+public:
+    GridIntersector( const float density= 4, const int threshold= 32 )
+        : m_triangles(), m_grids(), m_cells(), m_references(), m_density(density), m_threshold(threshold) {}
+
+    const char *name( ) const { return "grid"; }
+    int build( const Mesh& mesh );
+    Hit intersect( const Ray& ray ) const;
+    bool occluded( const Ray& ray ) const;
+    IntersectorStats stats( ) const;
+
+protected:
+    //! grille, ses cellules sont rangees dans m_cells a partir de first.
+    struct Grid
+    {
+        BBox bounds;
+        int dims[3];
+        Vector cell;        // taille d'une cellule
+        Vector inv_cell;
+        int first;
+    };
+
+    //! cellule : triangles [begin end) de m_references, ou sous grille.
+    struct Cell
+    {
+        int begin, end;
+        int subgrid;        // indice de la sous grille, ou -1
+    };
+
+    int make_grid( const BBox& bounds, const std::vector<int>& ids );
+    bool walk( const Grid& grid, const Ray& ray, const Vector& invd, const float tmin, const float tmax, const bool any, Hit& hit ) const;
+
+    std::vector<Triangle> m_triangles;
+    std::vector<Grid> m_grids;
+    std::vector<Cell> m_cells;
+    std::vector<int> m_references;
+    float m_density;
+    int m_threshold;
+};
+
+#endif
@@ -0,0 +1,238 @@
+//! \file heightfield.cpp
+
+#include <cmath>
+#include <algorithm>
+
+#include "heightfield.h"
+
+
+void Heightfield::build( const Image& heightmap, const Point& pmin, const Point& pmax )
+{
+    m_width= heightmap.width();
+    m_height= heightmap.height();
+    m_pmin= pmin;
+    m_pmax= pmax;
+    m_heights.clear();
+    m_levels.clear();
+    if(m_width < 2 || m_height < 2)
+    {
+        printf("[error] heightfield: %dx%d heightmap, not enough samples...\n", m_width, m_height);
+        m_width= 0;
+        m_height= 0;
+        return;
+    }
+
+    m_cell= Vector((pmax.x - pmin.x) / (m_width -1), 0, (pmax.z - pmin.z) / (m_height -1));
+
+    m_heights.resize(m_width * m_height);
+    for(int y= 0; y < m_height; y++)
+    for(int x= 0; x < m_width; x++)
+        m_heights[y * m_width + x]= pmin.y + heightmap(x, y).r * (pmax.y - pmin.y);
+
+    // pyramide : chaque niveau regroupe 2x2 blocs du niveau precedent, jusqu'a un seul bloc
+    int width= m_width -1;
+    int height= m_height -1;
+    int level= 0;
+    while(width > 1 || height > 1)
+    {
+        Level next;
+        next.width= (width +1) / 2;
+        next.height= (height +1) / 2;
+        next.bounds.resize(next.width * next.height);
+        for(int y= 0; y < next.height; y++)
+        for(int x= 0; x < next.width; x++)
+        {
+            vec2 bounds= node_bounds(level, 2*x, 2*y);
+            for(int k= 1; k < 4; k++)
+            {
+                int cx= 2*x + (k & 1);
+                int cy= 2*y + (k >> 1);
+                if(cx >= width || cy >= height)
+                    continue;
+
+                vec2 child= node_bounds(level, cx, cy);
+                bounds= vec2(std::min(bounds.x, child.x), std::max(bounds.y, child.y));
+            }
+            next.bounds[y * next.width + x]= bounds;
+        }
+
+        m_levels.push_back(next);
+        width= next.width;
+        height= next.height;
+        level++;
+    }
+}
+
+Point Heightfield::vertex( const int x, const int y ) const
+{
+    return Point(m_pmin.x + x * m_cell.x, m_heights[y * m_width + x], m_pmin.z + y * m_cell.z);
+}
+
+vec2 Heightfield::node_bounds( const int level, const int x, const int y ) const
+{
+    if(level > 0)
+    {
+        const Level& l= m_levels[level -1];
+        return l.bounds[y * l.width + x];
+    }
+
+    // cellule, bornes des 4 sommets
+    float a= m_heights[y * m_width + x];
+    float b= m_heights[y * m_width + x +1];
+    float c= m_heights[(y +1) * m_width + x];
+    float d= m_heights[(y +1) * m_width + x +1];
+    return vec2(std::min(std::min(a, b), std::min(c, d)), std::max(std::max(a, b), std::max(c, d)));
+}
+
+
+Hit Heightfield::intersect( const Ray& ray, const bool any, HeightfieldStats *stats ) const
+{
+    if(m_heights.empty())
+        return Hit();
+
+    const int cells_width= m_width -1;
+    const int cells_height= m_height -1;
+    const Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+
+    // ordre de visite des fils, du plus proche au plus eloigne, en fonction de la direction du rayon
+    const int sx= (ray.d.x < 0) ? 1 : 0;
+    const int sy= (ray.d.z < 0) ? 1 : 0;
+
+    // pile des noeuds a visiter, chaque noeud ajoute au plus 4 fils, 3 restent sur la pile par niveau
+    struct Entry { int level, x, y; };
+    Entry stack[128];
+    int top= 0;
+    stack[top++]= { int(m_levels.size()), 0, 0 };
+
+    int nodes= 0;
+    int cells= 0;
+    Hit hit;
+    while(top > 0)
+    {
+        Entry node= stack[--top];
+        nodes++;
+
+        // englobant du bloc : cellules couvertes, altitudes min / max
+        int size= 1 << node.level;
+        int x0= node.x * size;
+        int y0= node.y * size;
+        int x1= std::min(x0 + size, cells_width);
+        int y1= std::min(y0 + size, cells_height);
+        vec2 bounds= node_bounds(node.level, node.x, node.y);
+
+        Point pmin= Point(m_pmin.x + x0 * m_cell.x, bounds.x, m_pmin.z + y0 * m_cell.z);
+        Point pmax= Point(m_pmin.x + x1 * m_cell.x, bounds.y, m_pmin.z + y1 * m_cell.z);
+
+        Point rmin= pmin;
+        Point rmax= pmax;
+        if(ray.d.x < 0) std::swap(rmin.x, rmax.x);
+        if(ray.d.y < 0) std::swap(rmin.y, rmax.y);
+        if(ray.d.z < 0) std::swap(rmin.z, rmax.z);
+        Vector dmin= (rmin - ray.o) * invd;
+        Vector dmax= (rmax - ray.o) * invd;
+
+        float tmin= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, 0.f)));
+        float tmax= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, ray.tmax)));
+        if(tmin > tmax)
+            continue;
+
+        if(node.level == 0)
+        {
+            // cellule, 2 triangles
+            cells++;
+            Point a= vertex(node.x, node.y);
+            Point b= vertex(node.x +1, node.y);
+            Point c= vertex(node.x, node.y +1);
+            Point d= vertex(node.x +1, node.y +1);
+            int id= 2 * (node.y * cells_width + node.x);
+
+            Hit h0= Triangle(a, b, d, id).intersect(ray, ray.tmax);
+            if(any && h0)
+            {
+                // rayon d'ombre, une intersection quelconque suffit, pas besoin de tester le 2ieme triangle
+                hit= h0;
+                break;
+            }
+
+            Hit h1= Triangle(a, d, c, id +1).intersect(ray, h0 ? h0.t : ray.tmax);
+            hit= h1 ? h1 : h0;
+
+            // les blocs sont visites dans l'ordre du rayon, la premiere intersection est la plus proche
+            if(hit)
+                break;
+            continue;
+        }
+
+        // fils, empiles du plus eloigne au plus proche
+        const int level= node.level -1;
+        const int size_x= (level == 0) ? cells_width : m_levels[level -1].width;
+        const int size_y= (level == 0) ? cells_height : m_levels[level -1].height;
+        const int order[4][2]= { {1, 1}, {1, 0}, {0, 1}, {0, 0} };
+        for(int k= 0; k < 4; k++)
+        {
+            int cx= 2 * node.x + (order[k][0] ^ sx);
+            int cy= 2 * node.y + (order[k][1] ^ sy);
+            if(cx < size_x && cy < size_y)
+                stack[top++]= { level, cx, cy };
+        }
+    }
+
+    if(stats)
+    {
+        stats->rays++;
+        stats->nodes+= nodes;
+        stats->cells+= cells;
+    }
+
+    return hit;
+}
+
+Hit Heightfield::intersect( const Ray& ray, HeightfieldStats *stats ) const
+{
+    return intersect(ray, false, stats);
+}
+
+bool Heightfield::visible( const Ray& ray, HeightfieldStats *stats ) const
+{
+    return !intersect(ray, true, stats);
+}
+
+
+Vector Heightfield::normal( const Hit& hit ) const
+{
+    int cell= hit.triangle_id / 2;
+    int x= cell % (m_width -1);
+    int y= cell / (m_width -1);
+
+    Point a= vertex(x, y);
+    Point b= vertex(x +1, y);
+    Point c= vertex(x, y +1);
+    Point d= vertex(x +1, y +1);
+
+    Vector n= (hit.triangle_id & 1) ? cross(Vector(a, d), Vector(a, c)) : cross(Vector(a, b), Vector(a, d));
+    n= normalize(n);
+    // oriente la normale vers le haut
+    if(n.y < 0)
+        n= -n;
+    return n;
+}
+
+vec2 Heightfield::texcoord( const Point& p ) const
+{
+    return vec2((p.x - m_pmin.x) / (m_pmax.x - m_pmin.x), (p.z - m_pmin.z) / (m_pmax.z - m_pmin.z));
+}
+
+void Heightfield::bounds( Point& pmin, Point& pmax ) const
+{
+    vec2 root= m_heights.empty() ? vec2(m_pmin.y, m_pmax.y) : node_bounds(int(m_levels.size()), 0, 0);
+    pmin= Point(m_pmin.x, root.x, m_pmin.z);
+    pmax= Point(m_pmax.x, root.y, m_pmax.z);
+}
+
+size_t Heightfield::memory( ) const
+{
+    size_t size= m_heights.size() * sizeof(float);
+    for(const Level& level : m_levels)
+        size+= level.bounds.size() * sizeof(vec2);
+    return size;
+}
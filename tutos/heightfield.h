@@ -0,0 +1,96 @@
+//! \file heightfield.h lancer de rayons sur un terrain, decrit par une carte d'altitude, sans construire de triangles, cf data/terrain.
+
+#ifndef _HEIGHTFIELD_H
+#define _HEIGHTFIELD_H
+
+#include <vector>
+
+#include "vec.h"
+#include "image.h"
+
+#include "bvh.h"
+
+
+//! statistiques des parcours.
+struct HeightfieldStats
+{
+    long int rays;          //!< nombre de rayons
+    long int nodes;         //!< nombre de noeuds visites
+    long int cells;         //!< nombre de cellules testees, 2 triangles par cellule
+
+    HeightfieldStats( ) : rays(0), nodes(0), cells(0) {}
+
+    HeightfieldStats& operator+= ( const HeightfieldStats& stats ) { rays+= stats.rays; nodes+= stats.nodes; cells+= stats.cells; return *this; }
+};
+
+/*! terrain : altitude de chaque sommet d'une grille reguliere, et pyramide des altitudes min / max des blocs de 2^l x 2^l cellules.
+    chaque cellule de la grille, entre 4 sommets voisins, est decoupee en 2 triangles, intersectes a la volee.
+    le premier niveau de la pyramide regroupe 2x2 cellules, les bornes d'une cellule sont calculees a partir de ses 4 sommets : la pyramide
+    utilise 2/3 de float par sommet, et le terrain complet, altitudes comprises, moins de 2 floats par sommet.
+
+    les rayons parcourent la pyramide depuis la racine : un bloc n'est subdivise que si le rayon passe sous son altitude maximale,
+    et ses 4 fils sont visites dans l'ordre du rayon, la premiere intersection trouvee est la plus proche.
+    cf "maximum mipmaps for fast, accurate, and scalable dynamic height field rendering", Tevs et al, 2008.
+ */
+class Heightfield
+{
+public:
+    Heightfield( ) : m_heights(), m_levels(), m_width(0), m_height(0), m_pmin(), m_pmax(), m_cell() {}
+
+    /*! construit le terrain, l'altitude de chaque sommet est lue dans le canal rouge de heightmap, entre 0 et 1.
+        le terrain occupe la boite [pmin pmax], x et z le long des lignes et des colonnes de l'image, y pour l'altitude.
+     */
+    Heightfield( const Image& heightmap, const Point& pmin, const Point& pmax ) : Heightfield() { build(heightmap, pmin, pmax); }
+
+    //! construit le terrain, cf Heightfield().
+    void build( const Image& heightmap, const Point& pmin, const Point& pmax );
+
+    /*! renvoie l'intersection la plus proche dans l'intervalle [0 ray.tmax] du rayon. hit.triangle_id identifie la cellule et son triangle,
+        cf normal(). stats peut etre nul.
+     */
+    Hit intersect( const Ray& ray, HeightfieldStats *stats= nullptr ) const;
+
+    //! renvoie vrai s'il n'y a pas d'intersection dans l'intervalle [0 ray.tmax] du rayon, rayons d'ombre par exemple.
+    bool visible( const Ray& ray, HeightfieldStats *stats= nullptr ) const;
+
+    //! renvoie la normale geometrique du triangle touche.
+    Vector normal( const Hit& hit ) const;
+
+    //! renvoie la position du point d'intersection dans le terrain, entre 0 et 1, pour lire une texture, par exemple.
+    vec2 texcoord( const Point& p ) const;
+
+    //! englobant du terrain.
+    void bounds( Point& pmin, Point& pmax ) const;
+
+    int width( ) const { return m_width; }
+    int height( ) const { return m_height; }
+    //! renvoie le nombre de niveaux de la pyramide, cellules comprises.
+    int levels( ) const { return int(m_levels.size()) +1; }
+
+    //! renvoie la taille du terrain, en octets.
+    size_t memory( ) const;
+
+protected:
+    //! bornes min / max d'un bloc de 2^l x 2^l cellules.
+    struct Level
+    {
+        int width;
+        int height;
+        std::vector<vec2> bounds;
+    };
+
+    //! any : renvoie la premiere intersection trouvee, pour visible().
+    Hit intersect( const Ray& ray, const bool any, HeightfieldStats *stats ) const;
+    vec2 node_bounds( const int level, const int x, const int y ) const;
+    Point vertex( const int x, const int y ) const;
+
+    std::vector<float> m_heights;   // altitude des sommets, dans le repere du monde
+    std::vector<Level> m_levels;    // m_levels[l - 1] pour les blocs de 2^l x 2^l cellules
+    int m_width;                    // nombre de sommets
+    int m_height;
+    Point m_pmin;
+    Point m_pmax;
+    Vector m_cell;                  // taille d'une cellule
+};
+
+#endif
@@ -0,0 +1,50 @@
+//! \file intersector.cpp
+
+#include <cstdio>
+#include <cstring>
+
+#include "intersector.h"
+#include "grid.h"
+#include "kdtree.h"
+
+
+void Intersector::print( ) const
+{
+    IntersectorStats s= stats();
+    printf("%s: %d triangles, %d nodes, %d leaves, %.2f references per triangle, %dKB\n", name(),
+        s.triangles, s.nodes, s.leaves, s.triangles ? float(s.references) / float(s.triangles) : 0.f, int(s.memory / 1024));
+}
+
+
+IntersectorStats BVHIntersector::stats( ) const
+{
+    IntersectorStats s;
+    s.triangles= int(m_bvh.triangles.size());
+    s.nodes= int(m_bvh.nodes.size());
+    for(const Node& node : m_bvh.nodes)
+        if(node.leaf())
+            s.leaves++;
+    s.references= s.triangles;
+    s.memory= m_bvh.memory();
+    return s;
+}
+
+
+const std::vector<const char *>& intersector_names( )
+{
+    static const std::vector<const char *> names= { "bvh", "grid", "kdtree" };
+    return names;
+}
+
+std::unique_ptr<Intersector> make_intersector( const char *name )
+{
+    if(strcmp(name, "bvh") == 0)
+        return std::unique_ptr<Intersector>(new BVHIntersector());
+    if(strcmp(name, "grid") == 0)
+        return std::unique_ptr<Intersector>(new GridIntersector());
+    if(strcmp(name, "kdtree") == 0)
+        return std::unique_ptr<Intersector>(new KdTreeIntersector());
+
+    printf("[error] unknown intersector '%s'...\n", name);
+    return nullptr;
+}
@@ -0,0 +1,77 @@
+//! \file intersector.h interface commune des structures acceleratrices : bvh, grille, kd-tree. permet de choisir la structure la plus efficace pour chaque scene.
+
+#ifndef _INTERSECTOR_H
+#define _INTERSECTOR_H
+
+#include <memory>
+#include <vector>
+
+#include "mesh.h"
+
+#include "bvh.h"
+
+
+//! description d'une structure construite.
+struct IntersectorStats
+{
+    int triangles;          //!< nombre de triangles
+    int nodes;              //!< nombre de noeuds, ou de cellules
+    int leaves;             //!< nombre de feuilles, ou de cellules non vides
+    int references;         //!< nombre de references sur les triangles, un triangle peut etre reference par plusieurs feuilles / cellules
+    size_t memory;          //!< taille en octets
+
+    IntersectorStats( ) : triangles(0), nodes(0), leaves(0), references(0), memory(0) {}
+};
+
+/*! interface d'une structure acceleratrice.
+    intersect() et occluded() sont constantes et peuvent etre utilisees par plusieurs threads en meme temps.
+ */
+class Intersector
+{
+public:
+    virtual ~Intersector( ) {}
+
+    //! nom de la structure, "bvh", "grid" ou "kdtree".
+    virtual const char *name( ) const= 0;
+
+    //! construit la structure pour les triangles d'un mesh. renvoie 0 si ok, -1 en cas d'erreur.
+    virtual int build( const Mesh& mesh )= 0;
+
+    //! renvoie l'intersection la plus proche de l'origine du rayon dans l'intervalle [0 ray.tmax].
+    virtual Hit intersect( const Ray& ray ) const= 0;
+
+    //! renvoie vrai s'il existe une intersection dans l'intervalle [0 ray.tmax], rayons d'ombre par exemple.
+    virtual bool occluded( const Ray& ray ) const= 0;
+
+    //! description de la structure.
+    virtual IntersectorStats stats( ) const= 0;
+
+    //! affiche la description de la structure.
+    void print( ) const;
+};
+
+
+//! bvh, cf BVH.
+class BVHIntersector : public Intersector
+{
+public:
+    BVHIntersector( ) : m_bvh() {}
+
+    const char *name( ) const { return "bvh"; }
+    int build( const Mesh& mesh ) { m_bvh.build(mesh); return m_bvh.root < 0 ? -1 : 0; }
+    Hit intersect( const Ray& ray ) const { return m_bvh.intersect(ray); }
+    bool occluded( const Ray& ray ) const { return !m_bvh.visible(ray); }
+    IntersectorStats stats( ) const;
+
+protected:
+    BVH m_bvh;
+};
+
+
+//! noms des structures disponibles, cf make_intersector().
+const std::vector<const char *>& intersector_names( );
+
+//! cree une structure, a partir de son nom, "bvh", "grid" ou "kdtree". renvoie nullptr si le nom est inconnu.
+std::unique_ptr<Intersector> make_intersector( const char *name );
+
+#endif
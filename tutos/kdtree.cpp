@@ -0,0 +1,306 @@
+//! \file kdtree.cpp
+
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+
+#include "kdtree.h"
+
+
+// couts relatifs d'un noeud et d'un test rayon / triangle, pour la SAH
+static const float cost_traversal= 1;
+static const float cost_triangle= 1.5f;
+// nombre de plans candidats par axe
+static const int bins= 32;
+
+
+int KdTreeIntersector::build( const Mesh& mesh )
+{
+    m_triangles.clear();
+    m_nodes.clear();
+    m_leaves.clear();
+    m_references.clear();
+    m_root= -1;
+
+    m_triangles.reserve(mesh.triangle_count());
+    for(int id= 0; id < mesh.triangle_count(); id++)
+        m_triangles.emplace_back(mesh.triangle(id), id);
+    if(m_triangles.empty())
+        return -1;
+
+    m_bounds= m_triangles[0].bounds();
+    for(const Triangle& triangle : m_triangles)
+        m_bounds.insert(triangle.bounds());
+
+    // elargit un peu l'englobant, aucune face n'est plate
+    Vector margin= 0.0001f * Vector(m_bounds.pmin, m_bounds.pmax) + Vector(0.00001f, 0.00001f, 0.00001f);
+    m_bounds.pmin= m_bounds.pmin - margin;
+    m_bounds.pmax= m_bounds.pmax + margin;
+
+    // profondeur maximale, limite la duplication des references
+    m_max_depth= int(8 + 1.3f * std::log2(float(m_triangles.size())));
+
+    std::vector<int> ids(m_triangles.size());
+    for(unsigned i= 0; i < ids.size(); i++)
+        ids[i]= i;
+
+    m_root= build(m_bounds, ids, 0);
+
+    // relie les feuilles voisines
+    const int ropes[6]= { -1, -1, -1, -1, -1, -1 };
+    link(m_root, ropes);
+
+    return 0;
+}
+
+int KdTreeIntersector::build( const BBox& bounds, std::vector<int>& ids, const int depth )
+{
+    const int n= int(ids.size());
+    const int index= int(m_nodes.size());
+    m_nodes.push_back(KdNode());
+
+    // cout d'une feuille
+    float best_cost= cost_triangle * n;
+    int best_axis= -1;
+    float best_split= 0;
+
+    const float area= bounds.area();
+    if(n > m_leaf_size && depth < m_max_depth && area > 0)
+    {
+        for(int axis= 0; axis < 3; axis++)
+        {
+            float extent= bounds.pmax(axis) - bounds.pmin(axis);
+            if(extent <= 0)
+                continue;
+
+            // repartit les englobants des triangles, limites a l'englobant du noeud, dans les intervalles
+            int starts[bins]= { };
+            int ends[bins]= { };
+            float k= bins / extent;
+            for(int id : ids)
+            {
+                BBox box= m_triangles[id].bounds();
+                float lo= std::max(box.pmin(axis), bounds.pmin(axis));
+                float hi= std::min(box.pmax(axis), bounds.pmax(axis));
+                starts[std::max(0, std::min(int((lo - bounds.pmin(axis)) * k), bins -1))]++;
+                ends[std::max(0, std::min(int((hi - bounds.pmin(axis)) * k), bins -1))]++;
+            }
+
+            // evalue les plans entre les intervalles
+            int left= 0;
+            int right= n;
+            for(int i= 1; i < bins; i++)
+            {
+                left+= starts[i -1];
+                right-= ends[i -1];
+
+                float split= bounds.pmin(axis) + i * extent / bins;
+                BBox left_bounds= bounds;
+                BBox right_bounds= bounds;
+                left_bounds.pmax(axis)= split;
+                right_bounds.pmin(axis)= split;
+
+                float cost= cost_traversal + cost_triangle * (left_bounds.area() * left + right_bounds.area() * right) / area;
+                // favorise les noeuds vides, le parcours les traverse sans tester de triangles
+                if(left == 0 || right == 0)
+                    cost= cost * 0.8f;
+
+                if(cost < best_cost)
+                {
+                    best_cost= cost;
+                    best_axis= axis;
+                    best_split= split;
+                }
+            }
+        }
+    }
+
+    if(best_axis < 0)
+    {
+        // feuille
+        KdLeaf leaf;
+        leaf.bounds= bounds;
+        for(int i= 0; i < 6; i++)
+            leaf.ropes[i]= -1;
+        leaf.begin= int(m_references.size());
+        m_references.insert(m_references.end(), ids.begin(), ids.end());
+        leaf.end= int(m_references.size());
+
+        m_nodes[index]= { 0, 3, int(m_leaves.size()), -1 };
+        m_leaves.push_back(leaf);
+        return index;
+    }
+
+    // repartit les triangles, ceux qui sont a cheval sur le plan sont references par les 2 fils
+    std::vector<int> left_ids;
+    std::vector<int> right_ids;
+    for(int id : ids)
+    {
+        BBox box= m_triangles[id].bounds();
+        float lo= std::max(box.pmin(best_axis), bounds.pmin(best_axis));
+        float hi= std::min(box.pmax(best_axis), bounds.pmax(best_axis));
+        if(lo < best_split || (lo == best_split && hi == best_split))
+            left_ids.push_back(id);
+        if(hi > best_split)
+            right_ids.push_back(id);
+    }
+    // libere la memoire avant de construire les fils
+    std::vector<int>().swap(ids);
+
+    BBox left_bounds= bounds;
+    BBox right_bounds= bounds;
+    left_bounds.pmax(best_axis)= best_split;
+    right_bounds.pmin(best_axis)= best_split;
+
+    int left= build(left_bounds, left_ids, depth +1);
+    int right= build(right_bounds, right_ids, depth +1);
+    m_nodes[index]= { best_split, best_axis, left, right };
+    return index;
+}
+
+void KdTreeIntersector::link( const int index, const int ropes[6] )
+{
+    const KdNode node= m_nodes[index];
+    if(node.axis < 3)
+    {
+        // le voisin du fils gauche, par sa face pmax(axis), est le fils droit, et inversement
+        int left_ropes[6];
+        int right_ropes[6];
+        for(int i= 0; i < 6; i++)
+            left_ropes[i]= right_ropes[i]= ropes[i];
+        left_ropes[2*node.axis +1]= node.right;
+        right_ropes[2*node.axis]= node.left;
+
+        link(node.left, left_ropes);
+        link(node.right, right_ropes);
+        return;
+    }
+
+    // feuille : descend chaque voisin aussi loin que possible, tant qu'un seul de ses fils touche la face de la feuille
+    KdLeaf& leaf= m_leaves[node.left];
+    for(int face= 0; face < 6; face++)
+    {
+        const int axis= face / 2;
+        int rope= ropes[face];
+        while(rope >= 0 && m_nodes[rope].axis < 3)
+        {
+            const KdNode& r= m_nodes[rope];
+            if(r.axis == axis)
+                // le voisin est de l'autre cote de la face, son fils le plus proche la touche
+                rope= (face & 1) ? r.left : r.right;
+            else if(r.split <= leaf.bounds.pmin(r.axis))
+                rope= r.right;
+            else if(r.split >= leaf.bounds.pmax(r.axis))
+                rope= r.left;
+            else
+                break;
+        }
+
+        leaf.ropes[face]= rope;
+    }
+}
+
+
+Hit KdTreeIntersector::traverse( const Ray& ray, const bool any ) const
+{
+    Hit hit;
+    if(m_root < 0)
+        return hit;
+
+    // intervalle du rayon dans la scene
+    Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    Point rmin= m_bounds.pmin;
+    Point rmax= m_bounds.pmax;
+    if(ray.d.x < 0) std::swap(rmin.x, rmax.x);
+    if(ray.d.y < 0) std::swap(rmin.y, rmax.y);
+    if(ray.d.z < 0) std::swap(rmin.z, rmax.z);
+    Vector dmin= (rmin - ray.o) * invd;
+    Vector dmax= (rmax - ray.o) * invd;
+
+    float t= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, 0.f)));
+    float t1= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, ray.tmax)));
+    if(t > t1)
+        return hit;
+
+    int index= m_root;
+    // chaque feuille est visitee au plus une fois, protege le parcours contre les erreurs d'arrondis
+    for(size_t guard= 0; index >= 0 && guard < m_leaves.size(); guard++)
+    {
+        // descend jusqu'a la feuille qui contient le point d'entree
+        Point p= ray.o + t * ray.d;
+        while(m_nodes[index].axis < 3)
+        {
+            const KdNode& node= m_nodes[index];
+            float v= p(node.axis);
+            if(v < node.split)
+                index= node.left;
+            else if(v > node.split)
+                index= node.right;
+            else
+                // sur le plan, choisit le fils dans la direction du rayon
+                index= (ray.d(node.axis) < 0) ? node.left : node.right;
+        }
+
+        const KdLeaf& leaf= m_leaves[m_nodes[index].left];
+        for(int i= leaf.begin; i < leaf.end; i++)
+        {
+            if(Hit h= m_triangles[m_references[i]].intersect(ray, hit ? hit.t : ray.tmax))
+            {
+                hit= h;
+                if(any)
+                    return hit;
+            }
+        }
+
+        // face de sortie
+        float texit= FLT_MAX;
+        int face= -1;
+        for(int axis= 0; axis < 3; axis++)
+        {
+            if(ray.d(axis) > 0)
+            {
+                float te= (leaf.bounds.pmax(axis) - ray.o(axis)) * invd(axis);
+                if(te < texit) { texit= te; face= 2*axis +1; }
+            }
+            else if(ray.d(axis) < 0)
+            {
+                float te= (leaf.bounds.pmin(axis) - ray.o(axis)) * invd(axis);
+                if(te < texit) { texit= te; face= 2*axis; }
+            }
+        }
+
+        // les triangles peuvent deborder de la feuille, l'intersection n'est la plus proche que si elle se trouve dans la feuille
+        if(hit && hit.t <= texit)
+            return hit;
+        if(face < 0 || texit >= t1)
+            return hit;
+
+        index= leaf.ropes[face];
+        t= std::max(t, texit);
+    }
+
+    return hit;
+}
+
+Hit KdTreeIntersector::intersect( const Ray& ray ) const
+{
+    return traverse(ray, false);
+}
+
+bool KdTreeIntersector::occluded( const Ray& ray ) const
+{
+    return traverse(ray, true);
+}
+
+
+IntersectorStats KdTreeIntersector::stats( ) const
+{
+    IntersectorStats s;
+    s.triangles= int(m_triangles.size());
+    s.nodes= int(m_nodes.size());
+    s.leaves= int(m_leaves.size());
+    s.references= int(m_references.size());
+    s.memory= m_triangles.size() * sizeof(Triangle) + m_nodes.size() * sizeof(KdNode) + m_leaves.size() * sizeof(KdLeaf) + m_references.size() * sizeof(int);
+    return s;
+}
@@ -0,0 +1,59 @@
+//! \file kdtree.h kd-tree construit avec la SAH, parcours sans pile avec des "ropes".
+
+#ifndef _KDTREE_H
+#define _KDTREE_H
+
+#include <vector>
+
+#include "intersector.h"
+
+
+/*! kd-tree : chaque noeud coupe son englobant par un plan aligne sur un axe, choisi en minimisant la SAH, les triangles a cheval sur le plan
+    sont references par les 2 fils. les feuilles sont reliees a leurs voisines, par face, cf "stackless kd-tree traversal for high performance
+    gpu ray tracing", Popov et al, 2007 : un rayon traverse la feuille, sort par une face et redescend dans l'arbre a partir du voisin, sans pile.
+    les feuilles sont visitees dans l'ordre du rayon, le parcours s'arrete dans la premiere feuille qui contient une intersection.
+ */
+class KdTreeIntersector : public Intersector
+{
+public:
+    KdTreeIntersector( const int leaf_size= 2 ) : m_triangles(), m_nodes(), m_leaves(), m_references(), m_bounds(), m_root(-1), m_leaf_size(leaf_size), m_max_depth(0) {}
+
+    const char *name( ) const { return "kdtree"; }
+    int build( const Mesh& mesh );
+    Hit intersect( const Ray& ray ) const;
+    bool occluded( const Ray& ray ) const;
+    IntersectorStats stats( ) const;
+
+protected:
+    //! noeud : plan de separation, ou feuille si axis == 3.
+    struct KdNode
+    {
+        float split;
+        int axis;
+        int left;           // fils gauche, ou indice de la feuille dans m_leaves
+        int right;
+    };
+
+    //! feuille : englobant, triangles [begin end) de m_references et voisins par face, -1 a l'exterieur de la scene.
+    struct KdLeaf
+    {
+        BBox bounds;
+        int ropes[6];       // face 2*axis pour pmin(axis), 2*axis+1 pour pmax(axis)
+        int begin, end;
+    };
+
+    int build( const BBox& bounds, std::vector<int>& ids, const int depth );
+    void link( const int index, const int ropes[6] );
+    Hit traverse( const Ray& ray, const bool any ) const;
+
+    std::vector<Triangle> m_triangles;
+    std::vector<KdNode> m_nodes;
+    std::vector<KdLeaf> m_leaves;
+    std::vector<int> m_references;
+    BBox m_bounds;
+    int m_root;
+    int m_leaf_size;
+    int m_max_depth;
+};
+
+#endif
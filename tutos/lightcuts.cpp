@@ -0,0 +1,333 @@
+//! \file lightcuts.cpp
+
+#include <cmath>
+#include <algorithm>
+
+#include "lightcuts.h"
+
+
+std::vector<VPL> trace_vpls( const Mesh& mesh, const BVH& bvh, const Sources& sources, const int count, const unsigned seed, TextureCache *textures )
+{
+    std::vector<VPL> vpls;
+    if(sources.size() == 0 || sources.emission <= 0 || count <= 0)
+        return vpls;
+
+    std::vector<VPL> paths(count);
+    std::vector<char> valid(count, 0);
+#pragma omp parallel for schedule(dynamic, 64)
+    for(int i= 0; i < count; i++)
+    {
+        std::default_random_engine rng(hash_seed(seed, i));
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+        // choisit une source, puis un point sur la source et une direction distribuee selon cos theta / pi
+        Point o;
+        Vector d;
+        Color flux;
+        sources.sample_emission(count, rng, u01, o, d, flux);
+
+        Ray ray(o, d);
+        if(Hit hit= bvh.intersect(ray))
+        {
+            const TriangleData& triangle= mesh.triangle(hit.triangle_id);
+            const Material& material= mesh.triangle_material(hit.triangle_id);
+
+            Color diffuse= material.diffuse;
+            if(textures && material.diffuse_texture != -1 && mesh.has_texcoord())
+            {
+                float w= 1 - hit.u - hit.v;
+                vec2 uv= vec2(w * triangle.ta.x + hit.u * triangle.tb.x + hit.v * triangle.tc.x, w * triangle.ta.y + hit.u * triangle.tb.y + hit.v * triangle.tc.y);
+                diffuse= diffuse * textures->sample(material.diffuse_texture, uv);
+            }
+            if(diffuse.power() <= 0)
+                continue;
+
+            // oriente la normale vers la source
+            Vector n= normal(hit, triangle);
+            if(dot(n, ray.d) > 0)
+                n= -n;
+
+            paths[i]= VPL(point(hit, ray), n, flux * diffuse / float(M_PI));
+            valid[i]= 1;
+        }
+    }
+
+    for(int i= 0; i < count; i++)
+        if(valid[i])
+            vpls.push_back(paths[i]);
+
+    return vpls;
+}
+
+
+// angle entre 2 directions normalisees
+static float angle( const Vector& a, const Vector& b )
+{
+    return std::acos(std::max(-1.f, std::min(1.f, dot(a, b))));
+}
+
+// cos maximum de l'angle entre la direction n du repere et les directions des points de la boite [pmin pmax], vus depuis l'origine.
+// la boite est transformee dans le repere local, z le long de n, et englobee dans une boite alignee sur les axes locaux.
+static float max_cos( const World& world, const Point& pmin, const Point& pmax )
+{
+    Vector lmin, lmax;
+    for(int i= 0; i < 8; i++)
+    {
+        Vector corner= Vector((i & 1) ? pmax.x : pmin.x, (i & 2) ? pmax.y : pmin.y, (i & 4) ? pmax.z : pmin.z);
+        Vector local= world.inverse(corner);
+        if(i == 0)
+            lmin= lmax= local;
+        lmin= Vector(std::min(lmin.x, local.x), std::min(lmin.y, local.y), std::min(lmin.z, local.z));
+        lmax= Vector(std::max(lmax.x, local.x), std::max(lmax.y, local.y), std::max(lmax.z, local.z));
+    }
+
+    if(lmax.z <= 0)
+        // la boite est derriere le plan
+        return 0;
+
+    // distance minimale a l'axe z : z / sqrt(x^2 + y^2 + z^2) est maximal pour z maximal et x, y minimaux
+    float x= (lmin.x <= 0 && lmax.x >= 0) ? 0 : std::min(std::abs(lmin.x), std::abs(lmax.x));
+    float y= (lmin.y <= 0 && lmax.y >= 0) ? 0 : std::min(std::abs(lmin.y), std::abs(lmax.y));
+    return lmax.z / std::sqrt(x*x + y*y + lmax.z*lmax.z);
+}
+
+
+void Lightcuts::build( const std::vector<VPL>& lights, const unsigned seed )
+{
+    m_lights= lights;
+    m_nodes.clear();
+    m_root= -1;
+    m_diagonal2= 0;
+    if(m_lights.empty())
+        return;
+
+    m_nodes.reserve(2 * m_lights.size());
+
+    std::vector<int> ids(m_lights.size());
+    for(int i= 0; i < int(ids.size()); i++)
+        ids[i]= i;
+
+    BBox bounds= BBox(m_lights[0].p);
+    for(int i= 1; i < int(m_lights.size()); i++)
+        bounds.insert(m_lights[i].p);
+    m_diagonal2= length2(Vector(bounds.pmin, bounds.pmax));
+
+    std::default_random_engine rng(seed);
+    m_root= build(ids, 0, int(ids.size()), rng);
+}
+
+int Lightcuts::build( std::vector<int>& ids, const int begin, const int end, std::default_random_engine& rng )
+{
+    int index= int(m_nodes.size());
+    m_nodes.push_back(LightNode());
+
+    if(end - begin == 1)
+    {
+        // feuille, un seul vpl
+        const VPL& light= m_lights[ids[begin]];
+
+        LightNode& node= m_nodes[index];
+        node.bounds= BBox(light.p);
+        node.axis= light.n;
+        node.angle= 0;
+        node.intensity= light.intensity;
+        node.light= ids[begin];
+        node.left= -1;
+        node.right= -1;
+        return index;
+    }
+
+    // repartit les vpls en 2 groupes de meme taille, le long du plus grand axe de l'englobant des positions et des normales.
+    // les normales sont mises a l'echelle de la scene, cf la metrique de regroupement de l'article : 2 vpls proches mais orientes
+    // differemment, dans le coin d'une piece, par exemple, produisent un cone trop ouvert et des bornes peu precises.
+    BBox bounds= BBox(m_lights[ids[begin]].p);
+    BBox normals= BBox(Point(m_lights[ids[begin]].n));
+    for(int i= begin +1; i < end; i++)
+    {
+        bounds.insert(m_lights[ids[i]].p);
+        normals.insert(Point(m_lights[ids[i]].n));
+    }
+
+    float scale= std::sqrt(m_diagonal2) / 2;
+    Vector dp= Vector(bounds.pmin, bounds.pmax);
+    Vector dn= Vector(normals.pmin, normals.pmax) * scale;
+    float extents[6]= { dp.x, dp.y, dp.z, dn.x, dn.y, dn.z };
+    int axis= int(std::max_element(extents, extents + 6) - extents);
+
+    int m= (begin + end) / 2;
+    std::nth_element(ids.begin() + begin, ids.begin() + m, ids.begin() + end,
+        [&]( const int a, const int b )
+        {
+            if(axis < 3)
+                return m_lights[a].p(axis) < m_lights[b].p(axis);
+            else
+                return m_lights[a].n(axis - 3) < m_lights[b].n(axis - 3);
+        });
+
+    int left= build(ids, begin, m, rng);
+    int right= build(ids, m, end, rng);
+
+    // attention : m_nodes a pu etre re-alloue pendant la construction des fils
+    const LightNode& l= m_nodes[left];
+    const LightNode& r= m_nodes[right];
+    LightNode node;
+    node.bounds= BBox(l.bounds).insert(r.bounds);
+    node.intensity= l.intensity + r.intensity;
+    node.left= left;
+    node.right= right;
+
+    // cone des normales englobant les cones des fils
+    float lpower= l.intensity.power();
+    float rpower= r.intensity.power();
+    Vector a= l.axis * lpower + r.axis * rpower;
+    if(length2(a) < 1e-12f)
+    {
+        node.axis= l.axis;
+        node.angle= float(M_PI);
+    }
+    else
+    {
+        node.axis= normalize(a);
+        node.angle= std::min(float(M_PI), std::max(angle(node.axis, l.axis) + l.angle, angle(node.axis, r.axis) + r.angle));
+    }
+
+    // representant, choisi proportionnellement a l'intensite des fils
+    std::uniform_real_distribution<float> u01(0.f, 1.f);
+    node.light= (u01(rng) * (lpower + rpower) < lpower) ? l.light : r.light;
+
+    m_nodes[index]= node;
+    return index;
+}
+
+
+float Lightcuts::geometry( const BVH& bvh, const int id, const Point& p, const Vector& pn, const float clamp2, LightcutsStats *stats ) const
+{
+    const VPL& light= m_lights[id];
+    Vector l= Vector(p, light.p);
+    float d2= length2(l);
+    if(d2 <= 0)
+        return 0;
+
+    float cos_theta= dot(pn, l);
+    float cos_theta_l= -dot(light.n, l);
+    if(cos_theta <= 0 || cos_theta_l <= 0)
+        return 0;
+
+    if(stats)
+        stats->rays++;
+
+    Ray shadow_ray(p + 0.00001f * pn, l);
+    shadow_ray.tmax= 1 - .0001f;
+    if(!bvh.visible(shadow_ray))
+        return 0;
+
+    // cos theta et cos theta_l sont calcules avec l non normalise, d'ou le 1 / d^2 supplementaire
+    return cos_theta * cos_theta_l / (d2 * std::max(d2, clamp2));
+}
+
+float Lightcuts::bound( const LightNode& node, const Point& p, const Vector& pn, const float clamp2 ) const
+{
+    // distance minimale entre p et l'englobant
+    Point q= max(node.bounds.pmin, min(p, node.bounds.pmax));
+    float d2= std::max(distance2(p, q), clamp2);
+
+    // cos maximal au point p, pour les directions vers l'englobant
+    Point pmin= Point(Vector(p, node.bounds.pmin));
+    Point pmax= Point(Vector(p, node.bounds.pmax));
+    float cos_theta= max_cos(World(pn), pmin, pmax);
+    if(cos_theta <= 0)
+        return 0;
+
+    // cos maximal des vpls, pour les directions vers p : angle minimal entre l'axe du cone et les directions, diminue de l'ouverture du cone
+    float cos_theta_l= 1;
+    if(node.angle < float(M_PI))
+    {
+        Point lmin= Point(Vector(node.bounds.pmax, p));
+        Point lmax= Point(Vector(node.bounds.pmin, p));
+        float phi= std::acos(max_cos(World(node.axis), lmin, lmax)) - node.angle;
+        if(phi >= float(M_PI / 2))
+            return 0;
+        if(phi > 0)
+            cos_theta_l= std::cos(phi);
+    }
+
+    return cos_theta * cos_theta_l / d2;
+}
+
+
+namespace {
+// groupe de la coupe, en attente de raffinement
+struct CutNode
+{
+    float error;        // borne de l'erreur de l'estimation
+    float g;            // terme geometrique * visibilite du representant
+    int node;
+
+    bool operator< ( const CutNode& b ) const { return error < b.error; }
+};
+}
+
+Color Lightcuts::shade( const BVH& bvh, const Point& p, const Vector& pn, const Color& diffuse, const Color& direct,
+    const LightcutsParams& params, LightcutsStats *stats ) const
+{
+    if(m_root < 0)
+        return Black();
+
+    // taille maximale de la coupe, la file de priorite est allouee sur la pile, pas d'allocation par point
+    const int max_cut= 1024;
+    CutNode heap[max_cut];
+    int heap_size= 0;
+
+    const float clamp2= params.clamp * params.clamp * m_diagonal2;
+    const int cut_limit= std::max(1, std::min(params.max_cut, max_cut));
+
+    // les groupes sont compares dans l'espace des intensites, sans le terme diffuse / pi commun a tous les vpls
+    const Color fr= diffuse / float(M_PI);
+    
+    const LightNode& root= m_nodes[m_root];
+    float g= geometry(bvh, root.light, p, pn, clamp2, stats);
+    Color total= root.intensity * g;
+    int cut= 1;
+    if(!root.leaf())
+    {
+        heap[heap_size++]= { (fr * root.intensity).power() * bound(root, p, pn, clamp2), g, m_root };
+        std::push_heap(heap, heap + heap_size);
+    }
+
+    while(heap_size > 0 && cut < cut_limit)
+    {
+        // raffine le groupe dont l'erreur est la plus grande, s'il n'est pas assez precis
+        if(heap[0].error <= params.error * (direct + fr * total).power())
+            break;
+
+        std::pop_heap(heap, heap + heap_size);
+        CutNode parent= heap[--heap_size];
+        const LightNode& node= m_nodes[parent.node];
+        total= total - node.intensity * parent.g;
+
+        int children[2]= { node.left, node.right };
+        for(int k= 0; k < 2; k++)
+        {
+            const LightNode& child= m_nodes[children[k]];
+
+            // le fils qui partage le representant du pere reutilise son evaluation, pas de rayon supplementaire
+            float child_g= (child.light == node.light) ? parent.g : geometry(bvh, child.light, p, pn, clamp2, stats);
+            total= total + child.intensity * child_g;
+
+            if(!child.leaf())
+            {
+                heap[heap_size++]= { (fr * child.intensity).power() * bound(child, p, pn, clamp2), child_g, children[k] };
+                std::push_heap(heap, heap + heap_size);
+            }
+        }
+        cut++;
+    }
+
+    if(stats)
+    {
+        stats->points++;
+        stats->cut+= cut;
+    }
+
+    return fr * total;
+}
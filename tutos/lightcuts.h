@@ -0,0 +1,110 @@
+//! \file lightcuts.h radiosite instantanee : eclairage indirect par des points de lumiere virtuels, vpl, regroupes dans un arbre de lightcuts.
+
+#ifndef _LIGHTCUTS_H
+#define _LIGHTCUTS_H
+
+#include <vector>
+#include <random>
+
+#include "vec.h"
+#include "color.h"
+#include "mesh.h"
+
+#include "bvh.h"
+#include "sources.h"
+#include "texture_cache.h"
+
+
+//! point de lumiere virtuel : lumiere reflechie par un point eclaire directement par les sources.
+struct VPL
+{
+    Point p;
+    Vector n;
+    Color intensity;    //!< intensite dans la direction de la normale, flux recu * albedo / pi. l'emission est distribuee selon cos theta autour de n.
+
+    VPL( ) : p(), n(), intensity() {}
+    VPL( const Point& _p, const Vector& _n, const Color& _intensity ) : p(_p), n(_n), intensity(_intensity) {}
+};
+
+/*! genere les vpls : count chemins partent des sources, proportionnellement a leur emission, et creent un vpl sur la premiere surface touchee.
+    l'albedo des surfaces utilise la texture diffuse, si textures n'est pas nul. chaque chemin utilise son propre generateur de nombres
+    aleatoires, initialise par seed : les vpls ne dependent pas du nombre de threads.
+    renvoie les vpls, un peu moins que count, les chemins qui sortent de la scene ou touchent une surface noire ne creent pas de vpl.
+ */
+std::vector<VPL> trace_vpls( const Mesh& mesh, const BVH& bvh, const Sources& sources, const int count, const unsigned seed= 0, TextureCache *textures= nullptr );
+
+
+//! parametres de l'evaluation des coupes.
+struct LightcutsParams
+{
+    float error;        //!< erreur relative acceptee par groupe de vpls, par rapport a l'eclairage total estime du point, direct + indirect
+    int max_cut;        //!< nombre maximum de groupes evalues par point
+    float clamp;        //!< distance minimale entre un point et un vpl, en fraction de la diagonale des vpls, limite les singularites en 1 / d^2
+
+    LightcutsParams( ) : error(0.02f), max_cut(1000), clamp(0.01f) {}
+};
+
+//! statistiques des evaluations, a accumuler par thread.
+struct LightcutsStats
+{
+    long int points;        //!< nombre de points eclaires
+    long int cut;           //!< nombre total de groupes evalues
+    long int rays;          //!< nombre total de rayons d'ombre
+
+    LightcutsStats( ) : points(0), cut(0), rays(0) {}
+
+    LightcutsStats& operator+= ( const LightcutsStats& stats ) { points+= stats.points; cut+= stats.cut; rays+= stats.rays; return *this; }
+};
+
+//! noeud de l'arbre des vpls : englobant, cone des normales et intensite totale du groupe.
+struct LightNode
+{
+    BBox bounds;            //!< englobant des positions
+    Vector axis;            //!< axe du cone des normales
+    float angle;            //!< demi angle d'ouverture du cone, en radians
+    Color intensity;        //!< intensite totale des vpls du groupe
+    int light;              //!< vpl representant du groupe
+    int left;               //!< fils, -1 pour une feuille
+    int right;
+
+    bool leaf( ) const { return left < 0; }
+};
+
+/*! lightcuts, cf "Lightcuts: a scalable approach to illumination", Walter et al, 2005.
+    l'arbre regroupe les vpls proches et orientes dans la meme direction. chaque groupe est represente par un de ses vpls, choisi proportionnellement
+    a son intensite, et son eclairage est estime par celui du representant, multiplie par l'intensite totale du groupe.
+    pour chaque point, la coupe part de la racine et remplace le groupe dont l'erreur maximale est la plus grande par ses 2 fils, tant que cette erreur
+    depasse params.error * l'eclairage estime : les groupes eloignes sont evalues en une seule fois, et le nombre de rayons d'ombre reste tres inferieur
+    au nombre de vpls.
+ */
+class Lightcuts
+{
+public:
+    Lightcuts( ) : m_lights(), m_nodes(), m_root(-1), m_diagonal2(0) {}
+    Lightcuts( const std::vector<VPL>& lights, const unsigned seed= 0 ) : m_lights(), m_nodes(), m_root(-1), m_diagonal2(0) { build(lights, seed); }
+
+    //! construit l'arbre, seed initialise le choix des representants.
+    void build( const std::vector<VPL>& lights, const unsigned seed= 0 );
+
+    /*! renvoie l'eclairage indirect reflechi par le point p, de normale pn et de couleur diffuse, vers la camera.
+        direct est l'eclairage direct du point, deja estime : la precision de la coupe est relative a l'eclairage total, les points bien eclaires
+        par les sources evaluent moins de groupes. stats peut etre nul.
+     */
+    Color shade( const BVH& bvh, const Point& p, const Vector& pn, const Color& diffuse, const Color& direct,
+        const LightcutsParams& params= LightcutsParams(), LightcutsStats *stats= nullptr ) const;
+
+    int size( ) const { return int(m_lights.size()); }
+    const VPL& operator() ( const int id ) const { return m_lights[id]; }
+
+protected:
+    int build( std::vector<int>& ids, const int begin, const int end, std::default_random_engine& rng );
+    float geometry( const BVH& bvh, const int light, const Point& p, const Vector& pn, const float clamp2, LightcutsStats *stats ) const;
+    float bound( const LightNode& node, const Point& p, const Vector& pn, const float clamp2 ) const;
+
+    std::vector<VPL> m_lights;
+    std::vector<LightNode> m_nodes;
+    int m_root;
+    float m_diagonal2;   // longueur au carre de la diagonale des vpls
+};
+
+#endif
@@ -0,0 +1,477 @@
+//! \file lightmap.cpp
+
+#include <cfloat>
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#include "lightmap.h"
+#include "render_tile.h"
+
+
+// normale geometrique du triangle, de longueur 2 * aire
+static Vector area_normal( const TriangleData& triangle )
+{
+    return cross(Vector(Point(triangle.a), Point(triangle.b)), Vector(Point(triangle.a), Point(triangle.c)));
+}
+
+// normale geometrique du triangle, nulle pour un triangle degenere
+static Vector triangle_normal( const TriangleData& triangle )
+{
+    Vector n= area_normal(triangle);
+    float l= length(n);
+    if(l == 0)
+        return Vector(0, 0, 0);
+    return n / l;
+}
+
+namespace {
+// arete d'un triangle, entre 2 sommets soudes
+struct Edge
+{
+    int a, b;
+    int triangle;
+
+    bool operator< ( const Edge& e ) const { return (a != e.a) ? a < e.a : ((b != e.b) ? b < e.b : triangle < e.triangle); }
+};
+
+// carte : groupe de triangles projetes sur un plan
+struct Chart
+{
+    Vector normal;      // somme des normales des triangles, ponderees par leur aire
+    vec2 pmin, pmax;    // englobant des triangles projetes
+    int width, height;  // taille de la carte dans l'atlas, en texels, marges comprises
+    int x, y;           // position dans l'atlas
+
+    Chart( ) : normal(0, 0, 0), pmin(), pmax(), width(0), height(0), x(0), y(0) {}
+};
+}
+
+// renumerote les sommets des triangles : les sommets a la meme position ont le meme indice.
+static std::vector<int> weld( const Mesh& mesh )
+{
+    int n= 3 * mesh.triangle_count();
+    std::vector<vec3> positions(n);
+    for(int i= 0; i < mesh.triangle_count(); i++)
+    {
+        TriangleData triangle= mesh.triangle(i);
+        positions[3*i]= triangle.a;
+        positions[3*i +1]= triangle.b;
+        positions[3*i +2]= triangle.c;
+    }
+
+    std::vector<int> order(n);
+    for(int i= 0; i < n; i++)
+        order[i]= i;
+
+    auto less= [&]( const int a, const int b )
+    {
+        const vec3& pa= positions[a];
+        const vec3& pb= positions[b];
+        if(pa.x != pb.x) return pa.x < pb.x;
+        if(pa.y != pb.y) return pa.y < pb.y;
+        return pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+
+    std::vector<int> ids(n);
+    int count= 0;
+    for(int i= 0; i < n; i++)
+    {
+        if(i > 0 && !less(order[i -1], order[i]))
+            ids[order[i]]= ids[order[i -1]];
+        else
+            ids[order[i]]= count++;
+    }
+
+    return ids;
+}
+
+std::vector<vec2> lightmap_texcoords( const Mesh& mesh, const LightmapParams& params, LightmapStats *stats )
+{
+    const int n= mesh.triangle_count();
+    std::vector<vec2> texcoords(3 * n);
+    if(n == 0)
+        return texcoords;
+
+    // voisins de chaque triangle, par les aretes partagees
+    std::vector<int> ids= weld(mesh);
+    std::vector<Edge> edges;
+    edges.reserve(3 * n);
+    for(int i= 0; i < n; i++)
+    for(int k= 0; k < 3; k++)
+    {
+        int a= ids[3*i + k];
+        int b= ids[3*i + (k +1) % 3];
+        if(a != b)
+            edges.push_back( { std::min(a, b), std::max(a, b), i } );
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector< std::vector<int> > neighbors(n);
+    for(int begin= 0; begin < int(edges.size()); )
+    {
+        int end= begin +1;
+        while(end < int(edges.size()) && edges[end].a == edges[begin].a && edges[end].b == edges[begin].b)
+            end++;
+
+        for(int i= begin; i < end; i++)
+        for(int j= begin; j < end; j++)
+            if(i != j)
+                neighbors[edges[i].triangle].push_back(edges[j].triangle);
+
+        begin= end;
+    }
+
+    std::vector<Vector> normals(n);
+    for(int i= 0; i < n; i++)
+        normals[i]= triangle_normal(mesh.triangle(i));
+
+    // cartes : parcours des voisins orientes comme la normale moyenne de la carte, ponderee par l'aire des triangles
+    std::vector<int> charts(n, -1);
+    std::vector<Chart> atlas;
+    std::vector<int> stack;
+    std::vector<int> members;
+    for(int i= 0; i < n; i++)
+    {
+        if(charts[i] != -1)
+            continue;
+
+        int id= int(atlas.size());
+        atlas.push_back(Chart());
+
+        Vector sum= area_normal(mesh.triangle(i));
+        Vector average= normals[i];
+        charts[i]= id;
+        stack.push_back(i);
+        members.assign(1, i);
+        while(!stack.empty())
+        {
+            int t= stack.back();
+            stack.pop_back();
+
+            for(int m : neighbors[t])
+                if(charts[m] == -1 && dot(normals[m], average) >= params.normal_angle)
+                {
+                    charts[m]= id;
+                    stack.push_back(m);
+                    members.push_back(m);
+
+                    sum= sum + area_normal(mesh.triangle(m));
+                    if(length2(sum) > 0)
+                        average= normalize(sum);
+                }
+        }
+
+        // la normale moyenne change pendant le parcours : les premiers triangles ajoutes peuvent etre retournes une fois projetes
+        // sur le plan de la carte, et recouvrir leurs voisins. ils sont retires de la carte, et seront places dans une autre carte.
+        for(bool removed= true; removed && length2(sum) > 0; )
+        {
+            removed= false;
+            Vector normal= normalize(sum);
+            for(int k= 0; k < int(members.size()); k++)
+            {
+                int t= members[k];
+                if(dot(normals[t], normal) > 0 || length2(normals[t]) == 0)
+                    continue;
+
+                charts[t]= -1;
+                sum= sum - area_normal(mesh.triangle(t));
+                members[k]= members.back();
+                members.pop_back();
+                k--;
+                removed= true;
+            }
+        }
+
+        atlas[id].normal= sum;
+
+        // le premier triangle de la carte a ete retire, il commence la carte suivante
+        if(charts[i] == -1)
+            i--;
+    }
+
+    // projection des triangles sur le plan de chaque carte, perpendiculaire a la normale moyenne
+    std::vector<World> frames;
+    frames.reserve(atlas.size());
+    for(Chart& chart : atlas)
+    {
+        Vector normal= (length2(chart.normal) > 0) ? normalize(chart.normal) : Vector(0, 0, 1);
+        frames.push_back(World(normal));
+        chart.pmin= vec2(FLT_MAX, FLT_MAX);
+        chart.pmax= vec2(-FLT_MAX, -FLT_MAX);
+    }
+
+    std::vector<vec2> projected(3 * n);
+    for(int i= 0; i < n; i++)
+    {
+        TriangleData triangle= mesh.triangle(i);
+        Chart& chart= atlas[charts[i]];
+        const World& frame= frames[charts[i]];
+
+        vec3 p[3]= { triangle.a, triangle.b, triangle.c };
+        for(int k= 0; k < 3; k++)
+        {
+            Vector v= Vector(p[k]);
+            vec2 q= vec2(dot(v, frame.t), dot(v, frame.b));
+            projected[3*i + k]= q;
+            chart.pmin= vec2(std::min(chart.pmin.x, q.x), std::min(chart.pmin.y, q.y));
+            chart.pmax= vec2(std::max(chart.pmax.x, q.x), std::max(chart.pmax.y, q.y));
+        }
+    }
+
+    // placement des cartes par rangees, triees par hauteur decroissante.
+    // commence par une densite qui remplit la moitie de la lightmap, et la diminue jusqu'a ce que toutes les cartes soient placees
+    double area= 0;
+    for(const Chart& chart : atlas)
+        area+= double(chart.pmax.x - chart.pmin.x) * double(chart.pmax.y - chart.pmin.y);
+
+    const int resolution= params.resolution;
+    float scale= (area > 0) ? float(std::sqrt(0.5 * resolution * resolution / area)) : 1;
+
+    std::vector<int> order(atlas.size());
+    for(int i= 0; i < int(order.size()); i++)
+        order[i]= i;
+
+    for(;;)
+    {
+        for(Chart& chart : atlas)
+        {
+            chart.width= int(std::ceil((chart.pmax.x - chart.pmin.x) * scale)) + 1 + 2 * params.padding;
+            chart.height= int(std::ceil((chart.pmax.y - chart.pmin.y) * scale)) + 1 + 2 * params.padding;
+        }
+
+        std::sort(order.begin(), order.end(), [&]( const int a, const int b ) { return atlas[a].height > atlas[b].height; });
+
+        bool fit= true;
+        int x= 0;
+        int y= 0;
+        int row= 0;
+        for(int i : order)
+        {
+            Chart& chart= atlas[i];
+            if(x + chart.width > resolution)
+            {
+                // rangee suivante
+                x= 0;
+                y+= row;
+                row= 0;
+            }
+            if(x + chart.width > resolution || y + chart.height > resolution)
+            {
+                fit= false;
+                break;
+            }
+
+            chart.x= x;
+            chart.y= y;
+            x+= chart.width;
+            row= std::max(row, chart.height);
+        }
+
+        if(fit)
+            break;
+        if(scale < 1e-6f)
+        {
+            printf("[error] lightmap: too many charts for a %dx%d texture...\n", resolution, resolution);
+            return std::vector<vec2>();
+        }
+
+        scale= scale * 0.9f;
+    }
+
+    // coordonnees de texture des sommets, dans [0 1]
+    for(int i= 0; i < 3 * n; i++)
+    {
+        const Chart& chart= atlas[charts[i / 3]];
+        float x= chart.x + params.padding + (projected[i].x - chart.pmin.x) * scale;
+        float y= chart.y + params.padding + (projected[i].y - chart.pmin.y) * scale;
+        texcoords[i]= vec2(x / resolution, y / resolution);
+    }
+
+    if(stats)
+    {
+        stats->charts= int(atlas.size());
+        stats->scale= scale;
+    }
+
+    return texcoords;
+}
+
+
+// couleur diffuse du point d'intersection, sans filtrage de la texture
+static Color albedo( const Mesh& mesh, TextureCache *textures, const Hit& hit, const TriangleData& triangle )
+{
+    const Material& material= mesh.triangle_material(hit.triangle_id);
+    Color diffuse= material.diffuse;
+    if(textures && material.diffuse_texture != -1 && mesh.has_texcoord())
+    {
+        float w= 1 - hit.u - hit.v;
+        vec2 uv= vec2(w * triangle.ta.x + hit.u * triangle.tb.x + hit.v * triangle.tc.x, w * triangle.ta.y + hit.u * triangle.tb.y + hit.v * triangle.tc.y);
+        diffuse= diffuse * textures->sample(material.diffuse_texture, uv);
+    }
+
+    return diffuse;
+}
+
+Image bake_lightmap( Mesh& mesh, const BVH& bvh, const Sources& sources, TextureCache *textures, const LightmapParams& params, LightmapStats *stats )
+{
+    const int resolution= params.resolution;
+    std::vector<vec2> texcoords= lightmap_texcoords(mesh, params, stats);
+    if(texcoords.empty())
+        // pas de triangles, ou les cartes ne tiennent pas dans la lightmap
+        return Image();
+
+    // rasterise les triangles dans l'atlas : triangle et coordonnees barycentriques du centre de chaque texel
+    std::vector<Hit> texels(resolution * resolution);
+    for(int i= 0; i < mesh.triangle_count(); i++)
+    {
+        vec2 a= vec2(texcoords[3*i].x * resolution, texcoords[3*i].y * resolution);
+        vec2 b= vec2(texcoords[3*i +1].x * resolution, texcoords[3*i +1].y * resolution);
+        vec2 c= vec2(texcoords[3*i +2].x * resolution, texcoords[3*i +2].y * resolution);
+
+        float area= (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+        if(area == 0)
+            continue;
+
+        int xmin= std::max(0, int(std::floor(std::min(a.x, std::min(b.x, c.x)))));
+        int ymin= std::max(0, int(std::floor(std::min(a.y, std::min(b.y, c.y)))));
+        int xmax= std::min(resolution -1, int(std::ceil(std::max(a.x, std::max(b.x, c.x)))));
+        int ymax= std::min(resolution -1, int(std::ceil(std::max(a.y, std::max(b.y, c.y)))));
+        for(int y= ymin; y <= ymax; y++)
+        for(int x= xmin; x <= xmax; x++)
+        {
+            float px= x + 0.5f;
+            float py= y + 0.5f;
+            float u= ((px - a.x) * (c.y - a.y) - (c.x - a.x) * (py - a.y)) / area;
+            float v= ((b.x - a.x) * (py - a.y) - (px - a.x) * (b.y - a.y)) / area;
+            if(u < 0 || v < 0 || u + v > 1)
+                continue;
+
+            texels[y * resolution + x]= Hit(i, 0, u, v);
+        }
+    }
+
+    // eclairage de chaque texel, par blocs
+    Image lightmap(resolution, resolution, Color(0, 0, 0, 0));
+    const int tile= std::max(1, params.tile);
+    const int tiles= (resolution + tile -1) / tile;
+
+    int covered= 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+: covered)
+    for(int t= 0; t < tiles * tiles; t++)
+    {
+        int xmin= (t % tiles) * tile;
+        int ymin= (t / tiles) * tile;
+        int xmax= std::min(resolution, xmin + tile);
+        int ymax= std::min(resolution, ymin + tile);
+
+        for(int y= ymin; y < ymax; y++)
+        for(int x= xmin; x < xmax; x++)
+        {
+            const Hit& hit= texels[y * resolution + x];
+            if(!hit)
+                continue;
+
+            std::default_random_engine rng(hash_seed(params.seed, x, y));
+            std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+            const TriangleData& triangle= mesh.triangle(hit.triangle_id);
+            const Material& material= mesh.triangle_material(hit.triangle_id);
+            Point p= point(hit, triangle);
+            Vector pn= normal(hit, triangle);
+            Color diffuse= albedo(mesh, textures, hit, triangle);
+
+            Color irradiance= direct_irradiance(bvh, sources, p, pn, std::max(1, params.samples), rng, u01);
+
+            // un rebond : directions distribuees selon cos theta / pi, eclairage direct du point vise
+            if(params.indirect > 0)
+            {
+                World world(pn);
+                Color indirect= Black();
+                for(int i= 0; i < params.indirect; i++)
+                {
+                    Ray ray(p + 0.00001f * pn, world(sample_cosine(u01(rng), u01(rng))));
+                    if(Hit qhit= bvh.intersect(ray))
+                    {
+                        const TriangleData& qtriangle= mesh.triangle(qhit.triangle_id);
+                        Point q= point(qhit, ray);
+                        Vector qn= normal(qhit, qtriangle);
+                        if(dot(qn, ray.d) > 0)
+                            qn= -qn;
+
+                        // l'emission des sources est comptee par l'eclairage direct
+                        indirect= indirect + albedo(mesh, textures, qhit, qtriangle) / float(M_PI) * direct_irradiance(bvh, sources, q, qn, 1, rng, u01);
+                    }
+                }
+
+                // estimateur : pi * moyenne de la lumiere reflechie vers p, le cos theta / pi de la densite se simplifie
+                irradiance= irradiance + indirect * float(M_PI) / float(params.indirect);
+            }
+
+            lightmap(x, y)= Color(material.emission + diffuse / float(M_PI) * irradiance, 1);
+            covered++;
+        }
+    }
+
+    // dilatation : les texels vides voisins d'une carte prennent la moyenne de leurs voisins remplis, alpha marque les texels remplis
+    for(int k= 0; k < params.dilate; k++)
+    {
+        Image tmp= lightmap;
+    #pragma omp parallel for schedule(dynamic, 1)
+        for(int y= 0; y < resolution; y++)
+        for(int x= 0; x < resolution; x++)
+        {
+            if(lightmap(x, y).a > 0)
+                continue;
+
+            Color sum= Black();
+            int n= 0;
+            for(int dy= -1; dy <= 1; dy++)
+            for(int dx= -1; dx <= 1; dx++)
+            {
+                int nx= x + dx;
+                int ny= y + dy;
+                if(nx < 0 || ny < 0 || nx >= resolution || ny >= resolution)
+                    continue;
+                if(lightmap(nx, ny).a > 0)
+                {
+                    sum= sum + lightmap(nx, ny);
+                    n++;
+                }
+            }
+
+            if(n > 0)
+                tmp(x, y)= Color(sum / float(n), 1);
+        }
+
+        lightmap= tmp;
+    }
+
+    // remplace les coordonnees de texture, les sommets des triangles ne sont pas partages, chaque sommet a sa propre coordonnee
+    Mesh tmp(GL_TRIANGLES);
+    tmp.materials(mesh.materials());
+    bool has_normal= mesh.has_normal();
+    for(int i= 0; i < mesh.triangle_count(); i++)
+    {
+        TriangleData triangle= mesh.triangle(i);
+        if(mesh.materials().count())
+            tmp.material(mesh.triangle_material_index(i));
+
+        vec3 p[3]= { triangle.a, triangle.b, triangle.c };
+        vec3 n[3]= { triangle.na, triangle.nb, triangle.nc };
+        for(int k= 0; k < 3; k++)
+        {
+            tmp.texcoord(texcoords[3*i + k]);
+            if(has_normal)
+                tmp.normal(n[k]);
+            tmp.vertex(p[k]);
+        }
+    }
+    mesh= tmp;
+
+    if(stats)
+        stats->coverage= float(covered) / float(resolution * resolution);
+
+    return lightmap;
+}
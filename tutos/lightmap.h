@@ -0,0 +1,60 @@
+//! \file lightmap.h pre-calcul de l'eclairage dans une texture, lightmap, avec decoupage automatique de l'objet en cartes et placement dans l'atlas.
+
+#ifndef _LIGHTMAP_H
+#define _LIGHTMAP_H
+
+#include <vector>
+
+#include "vec.h"
+#include "mesh.h"
+#include "image.h"
+
+#include "bvh.h"
+#include "sources.h"
+#include "texture_cache.h"
+
+
+//! parametres du decoupage et du calcul.
+struct LightmapParams
+{
+    int resolution;         //!< largeur et hauteur de la lightmap, en texels
+    float normal_angle;     //!< cos minimum entre la normale d'un triangle et la normale moyenne de sa carte
+    int padding;            //!< marge autour de chaque carte, en texels, reservee a la dilatation
+    int samples;            //!< nombre d'echantillons par source et par texel, pour l'eclairage direct
+    int indirect;           //!< nombre de directions par texel pour l'eclairage indirect, 0 pour l'eclairage direct seul
+    int dilate;             //!< nombre d'iterations de dilatation des cartes, pour eviter les joints visibles avec le filtrage des textures
+    int tile;               //!< taille des blocs de texels calcules par un thread
+    unsigned seed;          //!< initialisation des generateurs de nombres aleatoires
+
+    LightmapParams( ) : resolution(1024), normal_angle(0.7f), padding(2), samples(16), indirect(0), dilate(4), tile(16), seed(0) {}
+};
+
+//! statistiques du decoupage.
+struct LightmapStats
+{
+    int charts;             //!< nombre de cartes
+    float scale;            //!< nombre de texels par unite de longueur
+    float coverage;         //!< proportion des texels de la lightmap couverts par un triangle
+
+    LightmapStats( ) : charts(0), scale(0), coverage(0) {}
+};
+
+/*! decoupe l'objet en cartes, groupes de triangles voisins orientes dans la meme direction, projetes sur le plan perpendiculaire a leur normale moyenne,
+    puis place les cartes dans une texture de params.resolution x params.resolution texels. la densite de texels est la meme pour toutes les cartes.
+    renvoie les coordonnees de texture des 3 sommets de chaque triangle, 3 * mesh.triangle_count() valeurs,
+    ou un tableau vide si les cartes ne tiennent pas dans la texture.
+ */
+std::vector<vec2> lightmap_texcoords( const Mesh& mesh, const LightmapParams& params= LightmapParams(), LightmapStats *stats= nullptr );
+
+/*! calcule la lumiere reflechie par les triangles, direct + indirect en option, pour chaque texel de la lightmap, en parallele, par blocs de texels.
+    les texels en dehors des cartes sont remplis par dilatation. la lightmap contient la couleur finale, emission + diffuse / pi * eclairement,
+    textures diffuses comprises, en valeurs lineaires, a enregistrer avec write_image_hdr().
+    les coordonnees de texture de mesh sont remplacees par celles de la lightmap, cf lightmap_texcoords(), pour afficher directement la lightmap
+    avec un shader qui ne fait que lire une texture, cf tuto9_texture1.glsl.
+    bvh, sources et textures sont construits sur mesh, avant l'appel. textures peut etre nul.
+    renvoie une image vide, et ne modifie pas mesh, si les cartes ne tiennent pas dans la lightmap, cf lightmap_texcoords().
+ */
+Image bake_lightmap( Mesh& mesh, const BVH& bvh, const Sources& sources, TextureCache *textures, const LightmapParams& params= LightmapParams(),
+    LightmapStats *stats= nullptr );
+
+#endif
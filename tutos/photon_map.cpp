@@ -0,0 +1,302 @@
+//! \file photon_map.cpp
+
+#include <cmath>
+#include <random>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "photon_map.h"
+
+
+// nombre de noeuds du sous arbre gauche d'un arbre equilibre a gauche de n noeuds : tous les niveaux sont complets, sauf le dernier, rempli de gauche a droite.
+static int left_size( const int n )
+{
+    if(n <= 1)
+        return 0;
+
+    int h= 0;
+    while((2 << h) <= n)
+        h++;
+
+    int half= 1 << (h -1);              // nombre de noeuds du dernier niveau complet du sous arbre gauche
+    int last= n - ((1 << h) -1);        // nombre de noeuds du dernier niveau de l'arbre
+    return (half -1) + std::min(last, half);
+}
+
+int PhotonMap::place( std::vector<Photon>& photons, const int begin, const int end, const int node )
+{
+    // axe le plus etire de l'englobant des photons
+    BBox bounds= BBox(photons[begin].p);
+    for(int i= begin +1; i < end; i++)
+        bounds.insert(photons[i].p);
+
+    Vector d= Vector(bounds.pmin, bounds.pmax);
+    int axis= 0;
+    if(d.y > d.x && d.y > d.z) axis= 1;
+    else if(d.z > d.x) axis= 2;
+
+    // le photon median devient le noeud, les sous arbres gauche et droit ont exactement la taille imposee par l'equilibre a gauche
+    int m= begin + left_size(end - begin);
+    std::nth_element(photons.begin() + begin, photons.begin() + m, photons.begin() + end,
+        [axis]( const Photon& a, const Photon& b ) { return a.p(axis) < b.p(axis); });
+
+    const Photon& photon= photons[m];
+    m_nodes[node]= { photon.p.x, photon.p.y, photon.p.z, axis };
+    m_photons[node]= photon;
+    return m;
+}
+
+void PhotonMap::build( std::vector<Photon>& photons, const int begin, const int end, const int node )
+{
+    if(begin >= end)
+        return;
+
+    int m= place(photons, begin, end, node);
+    build(photons, begin, m, 2*node +1);
+    build(photons, m +1, end, 2*node +2);
+}
+
+void PhotonMap::build( const std::vector<Photon>& photons, const float radius )
+{
+    m_radius2= radius * radius;
+    m_nodes.assign(photons.size(), Node());
+    m_photons.assign(photons.size(), Photon());
+    if(photons.empty())
+        return;
+
+    std::vector<Photon> tmp= photons;
+
+    // construit les premiers niveaux, jusqu'a obtenir assez de sous arbres independants pour occuper tous les threads
+    struct Job { int begin, end, node; };
+    std::vector<Job> jobs;
+    jobs.push_back( {0, int(tmp.size()), 0} );
+    for(int level= 0; level < 8; level++)
+    {
+        std::vector<Job> next;
+        for(const Job& job : jobs)
+        {
+            if(job.end - job.begin < 4096)
+            {
+                // sous arbre trop petit pour etre decoupe
+                next.push_back(job);
+                continue;
+            }
+
+            int m= place(tmp, job.begin, job.end, job.node);
+            next.push_back( {job.begin, m, 2*job.node +1} );
+            next.push_back( {m +1, job.end, 2*job.node +2} );
+        }
+        jobs.swap(next);
+    }
+
+    // puis les sous arbres, en parallele, ils utilisent des parties disjointes de tmp et des noeuds
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int i= 0; i < int(jobs.size()); i++)
+        build(tmp, jobs[i].begin, jobs[i].end, jobs[i].node);
+}
+
+
+int PhotonMap::neighbors( const Point& p, const int k, Neighbor *heap, float& r2 ) const
+{
+    const int n= int(m_nodes.size());
+    int count= 0;
+
+    // pile des sous arbres a visiter, et distance au plan de separation, la profondeur de l'arbre est inferieure a 32
+    int stack[64];
+    float stack_d2[64];
+    int top= 0;
+
+    int node= 0;
+    for(;;)
+    {
+        while(node < n)
+        {
+            const Node& photon= m_nodes[node];
+            float dx= p.x - photon.x;
+            float dy= p.y - photon.y;
+            float dz= p.z - photon.z;
+            float d2= dx*dx + dy*dy + dz*dz;
+            if(d2 < r2)
+            {
+                // insere le photon dans le tas des k plus proches, le plus eloigne est en tete
+                if(count < k)
+                {
+                    heap[count++]= { d2, node };
+                    std::push_heap(heap, heap + count);
+                }
+                else
+                {
+                    std::pop_heap(heap, heap + count);
+                    heap[count -1]= { d2, node };
+                    std::push_heap(heap, heap + count);
+                }
+
+                // le rayon de recherche diminue une fois que k photons sont trouves
+                if(count == k)
+                    r2= heap[0].d2;
+            }
+
+            int left= 2*node +1;
+            if(left >= n)
+                // feuille
+                break;
+
+            float delta= (photon.axis == 0) ? dx : ((photon.axis == 1) ? dy : dz);
+            int near= (delta < 0) ? left : left +1;
+            int far= (delta < 0) ? left +1 : left;
+            if(far < n)
+            {
+                stack[top]= far;
+                stack_d2[top]= delta * delta;
+                top++;
+            }
+            node= near;
+        }
+
+        // sous arbre suivant, s'il peut encore contenir des photons plus proches
+        do
+        {
+            if(top == 0)
+                return count;
+            top--;
+        }
+        while(stack_d2[top] >= r2);
+        node= stack[top];
+    }
+}
+
+Color PhotonMap::irradiance( const Point& p, const Vector& n, const int k ) const
+{
+    if(m_nodes.empty())
+        return Black();
+
+    Neighbor heap[max_k];
+    float r2= m_radius2;
+    int count= neighbors(p, std::max(1, std::min(int(k), int(max_k))), heap, r2);
+    if(count == 0)
+        return Black();
+
+    // flux des photons qui arrivent sur la face avant / aire du disque de recherche
+    Color power= Black();
+    for(int i= 0; i < count; i++)
+    {
+        const Photon& photon= m_photons[heap[i].id];
+        if(dot(n, photon.d) < 0)
+            power= power + photon.power;
+    }
+
+    return power / (float(M_PI) * r2);
+}
+
+
+void trace_photons( PhotonMaps& maps, const Mesh& mesh, const BVH& bvh, const Sources& sources, const PhotonParams& params,
+    const unsigned seed, TextureCache *textures )
+{
+    Point pmin, pmax;
+    mesh.bounds(pmin, pmax);
+    float radius= params.radius * distance(pmin, pmax);
+
+    int threads= 1;
+#ifdef _OPENMP
+    threads= omp_get_max_threads();
+#endif
+
+    // un buffer par thread, pas de synchronisation pendant l'emission
+    std::vector< std::vector<Photon> > caustics(threads);
+    std::vector< std::vector<Photon> > global(threads);
+
+    const int count= (sources.emission > 0) ? params.photons : 0;
+#pragma omp parallel for schedule(dynamic, 256)
+    for(int i= 0; i < count; i++)
+    {
+        int thread= 0;
+    #ifdef _OPENMP
+        thread= omp_get_thread_num();
+    #endif
+
+        std::default_random_engine rng(hash_seed(seed, i));
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+        // choisit une source, puis un point sur la source et une direction distribuee selon cos theta / pi
+        Point o;
+        Vector d;
+        Color flux;
+        sources.sample_emission(count, rng, u01, o, d, flux);
+
+        Ray ray(o, d);
+        bool specular= true;        // chemin source -> miroirs, les photons stockes ensuite sont des caustiques
+        for(int depth= 0; depth < params.depth; depth++)
+        {
+            Hit hit= bvh.intersect(ray);
+            if(!hit)
+                break;
+
+            const TriangleData& triangle= mesh.triangle(hit.triangle_id);
+            const Material& material= mesh.triangle_material(hit.triangle_id);
+
+            Color diffuse= material.diffuse;
+            if(textures && material.diffuse_texture != -1 && mesh.has_texcoord())
+            {
+                float w= 1 - hit.u - hit.v;
+                vec2 uv= vec2(w * triangle.ta.x + hit.u * triangle.tb.x + hit.v * triangle.tc.x, w * triangle.ta.y + hit.u * triangle.tb.y + hit.v * triangle.tc.y);
+                diffuse= diffuse * textures->sample(material.diffuse_texture, uv);
+            }
+            Color mirror= (material.ns >= params.mirror) ? material.specular : Black();
+
+            Point p= point(hit, ray);
+            Vector n= normal(hit, triangle);
+            if(dot(n, ray.d) > 0)
+                n= -n;
+
+            // stocke le photon sur les surfaces diffuses, apres le premier rebond
+            if(depth > 0 && diffuse.power() > 0)
+            {
+                Photon photon(p, normalize(ray.d), flux);
+                if(specular)
+                    caustics[thread].push_back(photon);
+                else
+                    global[thread].push_back(photon);
+            }
+
+            // roulette russe : rebond diffus, reflet miroir, ou absorption
+            float pd= diffuse.power();
+            float ps= mirror.power();
+            if(pd + ps > 1)
+            {
+                pd= pd / (pd + ps);
+                ps= 1 - pd;
+            }
+
+            float u= u01(rng);
+            if(u < pd)
+            {
+                flux= flux * diffuse / pd;
+                d= World(n)(sample_cosine(u01(rng), u01(rng)));
+                specular= false;
+            }
+            else if(u < pd + ps)
+            {
+                flux= flux * mirror / ps;
+                Vector v= normalize(ray.d);
+                d= v - 2 * dot(v, n) * n;
+            }
+            else
+                break;
+
+            ray= Ray(p + 0.00001f * n, d);
+        }
+    }
+
+    std::vector<Photon> photons;
+    for(int i= 0; i < threads; i++)
+        photons.insert(photons.end(), caustics[i].begin(), caustics[i].end());
+    maps.caustics.build(photons, radius);
+
+    photons.clear();
+    for(int i= 0; i < threads; i++)
+        photons.insert(photons.end(), global[i].begin(), global[i].end());
+    maps.global.build(photons, radius);
+}
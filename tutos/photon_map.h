@@ -0,0 +1,104 @@
+//! \file photon_map.h photon mapping : caustiques et eclairage indirect estimes par la densite des photons emis par les sources.
+
+#ifndef _PHOTON_MAP_H
+#define _PHOTON_MAP_H
+
+#include <vector>
+
+#include "vec.h"
+#include "color.h"
+#include "mesh.h"
+
+#include "bvh.h"
+#include "sources.h"
+#include "texture_cache.h"
+
+
+//! photon, stocke sur une surface diffuse.
+struct Photon
+{
+    Point p;            //!< position
+    Vector d;           //!< direction de propagation, vers la surface
+    Color power;        //!< flux transporte
+
+    Photon( ) : p(), d(), power() {}
+    Photon( const Point& _p, const Vector& _d, const Color& _power ) : p(_p), d(_d), power(_power) {}
+};
+
+//! parametres de l'emission et de l'estimation de densite.
+struct PhotonParams
+{
+    int photons;        //!< nombre de chemins emis par les sources
+    int depth;          //!< nombre maximum de rebonds par chemin
+    float mirror;       //!< exposant blinn-phong a partir duquel une matiere avec un reflet est traitee comme un miroir parfait, pour les caustiques
+    int k;              //!< nombre de photons utilises par estimation
+    float radius;       //!< rayon maximum de recherche, en fraction de la diagonale de la scene
+
+    PhotonParams( ) : photons(200000), depth(8), mirror(1000), k(64), radius(0.05f) {}
+};
+
+/*! kd-tree equilibre a gauche, stocke dans un tableau implicite : les fils du noeud i sont 2i+1 et 2i+2, pas de pointeurs.
+    chaque noeud est un photon, les positions et l'axe de separation sont ranges dans un tableau compact, 16 octets par noeud, parcouru
+    pendant la recherche des voisins, le flux et la direction des photons sont dans un tableau separe, et ne sont lus que pour les photons retenus.
+    cf "realistic image synthesis using photon mapping", H. W. Jensen, 2001.
+ */
+class PhotonMap
+{
+public:
+    //! nombre maximum de voisins par estimation, les voisins sont stockes sur la pile, pas d'allocation pendant les recherches.
+    enum { max_k= 256 };
+
+    PhotonMap( ) : m_nodes(), m_photons(), m_radius2(0) {}
+
+    //! construit l'arbre, en parallele. radius est le rayon maximum de recherche des voisins.
+    void build( const std::vector<Photon>& photons, const float radius );
+
+    /*! estime l'eclairement au point p de normale n, flux des k photons les plus proches / aire du disque qui les contient.
+        seuls les photons qui arrivent du cote de la normale sont comptes. il faut multiplier par diffuse / pi pour obtenir la lumiere reflechie.
+     */
+    Color irradiance( const Point& p, const Vector& n, const int k ) const;
+
+    int size( ) const { return int(m_nodes.size()); }
+    bool empty( ) const { return m_nodes.empty(); }
+
+protected:
+    struct Node
+    {
+        float x, y, z;
+        int axis;       //!< axe de separation
+    };
+
+    struct Neighbor
+    {
+        float d2;
+        int id;
+
+        bool operator< ( const Neighbor& b ) const { return d2 < b.d2; }
+    };
+
+    void build( std::vector<Photon>& photons, const int begin, const int end, const int node );
+    int place( std::vector<Photon>& photons, const int begin, const int end, const int node );
+    int neighbors( const Point& p, const int k, Neighbor *heap, float& r2 ) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<Photon> m_photons;
+    float m_radius2;
+};
+
+//! photons d'une scene : caustiques, chemins source -> miroirs -> surface diffuse, et eclairage indirect, chemins avec au moins un rebond diffus.
+struct PhotonMaps
+{
+    PhotonMap caustics;
+    PhotonMap global;
+};
+
+/*! emet params.photons chemins depuis les sources, proportionnellement a leur emission, en parallele, chaque thread remplit son propre buffer.
+    les photons ne sont stockes qu'apres un premier rebond, l'eclairage direct est estime par les sources, cf tuto_ray.
+    les matieres avec un reflet et un exposant superieur a params.mirror sont des miroirs parfaits, les autres sont diffuses. le nombre de rebonds
+    est limite par roulette russe, proportionnellement a l'albedo, et par params.depth.
+    chaque chemin utilise son propre generateur de nombres aleatoires, initialise par seed.
+ */
+void trace_photons( PhotonMaps& maps, const Mesh& mesh, const BVH& bvh, const Sources& sources, const PhotonParams& params= PhotonParams(),
+    const unsigned seed= 0, TextureCache *textures= nullptr );
+
+#endif
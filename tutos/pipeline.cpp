@@ -3,6 +3,15 @@
 
 #include <cstdio>
 #include <cmath>
+#include <cassert>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "vec.h"
 #include "mat.h"
@@ -30,13 +39,71 @@ struct ZBuffer
         std::size_t offset= y * width + x;
         return data[offset];
     }
+    
+    float operator() ( const int x, const int y ) const
+    {
+        std::size_t offset= y * width + x;
+        return data[offset];
+    }
 };
 
+// taille des blocs de pixels
+const int block_size= 8;
 
-struct Fragment
+// zbuffer hierarchique : profondeur max des blocs de 8x8 pixels d'une tuile, et de la tuile complete.
+// un triangle, ou la partie d'un triangle dans un bloc, plus loin que la profondeur max ne peut pas modifier l'image.
+struct HiZ
 {
-    float x, y, z;  // coordonnees espace image
-    float u, v, w;  // coordonnees barycentriques du fragment dans le triangle abc, p(u, v, w) = u * c + v * a + w * b;
+    std::vector<float> blocks;
+    int width;          // nombre de blocs
+    int height;
+    float zmax;         // profondeur max de la tuile
+    
+    HiZ( const int w, const int h, const float z= 1 ) : blocks(w*h, z), width(w), height(h), zmax(z) {}
+    
+    float operator() ( const int bx, const int by ) const { return blocks[by * width + bx]; }
+    
+    // recalcule la profondeur max d'un bloc, apres avoir modifie le zbuffer de la tuile
+    void update( const ZBuffer& depth, const int bx, const int by )
+    {
+        float z= 0;
+        for(int y= by * block_size; y < std::min((by +1) * block_size, depth.height); y++)
+        for(int x= bx * block_size; x < std::min((bx +1) * block_size, depth.width); x++)
+            z= std::max(z, depth(x, y));
+        
+        blocks[by * width + bx]= z;
+    }
+    
+    // recalcule la profondeur max de la tuile
+    void update( )
+    {
+        zmax= 0;
+        for(float z : blocks)
+            zmax= std::max(zmax, z);
+    }
+};
+
+
+// taille des groupes de fragments : 2 quads de 2x2 pixels
+const int batch_size= 8;
+// nombre max de varyings par sommet
+const int max_varyings= 8;
+
+// groupe de fragments d'une primitive. les valeurs sont rangees par attribut (SoA), pour que les boucles sur les fragments du groupe 
+// soient vectorisees par le compilateur.
+struct Fragments
+{
+    alignas(32) float x[batch_size];    // coordonnees espace image
+    alignas(32) float y[batch_size];
+    alignas(32) float z[batch_size];
+    alignas(32) float varyings[max_varyings][batch_size];   // varyings interpoles
+    
+    // sorties du fragment shader
+    alignas(32) float r[batch_size];
+    alignas(32) float g[batch_size];
+    alignas(32) float b[batch_size];
+    
+    unsigned mask;  // le fragment i est a l'interieur du triangle et visible si le bit i est a 1
 };
 
 
@@ -46,15 +113,22 @@ struct Pipeline
     Pipeline( ) {}
     virtual ~Pipeline( ) {}
     
-    // vertex shader, doit renvoyer les coordonnees du sommet dans le repere projectif
-    virtual Point vertex_shader( const int vertex_id ) const = 0;
+    // vertex shader, doit renvoyer les coordonnees homogenes du sommet dans le repere projectif, avant la division par w,
+    // et ecrire les varyings du sommet dans varyings[0 .. varying_count()).
+    virtual vec4 vertex_shader( const int vertex_id, float *varyings ) const = 0;
+    
+    // nombre de varyings par sommet, au plus max_varyings.
+    virtual int varying_count( ) const = 0;
     
-    // fragment shader, doit renvoyer la couleur du fragment de la primitive
-    // doit interpoler lui meme les "varyings", fragment.uvw definissent les coefficients.
-    virtual Color fragment_shader( const int primitive_id, const Fragment fragment ) const = 0;
-    // pour simplifier le code, les varyings n'existent pas dans cette version,
-    // il faut recuperer les infos des sommets de la primitive et faire l'interpolation.
-    // remarque : les gpu amd gcn fonctionnent comme ca...
+    // fragment shader, doit calculer la couleur r, g, b des batch_size fragments du groupe, les varyings sont deja interpoles.
+    // les fragments hors du triangle, cf fragments.mask, sont aussi calcules, comme sur les gpu, mais ne sont pas dessines.
+    // peut modifier fragments.z, dans ce cas depth_write() doit renvoyer vrai.
+    virtual void fragment_shader( const int primitive_id, Fragments& fragments ) const = 0;
+    // un seul appel virtuel par groupe de fragments, et pas pour chaque fragment.
+    
+    // renvoie vrai si le fragment shader modifie la profondeur des fragments. 
+    // le ztest ne peut se faire qu'apres l'execution du shader, et le zbuffer hierarchique ne peut pas eliminer de triangles.
+    virtual bool depth_write( ) const { return false; }
 };
 
 // pipeline simple
@@ -72,54 +146,604 @@ struct BasicPipeline : public Pipeline
     {
         mvp= projection * view * model;
         mv= Normal(view * model);
+        
+        // vertex_shader() lit la normale de chaque sommet
+        assert(mesh.has_normal());
     }
     
-    Point vertex_shader( const int vertex_id ) const
+    vec4 vertex_shader( const int vertex_id, float *varyings ) const
     {
+        // transforme la normale du sommet, une seule fois par sommet, et plus pour chaque fragment
+        Vector n= mv( Vector( mesh.normals()[vertex_id] ));
+        varyings[0]= n.x;
+        varyings[1]= n.y;
+        varyings[2]= n.z;
+        
         // recupere la position du sommet
-        Point p= Point( mesh.positions().at(vertex_id) );
-        // renvoie les coordonnees dans le repere projectif
-        return mvp(p);
+        Point p= Point( mesh.positions()[vertex_id] );
+        // renvoie les coordonnees homogenes dans le repere projectif
+        return mvp(vec4(p));
     }
     
-    Color fragment_shader( const int primitive_id, const Fragment fragment ) const
+    int varying_count( ) const { return 3; }
+    
+    void fragment_shader( const int primitive_id, Fragments& fragments ) const
     {
-        // recuperer les normales des sommets de la primitive
-        Vector a= mv( Vector( mesh.normals().at(primitive_id * 3) ));
-        Vector b= mv( Vector( mesh.normals().at(primitive_id * 3 +1) ));
-        Vector c= mv( Vector( mesh.normals().at(primitive_id * 3 +2) ));
-        
-        // interpoler la normale
-        Vector n= fragment.u * c + fragment.v * a + fragment.w * b;
-        // et la normaliser, l'interpolation ne conserve pas la longueur des vecteurs
-        n= normalize(n);
-        
-        // calcule une couleur qui depend de l'orientation de la primitive par rapport a la camera
-        return White() * std::abs(n.z);
+        for(int i= 0; i < batch_size; i++)
+        {
+            // normale interpolee
+            float nx= fragments.varyings[0][i];
+            float ny= fragments.varyings[1][i];
+            float nz= fragments.varyings[2][i];
+            // a normaliser, l'interpolation ne conserve pas la longueur des vecteurs
+            float k= std::abs(nz) / std::sqrt(nx*nx + ny*ny + nz*nz);
+            
+            // calcule une couleur qui depend de l'orientation de la primitive par rapport a la camera
+            fragments.r[i]= k;
+            fragments.g[i]= k;
+            fragments.b[i]= k;
+        }
         
         // on peut faire autre chose, par exemple, afficher directement la normale...
-        // return Color(std::abs(n.x), std::abs(n.y), std::abs(n.z));
+        // fragments.r[i]= std::abs(nx) / length, etc.
     }
 };
 
 
+// les sommets sont arrondis sur une grille de 1/256 de pixel, en virgule fixe : les calculs sur les aretes sont exacts, avec des entiers, 
+// 2 triangles qui partagent une arete la voient exactement de la meme maniere, et il n'y a pas de trous entre les triangles.
+const int subpixel_bits= 8;
+const int subpixel= 1 << subpixel_bits;
+
+// sommet dans le repere image, en virgule fixe
+struct Fixed
+{
+    int x, y;
+    
+    Fixed( ) : x(0), y(0) {}
+    Fixed( const Point& p ) : x(int(std::lround(p.x * subpixel))), y(int(std::lround(p.y * subpixel))) {}
+};
+
 // cf http://geomalgorithms.com/a01-_area.html, section modern triangles
-float area( const Point p, const Point a, const Point b )
+int64_t area( const Fixed& p, const Fixed& a, const Fixed& b )
+{
+    return int64_t(a.x - p.x) * (b.y - p.y) - int64_t(a.y - p.y) * (b.x - p.x);
+}
+
+
+// equation de l'arete p0p1 sur les pixels : E(x, y) = a * x + b * y + c = area(p0, p1, Point(x, y)), en virgule fixe, calcule avec des entiers.
+// lineaire en x et en y : E(x+1, y) = E(x, y) + a, E(x, y+1) = E(x, y) + b
+// regle top-left : un pixel exactement sur une arete partagee par 2 triangles n'est dessine qu'une seule fois. il appartient au triangle 
+// qui se trouve a droite d'une arete gauche, ou sous une arete horizontale en haut du triangle (l'axe y est oriente vers le haut). 
+// c est decale de 1 pour ces aretes, un pixel est a l'interieur du triangle si E(x, y) > 0, dans tous les cas.
+struct Edge
+{
+    int64_t a, b, c;
+    
+    Edge( ) : a(0), b(0), c(0) {}
+    Edge( const Fixed& p0, const Fixed& p1 ) : a(int64_t(p0.y - p1.y) * subpixel), b(int64_t(p1.x - p0.x) * subpixel)
+    {
+        const int64_t dy= p0.y - p1.y;
+        const int64_t dx= p1.x - p0.x;
+        const bool top_left= (dy > 0) || (dy == 0 && dx < 0);
+        c= -(dy * p0.x + dx * p0.y) + (top_left ? 1 : 0);
+    }
+    
+    int64_t eval( const int x, const int y ) const { return a * x + b * y + c; }
+    
+    // valeurs min et max sur les coins d'un bloc [x0 x1] x [y0 y1]
+    int64_t min( const int x0, const int y0, const int x1, const int y1 ) const { return eval(a < 0 ? x1 : x0, b < 0 ? y1 : y0); }
+    int64_t max( const int x0, const int y0, const int x1, const int y1 ) const { return eval(a < 0 ? x0 : x1, b < 0 ? y0 : y1); }
+};
+
+// interpolation d'un attribut sur le triangle abc, lineaire dans le repere image : f(x, y) = f + dx * (x - a.x) + dy * (y - a.y)
+struct Plane
+{
+    float f, dx, dy;
+    
+    Plane( ) : f(0), dx(0), dy(0) {}
+    
+    // coefficients a partir des valeurs aux sommets et des aretes du triangle, n est l'aire du triangle, en virgule fixe, comme les aretes.
+    Plane( const float fa, const float fb, const float fc, const Edge& ab, const Edge& bc, const Edge& ca, const float n )
+        : f(fa), dx((ab.a * fc + bc.a * fa + ca.a * fb) / n), dy((ab.b * fc + bc.b * fa + ca.b * fb) / n) {}
+    
+    // valeur en (a.x + x, a.y + y)
+    float eval( const float x, const float y ) const { return f + dx * x + dy * y; }
+};
+
+
+// bande de garde, en pixels, autour de l'image. les triangles qui sortent de l'image, mais pas de la bande de garde, ne sont pas decoupes, 
+// les pixels hors de l'image ne sont pas parcourus par rasterize(). la bande de garde limite aussi les coordonnees des sommets en virgule fixe,
+// et les calculs sur les aretes ne peuvent pas deborder.
+const int guard_band= 8192;
+
+// plans de decoupage dans le repere projectif : un sommet p est a l'interieur si -gx * p.w <= p.x <= gx * p.w, -gy * p.w <= p.y <= gy * p.w, 
+// et -p.w <= p.z <= p.w. le plan k est a l'exterieur si le bit k est a 1.
+// gx= gy= 1 pour la region observee par la camera, gx, gy > 1 pour la bande de garde.
+unsigned outcode( const vec4& p, const float gx, const float gy )
 {
-    Vector pa= Vector(p, a); pa.z= 0;
-    Vector pb= Vector(p, b); pb.z= 0;
-    return cross(pa, pb).z;
+    unsigned code= 0;
+    if(p.x < -gx * p.w) code|= 1;
+    if(p.x > gx * p.w) code|= 2;
+    if(p.y < -gy * p.w) code|= 4;
+    if(p.y > gy * p.w) code|= 8;
+    if(p.z < -p.w) code|= 16;
+    if(p.z > p.w) code|= 32;
+    return code;
+}
+
+// distance signee au plan k, positive a l'interieur
+float distance( const vec4& p, const int k, const float gx, const float gy )
+{
+    switch(k)
+    {
+        case 0: return gx * p.w + p.x;
+        case 1: return gx * p.w - p.x;
+        case 2: return gy * p.w + p.y;
+        case 3: return gy * p.w - p.y;
+        case 4: return p.w + p.z;
+        default: return p.w - p.z;
+    }
+}
+
+
+// sommets transformes par le vertex shader. rangement SoA : un tableau par attribut.
+struct VertexBuffer
+{
+    std::vector<vec4> positions;                    // repere projectif, coordonnees homogenes
+    std::vector<float> varyings[max_varyings];
+};
+
+// execute le vertex shader une seule fois par sommet, meme s'il est partage par plusieurs triangles.
+void transform( const Pipeline& pipeline, const int vertex_count, VertexBuffer& vertices )
+{
+    const int varyings= pipeline.varying_count();
+    vertices.positions.resize(vertex_count);
+    for(int k= 0; k < varyings; k++)
+        vertices.varyings[k].resize(vertex_count);
+    
+#pragma omp parallel for schedule(static)
+    for(int i= 0; i < vertex_count; i++)
+    {
+        float vertex[max_varyings];
+        vertices.positions[i]= pipeline.vertex_shader(i, vertex);
+        for(int k= 0; k < varyings; k++)
+            vertices.varyings[k][i]= vertex[k];
+    }
+}
+
+
+// sommet d'un triangle decoupe par les plans
+struct ClipVertex
+{
+    vec4 p;
+    float varyings[max_varyings];
+};
+
+// decoupe le polygone par le plan k, algorithme de Sutherland-Hodgman. les varyings sont interpoles lineairement dans le repere projectif, 
+// avant la division par w. renvoie le nombre de sommets du polygone decoupe.
+int clip( const ClipVertex *polygon, const int n, const int k, const float gx, const float gy, const int varyings, ClipVertex *clipped )
+{
+    int m= 0;
+    for(int i= 0; i < n; i++)
+    {
+        const ClipVertex& a= polygon[i];
+        const ClipVertex& b= polygon[(i +1) % n];
+        float da= distance(a.p, k, gx, gy);
+        float db= distance(b.p, k, gx, gy);
+        
+        if(da >= 0)
+            clipped[m++]= a;
+        
+        // l'arete ab traverse le plan
+        if((da >= 0) != (db >= 0))
+        {
+            float t= da / (da - db);
+            ClipVertex& v= clipped[m++];
+            v.p= vec4(a.p.x + t * (b.p.x - a.p.x), a.p.y + t * (b.p.y - a.p.y), a.p.z + t * (b.p.z - a.p.z), a.p.w + t * (b.p.w - a.p.w));
+            for(int j= 0; j < varyings; j++)
+                v.varyings[j]= a.varyings[j] + t * (b.varyings[j] - a.varyings[j]);
+        }
+    }
+    
+    return m;
 }
 
 
-bool visible( const Point p )
+// triangle transforme dans le repere image, pret a etre dessine
+struct Primitive
 {
-    if(p.x < -1 || p.x > 1) return false;
-    if(p.y < -1 || p.y > 1) return false;
-    if(p.z < -1 || p.z > 1) return false;
+    int id;                         // indice du triangle, pour le fragment shader
+    Point a, b, c;                  // sommets, arrondis sur la grille en virgule fixe
+    int xmin, ymin, xmax, ymax;     // englobant du triangle, limite a l'image
+    
+    Edge ab, bc, ca;                // equations des aretes
+    Plane z;                        // interpolation de z
+    Plane varyings[max_varyings];   // et des varyings
+};
+
+// prepare la fragmentation du triangle abc, dans le repere image, renvoie faux s'il n'y a rien a dessiner.
+bool setup( const int varyings, const int width, const int height, const int primitive_id, 
+    const Point& pa, const Point& pb, const Point& pc, const float *va, const float *vb, const float *vc, Primitive& primitive )
+{
+    // arrondit les sommets sur la grille en virgule fixe
+    Fixed a= Fixed(pa);
+    Fixed b= Fixed(pb);
+    Fixed c= Fixed(pc);
+    
+    // aire du triangle abc, exacte. les triangles mal orientes, aire negative, et les triangles degeneres, apres l'arrondi, ne sont pas dessines
+    int64_t n= area(a, b, c);
+    if(n <= 0)
+        return false;
+    
+    // englobant du triangle, limite a l'image. les pixels sont echantillonnes sur les coordonnees entieres :
+    // un petit triangle qui "passe" entre les pixels a un englobant vide, et il n'y a rien a dessiner.
+    // ceil() et floor() en virgule fixe, le decalage arithmetique arrondit vers -infini, meme pour les coordonnees negatives dans la bande de garde.
+    primitive.xmin= std::max(0, (std::min(a.x, std::min(b.x, c.x)) + subpixel -1) >> subpixel_bits);
+    primitive.ymin= std::max(0, (std::min(a.y, std::min(b.y, c.y)) + subpixel -1) >> subpixel_bits);
+    primitive.xmax= std::min(width -1, std::max(a.x, std::max(b.x, c.x)) >> subpixel_bits);
+    primitive.ymax= std::min(height -1, std::max(a.y, std::max(b.y, c.y)) >> subpixel_bits);
+    if(primitive.xmin > primitive.xmax || primitive.ymin > primitive.ymax)
+        return false;
+    
+    primitive.id= primitive_id;
+    primitive.a= Point(float(a.x) / subpixel, float(a.y) / subpixel, pa.z);
+    primitive.b= Point(float(b.x) / subpixel, float(b.y) / subpixel, pb.z);
+    primitive.c= Point(float(c.x) / subpixel, float(c.y) / subpixel, pc.z);
+    
+    // equations des aretes et coefficients d'interpolation, calcules une seule fois par triangle
+    primitive.ab= Edge(a, b);       // distance c / ab
+    primitive.bc= Edge(b, c);       // distance a / bc
+    primitive.ca= Edge(c, a);       // distance b / ca
+    primitive.z= Plane(pa.z, pb.z, pc.z, primitive.ab, primitive.bc, primitive.ca, float(n));
+    for(int k= 0; k < varyings; k++)
+        primitive.varyings[k]= Plane(va[k], vb[k], vc[k], primitive.ab, primitive.bc, primitive.ca, float(n));
+    
     return true;
 }
 
+// prepare la fragmentation d'un triangle, indices de ses sommets dans triangle[0..2]. 
+// ajoute les primitives a dessiner a primitives : aucune si le triangle n'est pas visible, plusieurs s'il est decoupe.
+void setup( const Pipeline& pipeline, const VertexBuffer& vertices, const Transform& viewport, const int width, const int height,
+    const int primitive_id, const unsigned int *triangle, std::vector<Primitive>& primitives )
+{
+    const int varyings= pipeline.varying_count();
+    
+    // recupere les 3 sommets du triangle, deja transformes
+    ClipVertex polygon[9];
+    for(int i= 0; i < 3; i++)
+    {
+        polygon[i].p= vertices.positions[triangle[i]];
+        for(int k= 0; k < varyings; k++)
+            polygon[i].varyings[k]= vertices.varyings[k][triangle[i]];
+    }
+    
+    // visibilite : si les 3 sommets sont du meme cote d'une face de la region observee par la camera, le triangle n'est pas visible.
+    // la region observee est un cube dans le repere projectif, -w <= x, y, z <= w.
+    if(outcode(polygon[0].p, 1, 1) & outcode(polygon[1].p, 1, 1) & outcode(polygon[2].p, 1, 1))
+        return;
+    
+    // bande de garde, dans le repere projectif
+    const float gx= 1 + 2 * float(guard_band) / float(width);
+    const float gy= 1 + 2 * float(guard_band) / float(height);
+    
+    // decoupe le triangle par les plans near et far, et par les bords de la bande de garde, s'il les traverse. c'est rare.
+    // les sommets derriere la camera, w <= 0, sont elimines par le plan near, la division par w est correcte ensuite.
+    int n= 3;
+    unsigned planes= outcode(polygon[0].p, gx, gy) | outcode(polygon[1].p, gx, gy) | outcode(polygon[2].p, gx, gy);
+    for(int k= 0; k < 6 && n > 0; k++)
+    {
+        if((planes & (1u << k)) == 0)
+            continue;
+        
+        // chaque plan ajoute au plus un sommet au polygone
+        ClipVertex clipped[9];
+        n= clip(polygon, n, k, gx, gy, varyings, clipped);
+        for(int i= 0; i < n; i++)
+            polygon[i]= clipped[i];
+    }
+    
+    // passage dans le repere image
+    Point points[9];
+    for(int i= 0; i < n; i++)
+    {
+        const vec4& p= polygon[i].p;
+        points[i]= viewport(Point(p.x / p.w, p.y / p.w, p.z / p.w));
+    }
+    
+    // decoupe le polygone en triangles
+    for(int i= 1; i +1 < n; i++)
+    {
+        Primitive primitive;
+        if(setup(varyings, width, height, primitive_id, points[0], points[i], points[i +1], 
+            polygon[0].varyings, polygon[i].varyings, polygon[i +1].varyings, primitive))
+            primitives.push_back(primitive);
+    }
+}
+
+// compteurs de fragments
+struct RasterStats
+{
+    long int fragments;     // fragments a l'interieur des triangles
+    long int shaded;        // fragments dont la couleur est calculee par le fragment shader
+    long int triangles;     // triangles elimines par le zbuffer hierarchique, par tuile
+    long int blocks;        // blocs elimines par le zbuffer hierarchique
+    
+    RasterStats( ) : fragments(0), shaded(0), triangles(0), blocks(0) {}
+    
+    RasterStats& operator+= ( const RasterStats& stats ) 
+    { 
+        fragments+= stats.fragments; shaded+= stats.shaded; triangles+= stats.triangles; blocks+= stats.blocks; 
+        return *this; 
+    }
+};
+
+// position des fragments d'un groupe : 2 quads de 2x2 pixels, cote a cote
+const int batch_x[batch_size]= { 0, 1, 0, 1, 2, 3, 2, 3 };
+const int batch_y[batch_size]= { 0, 0, 1, 1, 0, 0, 1, 1 };
+
+// nombre de bits a 1
+int bits( unsigned mask )
+{
+    int n= 0;
+    for(; mask; mask= mask & (mask -1))
+        n++;
+    return n;
+}
+
+// dessine la partie du triangle qui se trouve dans la tuile [tx tx + color.width()) x [ty ty + color.height()), dans l'image et le zbuffer de la tuile.
+void rasterize( const Pipeline& pipeline, const Primitive& primitive, const int tx, const int ty, Image& color, ZBuffer& depth, HiZ& hiz, RasterStats& stats )
+{
+    const Point& a= primitive.a;
+    const Point& b= primitive.b;
+    const Point& c= primitive.c;
+    const Edge& ab= primitive.ab;
+    const Edge& bc= primitive.bc;
+    const Edge& ca= primitive.ca;
+    const int varyings= pipeline.varying_count();
+    
+    // le ztest peut etre fait avant d'executer le fragment shader, s'il ne modifie pas la profondeur du fragment.
+    // et le zbuffer hierarchique peut eliminer les triangles et les blocs caches.
+    const bool early_z= !pipeline.depth_write();
+    
+    // le triangle est derriere tous les pixels deja dessines dans la tuile
+    const float zmin= std::min(a.z, std::min(b.z, c.z));
+    if(early_z && zmin >= hiz.zmax)
+    {
+        stats.triangles++;
+        return;
+    }
+    
+    // englobant du triangle dans la tuile
+    int xmin= std::max(primitive.xmin, tx);
+    int ymin= std::max(primitive.ymin, ty);
+    int xmax= std::min(primitive.xmax, tx + color.width() -1);
+    int ymax= std::min(primitive.ymax, ty + color.height() -1);
+    
+    bool modified= false;
+    
+    // dessiner le triangle
+    // parcours les blocs de 8x8 pixels de l'englobant. il suffit de tester les coins d'un bloc pour savoir si le triangle ne touche
+    // aucun de ses pixels, ou si tous les pixels sont a l'interieur du triangle : les equations des aretes sont lineaires, 
+    // leurs valeurs min / max sur le bloc sont atteintes sur les coins.
+    for(int by= ymin - ymin % block_size; by <= ymax; by+= block_size)
+    for(int bx= xmin - xmin % block_size; bx <= xmax; bx+= block_size)
+    {
+        // pixels du bloc a l'interieur de l'englobant
+        int x0= std::max(bx, xmin);
+        int y0= std::max(by, ymin);
+        int x1= std::min(bx + block_size -1, xmax);
+        int y1= std::min(by + block_size -1, ymax);
+        
+        // le triangle ne touche pas le bloc, si tous les coins sont du mauvais cote d'une des aretes
+        if(ab.max(x0, y0, x1, y1) <= 0 || bc.max(x0, y0, x1, y1) <= 0 || ca.max(x0, y0, x1, y1) <= 0)
+            continue;
+        
+        // le triangle est derriere tous les pixels du bloc : il ne peut pas modifier l'image ni le zbuffer.
+        // profondeur min du plan du triangle sur le bloc, au moins la profondeur min du triangle
+        const int hx= (bx - tx) / block_size;
+        const int hy= (by - ty) / block_size;
+        if(early_z)
+        {
+            float z0= primitive.z.eval(x0 - a.x, y0 - a.y);
+            float zblock= z0 + std::min(primitive.z.dx * (x1 - x0), 0.f) + std::min(primitive.z.dy * (y1 - y0), 0.f);
+            if(std::max(zblock, zmin) >= hiz(hx, hy))
+            {
+                stats.blocks++;
+                continue;
+            }
+        }
+        
+        // tous les pixels du bloc sont a l'interieur du triangle, si tous les coins sont a l'interieur, pas la peine de les tester
+        bool inside= (ab.min(x0, y0, x1, y1) > 0 && bc.min(x0, y0, x1, y1) > 0 && ca.min(x0, y0, x1, y1) > 0);
+        
+        // parcours le bloc par groupes de 4x2 pixels
+        bool block_modified= false;
+        for(int gy= by; gy <= y1; gy+= 2)
+        for(int gx= bx; gx <= x1; gx+= 4)
+        {
+            if(gy +1 < y0 || gx +3 < x0)
+                continue;
+            
+            Fragments fragments;
+            
+            // equations des aretes sur le premier pixel du groupe, les autres sont obtenues par increments entiers
+            const int64_t eab= ab.eval(gx, gy);
+            const int64_t ebc= bc.eval(gx, gy);
+            const int64_t eca= ca.eval(gx, gy);
+            
+            // fragments a l'interieur du triangle
+            unsigned mask= 0;
+            for(int i= 0; i < batch_size; i++)
+            {
+                int x= gx + batch_x[i];
+                int y= gy + batch_y[i];
+                fragments.x[i]= x;
+                fragments.y[i]= y;
+                fragments.z[i]= primitive.z.eval(x - a.x, y - a.y);
+                
+                bool covered= (x >= x0 && x <= x1 && y >= y0 && y <= y1)
+                    && (inside || (eab + ab.a * batch_x[i] + ab.b * batch_y[i] > 0 
+                        && ebc + bc.a * batch_x[i] + bc.b * batch_y[i] > 0 
+                        && eca + ca.a * batch_x[i] + ca.b * batch_y[i] > 0));
+                if(covered)
+                    mask|= 1u << i;
+            }
+            
+            if(mask == 0)
+                continue;
+            stats.fragments+= bits(mask);
+            
+            // early ztest : les fragments caches ne sont pas dessines, pas la peine de calculer leur couleur.
+            // le resultat est le meme que le ztest apres le shader, tant que le shader ne modifie pas fragments.z
+            if(early_z)
+            {
+                for(int i= 0; i < batch_size; i++)
+                    if((mask & (1u << i)) && fragments.z[i] >= depth(gx + batch_x[i] - tx, gy + batch_y[i] - ty))
+                        mask&= ~(1u << i);
+                
+                if(mask == 0)
+                    continue;
+            }
+            
+            // interpole les varyings
+            for(int k= 0; k < varyings; k++)
+            {
+                const Plane& plane= primitive.varyings[k];
+                for(int i= 0; i < batch_size; i++)
+                    fragments.varyings[k][i]= plane.eval(fragments.x[i] - a.x, fragments.y[i] - a.y);
+            }
+            
+            // evalue la couleur des fragments du triangle
+            fragments.mask= mask;
+            stats.shaded+= bits(mask);
+            pipeline.fragment_shader(primitive.id, fragments);
+            
+            // ztest
+            for(int i= 0; i < batch_size; i++)
+            {
+                if((mask & (1u << i)) == 0)
+                    continue;
+                
+                int x= gx + batch_x[i] - tx;
+                int y= gy + batch_y[i] - ty;
+                if(fragments.z[i] < depth(x, y))
+                {
+                    color(x, y)= Color(fragments.r[i], fragments.g[i], fragments.b[i], 1);
+                    depth(x, y)= fragments.z[i];
+                    block_modified= true;
+                }
+            }
+        }
+        
+        // met a jour le zbuffer hierarchique
+        if(block_modified)
+        {
+            hiz.update(depth, hx, hy);
+            modified= true;
+        }
+    }
+    
+    if(modified)
+        hiz.update();
+}
+
+
+// taille des tuiles : les triangles sont repartis dans les tuiles qu'ils touchent, chaque tuile est dessinee par un seul thread.
+const int tile_size= 64;
+
+// soude les sommets identiques, position, coordonnees de texture et normale, d'un mesh non indexe : chaque sommet est partage par plusieurs triangles.
+// les sommets recoivent la normale de leur triangle si le mesh n'a pas de normales. conserve les matieres des triangles.
+Mesh make_indexed( const Mesh& mesh )
+{
+    if(mesh.index_count() > 0)
+        return mesh;
+    
+    const std::vector<vec3>& positions= mesh.positions();
+    const int n= int(positions.size());
+    
+    std::vector<vec3> normals= mesh.normals();
+    if(!mesh.has_normal())
+    {
+        // normale geometrique des triangles, nulle pour un triangle degenere
+        normals.resize(n);
+        for(int i= 0; i +2 < n; i+= 3)
+        {
+            Vector ng= cross(Vector(Point(positions[i]), Point(positions[i +1])), Vector(Point(positions[i]), Point(positions[i +2])));
+            if(length2(ng) > 0)
+                ng= normalize(ng);
+            normals[i]= normals[i +1]= normals[i +2]= vec3(ng);
+        }
+    }
+    
+    const bool has_texcoord= mesh.has_texcoord();
+    const std::vector<vec2>& texcoords= mesh.texcoords();
+    
+    // trie les sommets, les sommets identiques sont consecutifs
+    std::vector<int> order(n);
+    for(int i= 0; i < n; i++)
+        order[i]= i;
+    
+    auto less= [&]( const int a, const int b )
+    {
+        const vec3& pa= positions[a];
+        const vec3& pb= positions[b];
+        if(pa.x != pb.x) return pa.x < pb.x;
+        if(pa.y != pb.y) return pa.y < pb.y;
+        if(pa.z != pb.z) return pa.z < pb.z;
+        
+        if(has_texcoord)
+        {
+            const vec2& ta= texcoords[a];
+            const vec2& tb= texcoords[b];
+            if(ta.x != tb.x) return ta.x < tb.x;
+            if(ta.y != tb.y) return ta.y < tb.y;
+        }
+        
+        const vec3& na= normals[a];
+        const vec3& nb= normals[b];
+        if(na.x != nb.x) return na.x < nb.x;
+        if(na.y != nb.y) return na.y < nb.y;
+        return na.z < nb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    
+    Mesh indexed(GL_TRIANGLES);
+    std::vector<unsigned int> ids(n);
+    for(int i= 0; i < n; i++)
+    {
+        if(i == 0 || less(order[i -1], order[i]))
+        {
+            if(has_texcoord)
+                indexed.texcoord(texcoords[order[i]]);
+            indexed.normal(normals[order[i]]);
+            indexed.vertex(positions[order[i]]);
+        }
+        ids[order[i]]= indexed.vertex_count() -1;
+    }
+    
+    indexed.materials(mesh.materials());
+    const bool has_material= mesh.has_material_index();
+    for(int i= 0; i +2 < n; i+= 3)
+    {
+        if(has_material)
+            indexed.material(mesh.triangle_material_index(i / 3));
+        indexed.triangle(ids[i], ids[i +1], ids[i +2]);
+    }
+    
+    return indexed;
+}
+
+
+int max_threads( )
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
 
 int main( int argc, char **argv )
 {
@@ -129,13 +753,16 @@ int main( int argc, char **argv )
     Mesh mesh= read_mesh("data/bigguy.obj");
     if(mesh == Mesh::error())
         return 1;
+    // dessine des triangles indexes, les sommets partages ne sont transformes qu'une seule fois
+    mesh= make_indexed(mesh);
     printf("  %d positions\n", mesh.vertex_count());
     printf("  %d indices\n", mesh.index_count());
     
     // regle le point de vue de la camera pour observer l'objet
     Point pmin, pmax;
     mesh.bounds(pmin, pmax);
-    Orbiter camera(pmin, pmax);
+    Orbiter camera;
+    camera.lookat(pmin, pmax);
 
     BasicPipeline pipeline( 
         mesh, 
@@ -145,78 +772,105 @@ int main( int argc, char **argv )
     
     Transform viewport= Viewport(color.width(), color.height());
     
-    // draw(pipeline, mesh.vertex_count());
-    for(unsigned int i= 0; i +2 < (unsigned int) mesh.vertex_count(); i= i +3)
+    auto start= std::chrono::high_resolution_clock::now();
+    
+    // draw(pipeline, mesh.indices());
+    // indices des sommets des triangles, 0, 1, 2, 3, etc. si le mesh n'est pas indexe
+    std::vector<unsigned int> indices= mesh.indices();
+    if(indices.empty())
+        for(int i= 0; i < mesh.vertex_count(); i++)
+            indices.push_back(i);
+    
+    // etape 0 : transforme les sommets
+    VertexBuffer vertices;
+    transform(pipeline, mesh.vertex_count(), vertices);
+    
+    const int primitives= int(indices.size()) / 3;
+    const int tiles_x= (color.width() + tile_size -1) / tile_size;
+    const int tiles_y= (color.height() + tile_size -1) / tile_size;
+    const int tiles= tiles_x * tiles_y;
+    const int threads= max_threads();
+    
+    // etape 1 : prepare les triangles et les repartit dans les tuiles.
+    // chaque thread traite une sequence de triangles consecutifs et remplit ses propres listes : setups[thread] et bins[thread][tile]. 
+    // les listes des threads, parcourues dans l'ordre, conservent l'ordre des triangles, et l'image ne depend pas du nombre de threads.
+    std::vector< std::vector<Primitive> > setups(threads);
+    std::vector< std::vector< std::vector<int> > > bins(threads, std::vector< std::vector<int> >(tiles));
+    
+#pragma omp parallel
     {
-        // transforme les 3 sommets du triangle
-        Point a= pipeline.vertex_shader(i);
-        Point b= pipeline.vertex_shader(i+1);
-        Point c= pipeline.vertex_shader(i+2);
+        int thread_id= 0;
+        int thread_count= 1;
+    #ifdef _OPENMP
+        thread_id= omp_get_thread_num();
+        thread_count= omp_get_num_threads();
+    #endif
         
-        // visibilite
-        if(visible(a) == false && visible(b) == false && visible(c) == false)
-            continue;
-        // faux dans pas mal de cas...
-        // question : comment faire un test correct ?
-        // indication : si tous les sommets sont du meme cote d'une face de la region observee par la camera, on est sur que le triangle n'est pas visible.
-        // comment definir la region observee par la camera ? quelle est sa forme (dans quel repere) ? les coordonnees de ses sommets ?
-        
-        // passage dans le repere image
-        a= viewport(a);
-        b= viewport(b);
-        c= viewport(c);
-        
-        // question: comment ne pas dessiner le triangle s'il est mal oriente ?
-        // aire du triangle abc
-        float n= area(a, b, c);
-        if(n < 0)
-            continue;
-        
-        // dessiner le triangle
-        // solution naive, parcours tous les pixels de l'image
-        // question : comment eviter de tester tous les pixels ? 
-        // indice : il est sans doute possible de determiner que le triangle ne touche pas un bloc de pixels en ne testant que les 4 coins du bloc...
-        // question : dessiner de tout petits triangles est tres long. comment gagner du temps en determinant qu'un triangle est suffisament petit/etire pour "passer" entre les pixels ?
-        // (remarque: oui, ca arrive tout le temps...)
-        for(int y= 0; y < color.height(); y++)
-        for(int x= 0; x < color.width(); x++)
+        int begin= int(long(primitives) * thread_id / thread_count);
+        int end= int(long(primitives) * (thread_id +1) / thread_count);
+        std::vector<Primitive>& thread_setups= setups[thread_id];
+        for(int i= begin; i < end; i++)
         {
-            // fragment 
-            Fragment frag;
-            frag.u= area(Point(x, y, 0), a, b);      // distance c / ab
-            frag.v= area(Point(x, y, 0), b, c);      // distance a / bc
-            frag.w= area(Point(x, y, 0), c, a);      // distance b / ac
+            // un triangle decoupe par les plans peut produire plusieurs primitives
+            int first= int(thread_setups.size());
+            setup(pipeline, vertices, viewport, color.width(), color.height(), i, &indices[3*i], thread_setups);
             
-            if(frag.u > 0 && frag.v > 0 && frag.w > 0)
+            for(int p= first; p < int(thread_setups.size()); p++)
             {
-                // normalise les coordonnees barycentriques du fragment
-                frag.u= frag.u / n;
-                frag.v= frag.v / n;
-                frag.w= frag.w / n;
-                
-                frag.x= x;
-                frag.y= y;
-                // interpole z
-                frag.z= frag.u * c.z + frag.v * a.z + frag.w * b.z;
-                
-                // evalue la couleur du fragment du triangle
-                Color frag_color= pipeline.fragment_shader(i/3, frag);
-                
-                // ztest
-                if(frag.z < depth(x, y))
-                {
-                    color(x, y)= Color(frag_color, 1);
-                    depth(x, y)= frag.z;
-                }
-                
-                // question : pour quelle raison le ztest est-il fait apres l'execution du fragment shader ? est-ce obligatoire ?
-                // question : peut on eviter d'executer le fragment shader sur un bloc de pixels couverts par le triangle ? 
-                //      dans quelles conditions sait-on qu'il n'y a rien a dessiner dans un bloc de pixels ?
-                //      == aucun fragment du triangle appartenant au bloc, ne peut modifier l'image et le zbuffer ?
+                const Primitive& primitive= thread_setups[p];
+                for(int y= primitive.ymin / tile_size; y <= primitive.ymax / tile_size; y++)
+                for(int x= primitive.xmin / tile_size; x <= primitive.xmax / tile_size; x++)
+                    bins[thread_id][y * tiles_x + x].push_back(p);
             }
         }
     }
     
+    // etape 2 : dessine chaque tuile dans une image et un zbuffer locaux, sans synchronisation entre les threads
+    RasterStats stats;
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int tile= 0; tile < tiles; tile++)
+    {
+        int tx= (tile % tiles_x) * tile_size;
+        int ty= (tile / tiles_x) * tile_size;
+        Image tile_color(std::min(tile_size, color.width() - tx), std::min(tile_size, color.height() - ty));
+        ZBuffer tile_depth(tile_color.width(), tile_color.height());
+        HiZ tile_hiz((tile_color.width() + block_size -1) / block_size, (tile_color.height() + block_size -1) / block_size);
+        
+        RasterStats tile_stats;
+        for(int t= 0; t < threads; t++)
+        for(int id : bins[t][tile])
+            rasterize(pipeline, setups[t][id], tx, ty, tile_color, tile_depth, tile_hiz, tile_stats);
+        
+    #pragma omp critical
+        stats+= tile_stats;
+        
+        // copie la tuile dans l'image
+        for(int y= 0; y < tile_color.height(); y++)
+        for(int x= 0; x < tile_color.width(); x++)
+        {
+            color(tx + x, ty + y)= tile_color(x, y);
+            depth(tx + x, ty + y)= tile_depth(x, y);
+        }
+    }
+    
+    auto stop= std::chrono::high_resolution_clock::now();
+    int cpu_time= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+    printf("cpu  %ds %03dms\n", int(cpu_time / 1000), int(cpu_time % 1000));
+    
+    long int references= 0;
+    long int drawn= 0;
+    for(int t= 0; t < threads; t++)
+    {
+        drawn+= setups[t].size();
+        for(int tile= 0; tile < tiles; tile++)
+            references+= bins[t][tile].size();
+    }
+    printf("%d triangles, %ld primitives after clipping and culling\n", primitives, drawn);
+    printf("%d vertices shaded, %.2f per triangle\n", mesh.vertex_count(), float(mesh.vertex_count()) / float(primitives));
+    printf("%d threads, %d tiles, %.2f tiles per triangle\n", threads, tiles, float(references) / float(primitives));
+    printf("%ld fragments, %ld shaded (%.1f%%), %ld hidden triangles, %ld hidden blocks\n", 
+        stats.fragments, stats.shaded, 100.f * float(stats.shaded) / float(std::max(stats.fragments, 1L)), stats.triangles, stats.blocks);
+    
     write_image(color, "render.png");
     return 0;
 }
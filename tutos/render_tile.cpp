@@ -0,0 +1,169 @@
+//! \file render_tile.cpp
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "wavefront.h"
+#include "render_tile.h"
+
+
+int RenderScene::load( const char *mesh_filename )
+{
+    mesh= read_mesh(mesh_filename);
+    if(mesh.triangle_count() == 0)
+        // erreur de chargement, pas de triangles
+        return -1;
+
+    filename= mesh_filename;
+    bvh.build(mesh);
+    sources.build(mesh);
+    printf("%d triangles, %d sources\n", mesh.triangle_count(), sources.size());
+
+    textures.reset(new TextureCache(mesh.materials()));
+    return 0;
+}
+
+
+Color direct_irradiance( const BVH& bvh, const Sources& sources, const Point& p, const Vector& pn, const int samples,
+    std::default_random_engine& rng, std::uniform_real_distribution<float>& u01 )
+{
+    Color color= Black();
+    for(int si= 0; si < sources.size(); si++)
+    {
+        const Source& source= sources(si);
+        for(int i= 0; i < samples; i++)
+        {
+            Point s= source.sample(u01(rng), u01(rng));
+            Vector l= Vector(p, s);
+
+            float cos_theta= dot(pn, normalize(l));
+            float cos_theta_s= dot(source.n, normalize(-l));
+            if(cos_theta <= 0 || cos_theta_s <= 0)
+                continue;
+
+            Ray shadow_ray(p + 0.00001f * pn, l);
+            shadow_ray.tmax= 1 - .00001f;
+            if(!bvh.visible(shadow_ray))
+                continue;
+
+            color= color + source.emission * cos_theta * cos_theta_s / (length2(l) * source.pdf(s) * samples);
+        }
+    }
+
+    return color;
+}
+
+
+void render_tile( RenderScene& scene, const RenderView& view, const int xmin, const int ymin, const int xmax, const int ymax, float *rgb,
+    float *positions, float *normals )
+{
+    const Mesh& mesh= scene.mesh;
+    const BVH& bvh= scene.bvh;
+    const Sources& sources= scene.sources;
+    const int samples= std::max(1, view.samples);
+    const int width= xmax - xmin;
+
+    // passage repere image vers repere du monde
+    Transform viewport= Viewport(view.width, view.height);
+    Transform inv= Inverse(viewport * view.projection * view.view);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int py= ymin; py < ymax; py++)
+    for(int px= xmin; px < xmax; px++)
+    {
+        std::default_random_engine rng(hash_seed(view.seed, px, py));
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+        Color color= Black();
+        Point p;
+        Vector pn;
+
+        // generer le rayon pour le pixel (x, y)
+        float x= px + u01(rng);
+        float y= py + u01(rng);
+        Point o= inv(Point(x, y, 0));
+        Point e= inv(Point(x, y, 1));
+
+        Ray ray(o, e);
+        if(Hit hit= bvh.intersect(ray))
+        {
+            const TriangleData& triangle= mesh.triangle(hit.triangle_id);
+            const Material& material= mesh.triangle_material(hit.triangle_id);
+
+            p= point(hit, ray);
+            pn= normal(hit, triangle);
+            if(dot(pn, ray.d) > 0)
+                pn= -pn;
+
+            // couleur diffuse, filtre la texture sur l'empreinte du pixel
+            Color diffuse= material.diffuse;
+            if(material.diffuse_texture != -1 && mesh.has_texcoord())
+            {
+                Ray rx(o, inv(Point(x +1, y, 1)));
+                Ray ry(o, inv(Point(x, y +1, 1)));
+
+                vec2 uv, duvdx, duvdy;
+                texcoord_differentials(triangle, hit, rx, ry, uv, duvdx, duvdy);
+                diffuse= diffuse * scene.textures->sample(material.diffuse_texture, uv, duvdx, duvdy);
+            }
+
+            // emission directe des sources visibles
+            if(material.emission.power() > 0)
+                color= material.emission;
+
+            // samples points sur chaque source
+            color= color + diffuse / float(M_PI) * direct_irradiance(bvh, sources, p, pn, samples, rng, u01);
+        }
+
+        int offset= 3 * ((py - ymin) * width + (px - xmin));
+        rgb[offset]= color.r;
+        rgb[offset +1]= color.g;
+        rgb[offset +2]= color.b;
+
+        if(positions)
+        {
+            positions[offset]= p.x;
+            positions[offset +1]= p.y;
+            positions[offset +2]= p.z;
+        }
+        if(normals)
+        {
+            normals[offset]= pn.x;
+            normals[offset +1]= pn.y;
+            normals[offset +2]= pn.z;
+        }
+    }
+}
+
+
+// copie un tableau de r, g, b dans une image
+static Image make_image( const std::vector<float>& rgb, const int width, const int height )
+{
+    Image image(width, height);
+    for(int i= 0; i < width * height; i++)
+        image(size_t(i))= Color(rgb[3 * i], rgb[3 * i +1], rgb[3 * i +2]);
+
+    return image;
+}
+
+
+Image render_image( RenderScene& scene, const RenderView& view )
+{
+    std::vector<float> rgb(3 * view.width * view.height);
+    render_tile(scene, view, 0, 0, view.width, view.height, rgb.data());
+
+    return make_image(rgb, view.width, view.height);
+}
+
+Image render_image( RenderScene& scene, const RenderView& view, Image& positions, Image& normals )
+{
+    std::vector<float> rgb(3 * view.width * view.height);
+    std::vector<float> p(3 * view.width * view.height);
+    std::vector<float> n(3 * view.width * view.height);
+    render_tile(scene, view, 0, 0, view.width, view.height, rgb.data(), p.data(), n.data());
+
+    positions= make_image(p, view.width, view.height);
+    normals= make_image(n, view.width, view.height);
+    return make_image(rgb, view.width, view.height);
+}
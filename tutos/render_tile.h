@@ -0,0 +1,70 @@
+//! \file render_tile.h eclairage direct par blocs de pixels, scene chargee une seule fois et partagee par plusieurs rendus.
+
+#ifndef _RENDER_TILE_H
+#define _RENDER_TILE_H
+
+#include <memory>
+#include <random>
+#include <string>
+
+#include "mat.h"
+#include "mesh.h"
+#include "image.h"
+
+#include "bvh.h"
+#include "sources.h"
+#include "texture_cache.h"
+
+
+//! scene : objet, bvh, sources de lumiere et textures des matieres.
+struct RenderScene
+{
+    std::string filename;
+    Mesh mesh;
+    BVH bvh;
+    Sources sources;
+    std::unique_ptr<TextureCache> textures;
+
+    RenderScene( ) : filename(), mesh(), bvh(), sources(), textures() {}
+
+    //! charge un objet, construit le bvh et la liste des sources. renvoie 0 si ok, -1 en cas d'erreur.
+    int load( const char *mesh_filename );
+};
+
+//! camera et parametres d'une image.
+struct RenderView
+{
+    Transform view;
+    Transform projection;
+    int width;
+    int height;
+    int samples;        //!< nombre d'echantillons par source et par pixel
+    unsigned seed;      //!< initialisation des generateurs de nombres aleatoires
+
+    RenderView( ) : view(), projection(), width(0), height(0), samples(1), seed(0) {}
+    RenderView( const Transform& _view, const Transform& _projection, const int _width, const int _height, const int _samples, const unsigned _seed= 0 )
+        : view(_view), projection(_projection), width(_width), height(_height), samples(_samples), seed(_seed) {}
+};
+
+/*! eclairage direct des pixels [xmin .. xmax) x [ymin .. ymax), ecrit les couleurs r, g, b dans rgb, ligne par ligne, 3 * (xmax - xmin) * (ymax - ymin) floats.
+    chaque pixel utilise son propre generateur de nombres aleatoires, initialise par view.seed et ses coordonnees : les pixels ont la meme
+    valeur quelque soit le decoupage de l'image en blocs, et le nombre de threads.
+
+    si positions et normals ne sont pas nuls, ils recoivent aussi la position x, y, z et la normale du point visible de chaque pixel, nulles pour les pixels sans intersection.
+ */
+void render_tile( RenderScene& scene, const RenderView& view, const int xmin, const int ymin, const int xmax, const int ymax, float *rgb,
+    float *positions= nullptr, float *normals= nullptr );
+
+/*! eclairement direct du point p, de normale pn : samples points par source, avec un rayon d'ombre vers chaque point.
+    la lumiere reflechie par une matiere diffuse est diffuse / pi * direct_irradiance().
+ */
+Color direct_irradiance( const BVH& bvh, const Sources& sources, const Point& p, const Vector& pn, const int samples,
+    std::default_random_engine& rng, std::uniform_real_distribution<float>& u01 );
+
+//! eclairage direct de toute l'image, en valeurs lineaires, a enregistrer avec write_image_hdr().
+Image render_image( RenderScene& scene, const RenderView& view );
+
+//! eclairage direct de toute l'image, et position / normale du point visible de chaque pixel, cf render_tile().
+Image render_image( RenderScene& scene, const RenderView& view, Image& positions, Image& normals );
+
+#endif
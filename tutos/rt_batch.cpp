@@ -0,0 +1,224 @@
+//! \file rt_batch.cpp rendu d'une liste de points de vue du meme objet : la scene, le bvh et les sources sont construits une seule fois.
+
+/*  utilisation :
+        rt_batch <mesh> <jobs> [log] [concurrent]
+
+    chaque ligne non vide du fichier jobs decrit une image, les lignes commencant par # sont ignorees :
+        <orbiter> [largeur] [hauteur] [samples] [image]
+    par defaut : 1024 640 16 batch_<numero>.hdr, une image .png est corrigee (gamma 2.2) avant d'etre enregistree.
+    une image de taille nulle ou negative, ou sans echantillons, n'est pas calculee et marquee en erreur dans le log.
+
+    les images sont calculees l'une apres l'autre, en utilisant tous les threads pour chaque image,
+    ou en parallele, une image par thread, avec l'option concurrent : c'est plus efficace pour beaucoup de petites images.
+    les temps de chaque etape sont ajoutes au fichier log, rt_batch_log.txt par defaut.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "orbiter.h"
+#include "image.h"
+#include "image_io.h"
+#include "image_hdr.h"
+
+#include "render_tile.h"
+
+
+//! description d'une image.
+struct Job
+{
+    std::string orbiter;
+    std::string output;
+    int width;
+    int height;
+    int samples;
+};
+
+//! temps d'execution des etapes d'une image, en millisecondes.
+struct JobTimes
+{
+    float camera;
+    float render;
+    float write;
+    bool error;
+};
+
+
+static int read_jobs( const char *filename, std::vector<Job>& jobs )
+{
+    FILE *in= fopen(filename, "rt");
+    if(in == NULL)
+    {
+        printf("[error] loading jobs '%s'...\n", filename);
+        return -1;
+    }
+
+    char line[1024];
+    while(fgets(line, sizeof(line), in) != NULL)
+    {
+        char orbiter[1024];
+        char output[1024]= "";
+        Job job= { "", "", 1024, 640, 16 };
+
+        int n= sscanf(line, " %1023s %d %d %d %1023s", orbiter, &job.width, &job.height, &job.samples, output);
+        if(n < 1 || orbiter[0] == '#')
+            continue;
+
+        job.orbiter= orbiter;
+        if(output[0])
+            job.output= output;
+        else
+        {
+            char tmp[64];
+            sprintf(tmp, "batch_%03d.hdr", int(jobs.size()));
+            job.output= tmp;
+        }
+
+        jobs.push_back(job);
+    }
+
+    fclose(in);
+    printf("jobs '%s': %d images\n", filename, int(jobs.size()));
+    return 0;
+}
+
+
+static JobTimes run_job( RenderScene& scene, const Job& job, const unsigned seed )
+{
+    JobTimes times= { 0, 0, 0, true };
+    if(job.width <= 0 || job.height <= 0 || job.samples <= 0)
+    {
+        printf("[error] job '%s': %dx%d %d samples...\n", job.orbiter.c_str(), job.width, job.height, job.samples);
+        return times;
+    }
+
+    auto start= std::chrono::high_resolution_clock::now();
+
+    Orbiter camera;
+    if(camera.read_orbiter(job.orbiter.c_str()))
+        // erreur, pas de camera
+        return times;
+
+    RenderView view(camera.view(), camera.projection(job.width, job.height, 45), job.width, job.height, job.samples, seed);
+    times.camera= elapsed(start);
+
+    start= std::chrono::high_resolution_clock::now();
+    Image image= render_image(scene, view);
+    times.render= elapsed(start);
+
+    start= std::chrono::high_resolution_clock::now();
+    int code;
+    if(is_hdr_image(job.output.c_str()))
+        code= write_image_hdr(image, job.output.c_str());
+    else
+        code= write_image(gamma_correct(image), job.output.c_str());
+    times.write= elapsed(start);
+
+    times.error= (code < 0);
+    return times;
+}
+
+
+int main( const int argc, const char **argv )
+{
+    if(argc < 3)
+    {
+        printf("usage: %s <mesh> <jobs> [log] [concurrent]\n", argv[0]);
+        return 1;
+    }
+
+    const char *mesh_filename= argv[1];
+    const char *jobs_filename= argv[2];
+    const char *log_filename= "rt_batch_log.txt";
+    if(argc > 3) log_filename= argv[3];
+    bool concurrent= (argc > 4 && strcmp(argv[4], "concurrent") == 0);
+
+    std::vector<Job> jobs;
+    if(read_jobs(jobs_filename, jobs) < 0)
+        return 1;
+
+    FILE *log= fopen(log_filename, "at");
+    if(log == NULL)
+    {
+        printf("[error] writing log '%s'...\n", log_filename);
+        return 1;
+    }
+
+    // charge la scene une seule fois
+    auto start= std::chrono::high_resolution_clock::now();
+
+    RenderScene scene;
+    if(scene.load(mesh_filename) < 0)
+    {
+        fprintf(log, "# %s '%s': [error] loading mesh\n", argv[0], mesh_filename);
+        fclose(log);
+        return 1;
+    }
+
+    float load_time= elapsed(start);
+    fprintf(log, "# %s '%s' '%s': %d jobs%s, scene %.2fms\n", argv[0], mesh_filename, jobs_filename, int(jobs.size()), concurrent ? ", concurrent" : "", load_time);
+    fprintf(log, "# job orbiter width height samples output camera_ms render_ms write_ms status\n");
+
+    // chaque image utilise tous les threads, ou une image par thread. render_tile() n'utilise qu'un thread dans une region parallele
+    std::vector<JobTimes> times(jobs.size());
+    start= std::chrono::high_resolution_clock::now();
+
+    auto run= [&]( const int i ) {
+        times[i]= run_job(scene, jobs[i], unsigned(i));
+
+        const Job& job= jobs[i];
+        const JobTimes& t= times[i];
+    #pragma omp critical
+        {
+            printf("job %d '%s' %dx%d %d samples: render %.2fms%s\n", i, job.orbiter.c_str(), job.width, job.height, job.samples, t.render, t.error ? " [error]" : "");
+            fprintf(log, "%d %s %d %d %d %s %.2f %.2f %.2f %s\n", i, job.orbiter.c_str(), job.width, job.height, job.samples, job.output.c_str(),
+                t.camera, t.render, t.write, t.error ? "error" : "ok");
+            fflush(log);
+        }
+    };
+
+    if(concurrent)
+    {
+    #pragma omp parallel for schedule(dynamic, 1)
+        for(int i= 0; i < int(jobs.size()); i++)
+            run(i);
+    }
+    else
+    {
+        for(int i= 0; i < int(jobs.size()); i++)
+            run(i);
+    }
+
+    float total= elapsed(start);
+
+    int errors= 0;
+    float render= 0;
+    for(int i= 0; i < int(times.size()); i++)
+    {
+        render+= times[i].render;
+        if(times[i].error)
+            errors++;
+    }
+
+    int threads= 1;
+#ifdef _OPENMP
+    threads= omp_get_max_threads();
+#endif
+
+    printf("batch: %d jobs, %d errors, scene %.2fms, jobs %.2fms (render %.2fms), %d threads\n", int(jobs.size()), errors, load_time, total, render, threads);
+    fprintf(log, "# total: %d jobs, %d errors, scene %.2fms, jobs %.2fms (render %.2fms), %d threads\n", int(jobs.size()), errors, load_time, total, render, threads);
+    fclose(log);
+
+    if(scene.textures && scene.textures->count())
+        scene.textures->print();
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,470 @@
+//! \file rt_bench.cpp benchmark du lancer de rayons : scenes et cameras fixes, resultats enregistres en json pour comparer les versions.
+
+#include <cstdio>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "vec.h"
+#include "mat.h"
+#include "mesh.h"
+#include "wavefront.h"
+#include "orbiter.h"
+
+#include "bvh.h"
+#include "bvh_quality.h"
+#include "sources.h"
+#include "intersector.h"
+
+
+// scenes de reference, la camera est placee automatiquement sur l'englobant si le fichier orbiter n'est pas fourni.
+struct BenchScene
+{
+    const char *name;
+    const char *mesh_filename;
+    const char *orbiter_filename;
+};
+
+const BenchScene scenes[]= {
+    { "cornell", "data/cornell.obj", "data/cornell_orbiter.txt" },
+    { "bigguy", "data/bigguy.obj", nullptr },
+    { "emission", "data/emission.obj", "data/emission_orbiter.txt" },
+    { "robot", "data/Robot/Robot_000001.obj", nullptr },
+};
+
+// parametres fixes, ne pas modifier sans renommer le fichier de resultats...
+const int width= 512;
+const int height= 320;
+const int repeat= 3;        // chaque mesure est repetee, on garde la plus rapide
+const unsigned seed= 1;     // generateur initialise de la meme maniere a chaque execution
+
+
+// resultat d'une mesure
+struct BenchRays
+{
+    int rays;
+    float ms;
+
+    float mrays( ) const { return ms > 0 ? float(rays) / (ms * 1000) : 0; }
+};
+
+int max_threads( )
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+// pic de memoire du processus, en Ko, ou 0 si l'info n'est pas disponible
+int peak_memory( )
+{
+    int kb= 0;
+#ifdef __linux__
+    FILE *in= fopen("/proc/self/status", "rt");
+    if(in == nullptr)
+        return 0;
+
+    char line[1024];
+    while(fgets(line, sizeof(line), in))
+        if(sscanf(line, "VmHWM: %d kB", &kb) == 1)
+            break;
+    fclose(in);
+#endif
+    return kb;
+}
+
+
+// requetes, bvh ou structure quelconque, cf Intersector
+Hit closest( const BVH& bvh, const Ray& ray ) { return bvh.intersect(ray); }
+Hit closest( const Intersector& intersector, const Ray& ray ) { return intersector.intersect(ray); }
+bool visible( const BVH& bvh, const Ray& ray ) { return bvh.visible(ray); }
+bool visible( const Intersector& intersector, const Ray& ray ) { return !intersector.occluded(ray); }
+
+// intersections les plus proches
+template< typename Structure >
+BenchRays bench_intersect( const Structure& structure, const std::vector<Ray>& rays, std::vector<Hit>& hits, const int threads )
+{
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+
+    hits.resize(rays.size());
+    BenchRays bench= { int(rays.size()), FLT_MAX };
+    for(int r= 0; r < repeat; r++)
+    {
+        auto start= std::chrono::high_resolution_clock::now();
+
+        const int n= int(rays.size());
+    #pragma omp parallel for schedule(dynamic, 1024)
+        for(int i= 0; i < n; i++)
+            hits[i]= closest(structure, rays[i]);
+
+        bench.ms= std::min(bench.ms, elapsed(start));
+    }
+
+    return bench;
+}
+
+// rayons d'ombre / visibilite, pas besoin de l'intersection la plus proche
+template< typename Structure >
+BenchRays bench_visible( const Structure& structure, const std::vector<Ray>& rays, std::vector<int>& visibles, const int threads )
+{
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+
+    visibles.resize(rays.size());
+    BenchRays bench= { int(rays.size()), FLT_MAX };
+    for(int r= 0; r < repeat; r++)
+    {
+        auto start= std::chrono::high_resolution_clock::now();
+
+        const int n= int(rays.size());
+    #pragma omp parallel for schedule(dynamic, 1024)
+        for(int i= 0; i < n; i++)
+            visibles[i]= visible(structure, rays[i]);
+
+        bench.ms= std::min(bench.ms, elapsed(start));
+    }
+
+    return bench;
+}
+
+
+// mesures d'une structure acceleratrice, cf intersector_names()
+struct BenchBackend
+{
+    const char *name;
+    float build_ms;
+    IntersectorStats stats;
+
+    BenchRays primary;
+    BenchRays shadow;
+    BenchRays incoherent;
+    int errors;         // nombre de rayons primaires dont l'intersection est differente de celle du bvh
+
+    float ms( ) const { return primary.ms + shadow.ms + incoherent.ms; }
+};
+
+struct BenchResult
+{
+    const BenchScene *scene;
+    int triangles;
+    int nodes;
+    float build_ms;
+    size_t memory;
+    int peak_kb;
+
+    BenchRays primary;
+    BenchRays shadow;
+    BenchRays incoherent;
+
+    std::vector<int> threads;
+    std::vector<BenchRays> scaling;
+
+    BVHQuality quality;
+
+    std::vector<BenchBackend> backends;
+    int best;               // structure la plus rapide sur les 3 ensembles de rayons
+};
+
+
+bool bench( const BenchScene& scene, BenchResult& result )
+{
+    printf("\n[%s]\n", scene.name);
+
+    Mesh mesh= read_mesh(scene.mesh_filename);
+    if(mesh.triangle_count() == 0)
+        return false;
+
+    Point pmin, pmax;
+    mesh.bounds(pmin, pmax);
+
+    Orbiter camera;
+    if(scene.orbiter_filename == nullptr)
+        camera.lookat(pmin, pmax);
+    else if(camera.read_orbiter(scene.orbiter_filename) < 0)
+        return false;
+
+    result.scene= &scene;
+
+    // construction
+    BVH bvh;
+    {
+        result.build_ms= FLT_MAX;
+        for(int r= 0; r < repeat; r++)
+        {
+            auto start= std::chrono::high_resolution_clock::now();
+            bvh.build(mesh);
+            result.build_ms= std::min(result.build_ms, elapsed(start));
+        }
+
+        result.triangles= int(bvh.triangles.size());
+        result.nodes= int(bvh.nodes.size());
+        result.memory= bvh.memory();
+    }
+
+    // rayons primaires, un par pixel
+    std::vector<Ray> primary;
+    {
+        Transform view= camera.view();
+        Transform projection= camera.projection(width, height, 45);
+        Transform viewport= camera.viewport();
+        Transform inv= Inverse(viewport * projection * view);
+
+        for(int y= 0; y < height; y++)
+        for(int x= 0; x < width; x++)
+            primary.emplace_back(inv(Point(x + .5f, y + .5f, 0)), inv(Point(x + .5f, y + .5f, 1)));
+    }
+
+    const int threads= max_threads();
+    std::vector<Hit> hits;
+    result.primary= bench_intersect(bvh, primary, hits, threads);
+
+    // qualite de l'arbre, cout predit et mesure sur les rayons primaires
+    result.quality= bvh_quality(bvh);
+    bvh_measure(bvh, primary, result.quality);
+
+    // prepare les rayons secondaires depuis les points d'intersection des rayons primaires
+    Sources sources;
+    sources.build(mesh);
+
+    // pas de sources dans la scene, utilise un point au dessus de l'englobant
+    Point light= center(pmin, pmax) + Vector(0, (pmax.y - pmin.y) * 2, 0);
+
+    std::default_random_engine rng(seed);
+    std::uniform_real_distribution<float> u01(0.f, 1.f);
+
+    std::vector<Ray> shadow;
+    std::vector<Ray> incoherent;
+    for(int i= 0; i < int(hits.size()); i++)
+    {
+        if(!hits[i])
+            continue;
+
+        TriangleData triangle= mesh.triangle(hits[i].triangle_id);
+        Vector n= normalize(cross(Vector(Point(triangle.a), Point(triangle.b)), Vector(Point(triangle.a), Point(triangle.c))));
+        if(dot(n, primary[i].d) > 0)
+            n= -n;
+
+        Point p= point(hits[i], primary[i]) + 0.001f * n;
+
+        // rayon d'ombre vers un point d'une source
+        Point s= light;
+        if(sources.size() > 0)
+        {
+            int id= std::min(int(u01(rng) * sources.size()), sources.size() -1);
+            s= sources(id).sample(u01(rng), u01(rng));
+        }
+        Ray ray(p, s);
+        ray.tmax= 1 - .001f;
+        shadow.push_back(ray);
+
+        // rayon incoherent, direction distribuee selon cos theta autour de la normale
+        World world(n);
+        incoherent.push_back(Ray(p, world(sample_cosine(u01(rng), u01(rng)))));
+    }
+
+    std::vector<int> visible;
+    result.shadow= bench_visible(bvh, shadow, visible, threads);
+
+    std::vector<Hit> incoherent_hits;
+    result.incoherent= bench_intersect(bvh, incoherent, incoherent_hits, threads);
+
+    // passage a l'echelle, rayons primaires
+    for(int t= 1; ; t= t * 2)
+    {
+        t= std::min(t, threads);
+        result.threads.push_back(t);
+        result.scaling.push_back(bench_intersect(bvh, primary, hits, t));
+
+        if(t == threads)
+            break;
+    }
+
+    // compare les structures sur les memes rayons
+    result.best= -1;
+    for(const char *name : intersector_names())
+    {
+        std::unique_ptr<Intersector> intersector= make_intersector(name);
+
+        BenchBackend backend;
+        backend.name= name;
+        backend.build_ms= FLT_MAX;
+        for(int r= 0; r < repeat; r++)
+        {
+            auto start= std::chrono::high_resolution_clock::now();
+            intersector->build(mesh);
+            backend.build_ms= std::min(backend.build_ms, elapsed(start));
+        }
+        backend.stats= intersector->stats();
+        intersector->print();
+
+        std::vector<Hit> backend_hits;
+        std::vector<int> backend_visible;
+        backend.primary= bench_intersect(*intersector, primary, backend_hits, threads);
+
+        // verifie les intersections des rayons primaires, meme triangle et meme distance que le bvh
+        backend.errors= 0;
+        for(int i= 0; i < int(hits.size()); i++)
+            if(backend_hits[i].triangle_id != hits[i].triangle_id
+            || (hits[i] && std::abs(backend_hits[i].t - hits[i].t) > 0.0001f * std::max(1.f, hits[i].t)))
+                backend.errors++;
+
+        backend.shadow= bench_visible(*intersector, shadow, backend_visible, threads);
+        backend.incoherent= bench_intersect(*intersector, incoherent, backend_hits, threads);
+
+        // seules les structures qui trouvent les memes intersections que le bvh sont comparees
+        if(backend.errors == 0 && (result.best < 0 || backend.ms() < result.backends[result.best].ms()))
+            result.best= int(result.backends.size());
+        result.backends.push_back(backend);
+    }
+
+    result.peak_kb= peak_memory();
+
+    printf("  %d triangles, %d nodes, %.2fMB\n", result.triangles, result.nodes, result.memory / 1024.f / 1024.f);
+    printf("  build %.2fms\n", result.build_ms);
+    printf("  primary %.2fms %.2f Mrays/s\n", result.primary.ms, result.primary.mrays());
+    printf("  shadow %.2fms %.2f Mrays/s\n", result.shadow.ms, result.shadow.mrays());
+    printf("  incoherent %.2fms %.2f Mrays/s\n", result.incoherent.ms, result.incoherent.mrays());
+    for(int i= 0; i < int(result.threads.size()); i++)
+        printf("  %d threads %.2f Mrays/s\n", result.threads[i], result.scaling[i].mrays());
+    bvh_print(result.quality);
+
+    for(const BenchBackend& backend : result.backends)
+        printf("  %-6s build %.2fms, %.2fMB, primary %.2f, shadow %.2f, incoherent %.2f Mrays/s%s\n", backend.name,
+            backend.build_ms, backend.stats.memory / 1024.f / 1024.f, backend.primary.mrays(), backend.shadow.mrays(), backend.incoherent.mrays(),
+            backend.errors ? " [error] hits differ from the bvh" : "");
+    if(result.best >= 0)
+        printf("  best %s\n", result.backends[result.best].name);
+
+    return true;
+}
+
+
+void write_quality( FILE *out, const BVHQuality& quality )
+{
+    fprintf(out, "      \"quality\": {\n");
+    fprintf(out, "        \"sah\": %.3f,\n", quality.sah);
+    fprintf(out, "        \"overlap\": %.4f,\n", quality.overlap);
+    fprintf(out, "        \"depth_avg\": %.2f,\n", quality.depth_avg);
+    fprintf(out, "        \"depth_max\": %d,\n", quality.depth_max);
+    fprintf(out, "        \"leaves\": %d,\n", quality.leaves);
+    fprintf(out, "        \"leaf_sizes\": [");
+    for(int i= 0; i < int(quality.leaf_sizes.size()); i++)
+        fprintf(out, "%s%d", i ? ", " : " ", quality.leaf_sizes[i]);
+    fprintf(out, " ],\n");
+    fprintf(out, "        \"depths\": [");
+    for(int i= 0; i < int(quality.depths.size()); i++)
+        fprintf(out, "%s%d", i ? ", " : " ", quality.depths[i]);
+    fprintf(out, " ],\n");
+    fprintf(out, "        \"predicted\": { \"nodes\": %.3f, \"boxes\": %.3f, \"triangles\": %.3f, \"cost\": %.3f },\n",
+        quality.predicted_nodes, quality.predicted_boxes, quality.predicted_triangles, quality.sah);
+    fprintf(out, "        \"measured\": { \"nodes\": %.3f, \"boxes\": %.3f, \"triangles\": %.3f, \"cost\": %.3f }\n",
+        quality.measured_nodes, quality.measured_boxes, quality.measured_triangles, quality.measured_cost);
+    fprintf(out, "      },\n");
+}
+
+void write_rays( FILE *out, const char *name, const BenchRays& bench )
+{
+    fprintf(out, "      \"%s\": { \"rays\": %d, \"ms\": %.3f, \"mrays\": %.3f },\n", name, bench.rays, bench.ms, bench.mrays());
+}
+
+void write_backends( FILE *out, const BenchResult& result )
+{
+    fprintf(out, "      \"backends\": [\n");
+    for(int i= 0; i < int(result.backends.size()); i++)
+    {
+        const BenchBackend& backend= result.backends[i];
+        fprintf(out, "        { \"name\": \"%s\", \"build_ms\": %.3f, \"memory_bytes\": %lu, \"nodes\": %d, \"references\": %d, ",
+            backend.name, backend.build_ms, (unsigned long) backend.stats.memory, backend.stats.nodes, backend.stats.references);
+        fprintf(out, "\"primary\": %.3f, \"shadow\": %.3f, \"incoherent\": %.3f, \"errors\": %d }%s\n",
+            backend.primary.mrays(), backend.shadow.mrays(), backend.incoherent.mrays(), backend.errors, (i + 1 < int(result.backends.size())) ? "," : "");
+    }
+    fprintf(out, "      ],\n");
+    fprintf(out, "      \"best\": \"%s\"\n", result.best < 0 ? "" : result.backends[result.best].name);
+}
+
+int write_results( const std::vector<BenchResult>& results, const char *filename )
+{
+    FILE *out= fopen(filename, "wt");
+    if(out == nullptr)
+    {
+        printf("[error] writing '%s'...\n", filename);
+        return -1;
+    }
+
+    printf("\nwriting '%s'...\n", filename);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"width\": %d,\n", width);
+    fprintf(out, "  \"height\": %d,\n", height);
+    fprintf(out, "  \"threads\": %d,\n", max_threads());
+    fprintf(out, "  \"scenes\": [\n");
+    for(int i= 0; i < int(results.size()); i++)
+    {
+        const BenchResult& result= results[i];
+        fprintf(out, "    {\n");
+        fprintf(out, "      \"name\": \"%s\",\n", result.scene->name);
+        fprintf(out, "      \"mesh\": \"%s\",\n", result.scene->mesh_filename);
+        fprintf(out, "      \"triangles\": %d,\n", result.triangles);
+        fprintf(out, "      \"nodes\": %d,\n", result.nodes);
+        fprintf(out, "      \"build_ms\": %.3f,\n", result.build_ms);
+        fprintf(out, "      \"memory_bytes\": %lu,\n", (unsigned long) result.memory);
+        fprintf(out, "      \"peak_memory_kb\": %d,\n", result.peak_kb);
+        write_quality(out, result.quality);
+        write_rays(out, "primary", result.primary);
+        write_rays(out, "shadow", result.shadow);
+        write_rays(out, "incoherent", result.incoherent);
+        fprintf(out, "      \"scaling\": [");
+        for(int k= 0; k < int(result.threads.size()); k++)
+            fprintf(out, "%s{ \"threads\": %d, \"mrays\": %.3f }", k ? ", " : " ", result.threads[k], result.scaling[k].mrays());
+        fprintf(out, " ],\n");
+        write_backends(out, result);
+        fprintf(out, "    }%s\n", (i + 1 < int(results.size())) ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+
+    fclose(out);
+    return 0;
+}
+
+
+int main( const int argc, const char **argv )
+{
+    const char *filename= "rt_bench.json";
+    if(argc > 1) filename= argv[1];
+
+    // execute toutes les scenes, ou seulement celle indiquee en parametre
+    const char *only= nullptr;
+    if(argc > 2) only= argv[2];
+
+    std::vector<BenchResult> results;
+    for(const BenchScene& scene : scenes)
+    {
+        if(only && strcmp(only, scene.name) != 0)
+            continue;
+
+        BenchResult result;
+        if(bench(scene, result))
+            results.push_back(result);
+        else
+            printf("[error] scene '%s'...\n", scene.name);
+    }
+
+    if(results.empty())
+        return 1;
+
+    return write_results(results, filename) < 0 ? 1 : 0;
+}
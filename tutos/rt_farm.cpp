@@ -0,0 +1,690 @@
+//! \file rt_farm.cpp rendu reparti : un coordinateur distribue les blocs de l'image a des processus de rendu, connectes par sockets tcp ou unix.
+
+/*  utilisation :
+        rt_farm coordinator <adresse> [mesh] [orbiter] [processus] [samples] [taille des blocs]
+        rt_farm worker <adresse>
+
+    adresse : "unix:/tmp/rt_farm.sock", "machine:port", ou "port" pour une connexion tcp locale.
+    le coordinateur attend les connexions des processus de rendu, et demarre lui meme [processus] processus locaux, si necessaire.
+    les processus de rendu peuvent etre demarres / arretes a tout moment, les blocs d'un processus deconnecte sont redistribues.
+
+    exemple, 4 processus sur la meme machine :
+        bin/rt_farm coordinator unix:/tmp/rt_farm.sock data/cornell.obj data/cornell_orbiter.txt 4
+    ou, sur plusieurs machines qui partagent les fichiers :
+        bin/rt_farm coordinator 4242 data/cornell.obj data/cornell_orbiter.txt
+        bin/rt_farm worker machine:4242
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <algorithm>
+
+#include "mat.h"
+#include "orbiter.h"
+#include "image.h"
+#include "image_hdr.h"
+
+#include "render_tile.h"
+
+
+#ifndef _WIN32
+
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+
+// messages echanges par le coordinateur et les processus de rendu : entete + donnees, dans l'ordre des octets de la machine.
+enum MessageType
+{
+    MESSAGE_SCENE= 1,       // coordinateur -> processus : SceneMessage + nom du fichier mesh
+    MESSAGE_READY,          // processus -> coordinateur : scene chargee
+    MESSAGE_TILE,           // coordinateur -> processus : TileMessage, bloc a calculer
+    MESSAGE_RESULT,         // processus -> coordinateur : TileMessage + couleurs r, g, b du bloc
+    MESSAGE_QUIT            // coordinateur -> processus : fin
+};
+
+struct MessageHeader
+{
+    int32_t type;
+    int32_t size;           // taille des donnees, en octets
+};
+
+struct SceneMessage
+{
+    int32_t width;
+    int32_t height;
+    int32_t samples;
+    uint32_t seed;
+    float view[16];
+    float projection[16];
+};
+
+struct TileMessage
+{
+    int32_t id;
+    int32_t xmin, ymin;
+    int32_t xmax, ymax;
+};
+
+
+static bool send_all( const int fd, const void *data, const size_t size )
+{
+    const char *p= (const char *) data;
+    for(size_t n= 0; n < size; )
+    {
+        ssize_t r= send(fd, p + n, size - n, 0);
+        if(r < 0 && errno == EINTR)
+            continue;
+        if(r <= 0)
+            return false;
+        n+= r;
+    }
+    return true;
+}
+
+static bool recv_all( const int fd, void *data, const size_t size )
+{
+    char *p= (char *) data;
+    for(size_t n= 0; n < size; )
+    {
+        ssize_t r= recv(fd, p + n, size - n, 0);
+        if(r < 0 && errno == EINTR)
+            continue;
+        if(r <= 0)
+            return false;
+        n+= r;
+    }
+    return true;
+}
+
+static bool send_message( const int fd, const int type, const void *data= nullptr, const size_t size= 0, const void *data2= nullptr, const size_t size2= 0 )
+{
+    MessageHeader header= { type, int32_t(size + size2) };
+    return send_all(fd, &header, sizeof(header))
+        && (size == 0 || send_all(fd, data, size))
+        && (size2 == 0 || send_all(fd, data2, size2));
+}
+
+static bool recv_message( const int fd, int& type, std::vector<char>& data )
+{
+    MessageHeader header;
+    if(!recv_all(fd, &header, sizeof(header)) || header.size < 0)
+        return false;
+
+    type= header.type;
+    data.resize(header.size);
+    return header.size == 0 || recv_all(fd, data.data(), header.size);
+}
+
+// coordinateur : lit les octets deja disponibles sur la connexion, sans attendre la fin du message.
+// renvoie false si la connexion est fermee.
+static bool recv_available( const int fd, std::vector<char>& buffer )
+{
+    char tmp[64*1024];
+    ssize_t r= recv(fd, tmp, sizeof(tmp), MSG_DONTWAIT);
+    if(r < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return true;        // rien a lire pour l'instant
+    if(r <= 0)
+        return false;
+
+    buffer.insert(buffer.end(), tmp, tmp + r);
+    return true;
+}
+
+// coordinateur : extrait le premier message complet de buffer.
+// renvoie 1 si un message est extrait, 0 s'il est encore incomplet, -1 si l'entete est invalide.
+static int pop_message( std::vector<char>& buffer, int& type, std::vector<char>& data )
+{
+    MessageHeader header;
+    if(buffer.size() < sizeof(header))
+        return 0;
+
+    memcpy(&header, buffer.data(), sizeof(header));
+    if(header.size < 0)
+        return -1;
+
+    size_t size= sizeof(header) + size_t(header.size);
+    if(buffer.size() < size)
+        return 0;
+
+    type= header.type;
+    data.assign(buffer.begin() + sizeof(header), buffer.begin() + size);
+    buffer.erase(buffer.begin(), buffer.begin() + size);
+    return 1;
+}
+
+
+//! adresse d'une socket unix "unix:chemin", ou tcp "machine:port" / "port".
+struct Address
+{
+    std::string text;
+    bool local;
+    std::string path;
+    std::string host;
+    std::string port;
+
+    Address( const char *address ) : text(address), local(false), path(), host(), port()
+    {
+        if(strncmp(address, "unix:", 5) == 0)
+        {
+            local= true;
+            path= address + 5;
+            return;
+        }
+
+        const char *sep= strrchr(address, ':');
+        if(sep)
+        {
+            host= std::string(address, sep);
+            port= sep +1;
+        }
+        else
+            port= address;
+    }
+};
+
+static int listen_socket( const Address& address )
+{
+    int fd= -1;
+    if(address.local)
+    {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family= AF_UNIX;
+        strncpy(addr.sun_path, address.path.c_str(), sizeof(addr.sun_path) -1);
+
+        unlink(address.path.c_str());
+        fd= socket(AF_UNIX, SOCK_STREAM, 0);
+        if(fd >= 0 && bind(fd, (sockaddr *) &addr, sizeof(addr)) < 0)
+        {
+            close(fd);
+            fd= -1;
+        }
+    }
+    else
+    {
+        addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family= AF_UNSPEC;
+        hints.ai_socktype= SOCK_STREAM;
+        hints.ai_flags= AI_PASSIVE;
+
+        addrinfo *info= nullptr;
+        if(getaddrinfo(address.host.empty() ? nullptr : address.host.c_str(), address.port.c_str(), &hints, &info) != 0)
+            info= nullptr;
+
+        for(addrinfo *p= info; p && fd < 0; p= p->ai_next)
+        {
+            fd= socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+            if(fd < 0)
+                continue;
+
+            int on= 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if(bind(fd, p->ai_addr, p->ai_addrlen) < 0)
+            {
+                close(fd);
+                fd= -1;
+            }
+        }
+
+        if(info)
+            freeaddrinfo(info);
+    }
+
+    if(fd >= 0 && listen(fd, 64) < 0)
+    {
+        close(fd);
+        fd= -1;
+    }
+
+    if(fd < 0)
+        printf("[error] listening on '%s'...\n", address.text.c_str());
+    return fd;
+}
+
+static int connect_socket( const Address& address )
+{
+    // le coordinateur n'est peut etre pas encore pret, essaye pendant quelques secondes
+    for(int retry= 0; retry < 50; retry++)
+    {
+        int fd= -1;
+        if(address.local)
+        {
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family= AF_UNIX;
+            strncpy(addr.sun_path, address.path.c_str(), sizeof(addr.sun_path) -1);
+
+            fd= socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd >= 0 && connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0)
+            {
+                close(fd);
+                fd= -1;
+            }
+        }
+        else
+        {
+            addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family= AF_UNSPEC;
+            hints.ai_socktype= SOCK_STREAM;
+
+            addrinfo *info= nullptr;
+            if(getaddrinfo(address.host.empty() ? "localhost" : address.host.c_str(), address.port.c_str(), &hints, &info) != 0)
+                info= nullptr;
+
+            for(addrinfo *p= info; p && fd < 0; p= p->ai_next)
+            {
+                fd= socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+                if(fd >= 0 && connect(fd, p->ai_addr, p->ai_addrlen) < 0)
+                {
+                    close(fd);
+                    fd= -1;
+                }
+            }
+
+            if(info)
+                freeaddrinfo(info);
+
+            if(fd >= 0)
+            {
+                // les messages sont envoyes des qu'ils sont complets
+                int on= 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+        }
+
+        if(fd >= 0)
+            return fd;
+
+        usleep(100000);
+    }
+
+    printf("[error] connecting to '%s'...\n", address.text.c_str());
+    return -1;
+}
+
+
+// processus de rendu : charge la scene et calcule les blocs demandes par le coordinateur, jusqu'a la fin.
+static int worker( const Address& address )
+{
+    int fd= connect_socket(address);
+    if(fd < 0)
+        return 1;
+
+    RenderScene scene;
+    RenderView view;
+    std::vector<char> data;
+    std::vector<float> rgb;
+    int tiles= 0;
+    float time= 0;
+
+    int code= 1;
+    for(;;)
+    {
+        int type;
+        if(!recv_message(fd, type, data))
+            break;      // le coordinateur a ferme la connexion
+
+        if(type == MESSAGE_QUIT)
+        {
+            code= 0;
+            break;
+        }
+
+        if(type == MESSAGE_SCENE)
+        {
+            if(data.size() < sizeof(SceneMessage))
+                break;
+
+            SceneMessage message;
+            memcpy(&message, data.data(), sizeof(message));
+            std::string filename(data.data() + sizeof(message), data.data() + data.size());
+
+            // ne recharge pas la scene si elle n'a pas change
+            if(scene.filename != filename && scene.load(filename.c_str()) < 0)
+                break;
+
+            view.width= message.width;
+            view.height= message.height;
+            view.samples= message.samples;
+            view.seed= message.seed;
+            memcpy(view.view.m, message.view, sizeof(message.view));
+            memcpy(view.projection.m, message.projection, sizeof(message.projection));
+
+            if(!send_message(fd, MESSAGE_READY))
+                break;
+        }
+
+        else if(type == MESSAGE_TILE)
+        {
+            if(data.size() != sizeof(TileMessage))
+                break;
+
+            TileMessage tile;
+            memcpy(&tile, data.data(), sizeof(tile));
+
+            auto start= std::chrono::high_resolution_clock::now();
+
+            rgb.resize(3 * (tile.xmax - tile.xmin) * (tile.ymax - tile.ymin));
+            render_tile(scene, view, tile.xmin, tile.ymin, tile.xmax, tile.ymax, rgb.data());
+
+            auto stop= std::chrono::high_resolution_clock::now();
+            time+= std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.f;
+            tiles++;
+
+            if(!send_message(fd, MESSAGE_RESULT, &tile, sizeof(tile), rgb.data(), rgb.size() * sizeof(float)))
+                break;
+        }
+    }
+
+    close(fd);
+    printf("worker %d: %d tiles, %.2fms\n", int(getpid()), tiles, time);
+    return code;
+}
+
+
+// processus de rendu connecte au coordinateur, et blocs en cours de calcul
+struct Connection
+{
+    int fd;
+    std::vector<int> tiles;
+    int done;
+    std::vector<char> buffer;   // message en cours de reception
+    std::chrono::steady_clock::time_point received;     // date des derniers octets recus
+};
+
+// nombre de blocs envoyes a l'avance a chaque processus, pour ne pas attendre entre 2 blocs
+const int tiles_in_flight= 2;
+
+// delai maximum entre 2 morceaux d'un message, en secondes, avant de deconnecter le processus
+const int stall_timeout= 10;
+
+
+static int coordinator( const char *program, const Address& address, const char *mesh_filename, const char *orbiter_filename, const int workers, const int samples, const int tile_size )
+{
+    Orbiter camera;
+    if(camera.read_orbiter(orbiter_filename))
+        // erreur, pas de camera
+        return 1;
+
+    SceneMessage scene;
+    scene.width= 1024;
+    scene.height= 640;
+    scene.samples= samples;
+    scene.seed= 1;
+    Transform view= camera.view();
+    Transform projection= camera.projection(scene.width, scene.height, 45);
+    memcpy(scene.view, view.m, sizeof(scene.view));
+    memcpy(scene.projection, projection.m, sizeof(scene.projection));
+
+    // decoupe l'image en blocs
+    std::vector<TileMessage> tiles;
+    for(int y= 0; y < scene.height; y+= tile_size)
+    for(int x= 0; x < scene.width; x+= tile_size)
+        tiles.push_back( { int32_t(tiles.size()), x, y, std::min(scene.width, x + tile_size), std::min(scene.height, y + tile_size) } );
+
+    std::deque<int> pending;
+    for(int i= 0; i < int(tiles.size()); i++)
+        pending.push_back(i);
+    std::vector<bool> finished(tiles.size(), false);
+    int done= 0;
+
+    int server= listen_socket(address);
+    if(server < 0)
+        return 1;
+
+    printf("coordinator '%s': %d tiles %dx%d, %d samples\n", address.text.c_str(), int(tiles.size()), tile_size, tile_size, samples);
+
+    auto start= std::chrono::high_resolution_clock::now();
+
+    // demarre les processus de rendu locaux
+    std::vector<pid_t> children;
+    for(int i= 0; i < workers; i++)
+    {
+        pid_t pid= fork();
+        if(pid == 0)
+        {
+            close(server);
+            execlp(program, program, "worker", address.text.c_str(), (char *) nullptr);
+            printf("[error] running '%s'...\n", program);
+            _exit(1);
+        }
+        if(pid > 0)
+            children.push_back(pid);
+    }
+
+    Image image(scene.width, scene.height);
+    std::vector<Connection> connections;
+    std::vector<char> data;
+
+    // envoie les blocs en attente a un processus
+    auto dispatch= [&]( Connection& connection ) {
+        while(int(connection.tiles.size()) < tiles_in_flight && !pending.empty())
+        {
+            int id= pending.front();
+            if(!send_message(connection.fd, MESSAGE_TILE, &tiles[id], sizeof(TileMessage)))
+                return false;
+
+            pending.pop_front();
+            connection.tiles.push_back(id);
+        }
+        return true;
+    };
+
+    // processus deconnecte, redistribue ses blocs
+    auto disconnect= [&]( Connection& connection ) {
+        for(int k= 0; k < int(connection.tiles.size()); k++)
+            pending.push_front(connection.tiles[k]);
+        connection.tiles.clear();
+
+        close(connection.fd);
+        connection.fd= -1;
+    };
+
+    int code= 0;
+    while(done < int(tiles.size()))
+    {
+        std::vector<pollfd> fds;
+        fds.push_back( { server, POLLIN, 0 } );
+        for(int i= 0; i < int(connections.size()); i++)
+            fds.push_back( { connections[i].fd, POLLIN, 0 } );
+
+        int n= poll(fds.data(), fds.size(), 1000);
+        if(n < 0 && errno != EINTR)
+            break;
+
+        if(n == 0 && connections.empty() && !children.empty())
+        {
+            // verifie que les processus locaux sont toujours la
+            int status;
+            while(!children.empty() && waitpid(-1, &status, WNOHANG) > 0)
+                children.pop_back();
+            if(children.empty())
+            {
+                printf("[error] no more workers...\n");
+                code= 1;
+                break;
+            }
+        }
+
+        if(n < 0)
+            continue;
+
+        // un processus bloque au milieu d'un message est deconnecte
+        auto now= std::chrono::steady_clock::now();
+        for(int i= 0; i < int(connections.size()); i++)
+            if(!connections[i].buffer.empty() && now - connections[i].received > std::chrono::seconds(stall_timeout))
+            {
+                printf("[error] worker stalled...\n");
+                disconnect(connections[i]);
+            }
+
+        // nouveau processus de rendu
+        if(fds[0].revents & POLLIN)
+        {
+            int fd= accept(server, nullptr, nullptr);
+            if(fd >= 0)
+            {
+                int on= 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+                if(send_message(fd, MESSAGE_SCENE, &scene, sizeof(scene), mesh_filename, strlen(mesh_filename)))
+                    connections.push_back( { fd, std::vector<int>(), 0, std::vector<char>(), std::chrono::steady_clock::now() } );
+                else
+                    close(fd);
+            }
+        }
+
+        for(int i= 0; i < int(connections.size()); i++)
+        {
+            Connection& connection= connections[i];
+            if(connection.fd < 0 || (fds[i +1].revents & (POLLIN | POLLHUP | POLLERR)) == 0)
+                continue;
+
+            // un processus lent ne bloque pas les autres : lit ce qui est disponible, et traite les messages complets
+            bool error= !recv_available(connection.fd, connection.buffer);
+            connection.received= now;
+            int type;
+            int status;
+            while(!error && (status= pop_message(connection.buffer, type, data)) != 0)
+            {
+                error= true;
+                if(status < 0)
+                    break;
+
+                if(type == MESSAGE_READY)
+                    error= !dispatch(connection);
+
+                else if(type == MESSAGE_RESULT && data.size() >= sizeof(TileMessage))
+                {
+                    TileMessage tile;
+                    memcpy(&tile, data.data(), sizeof(tile));
+
+                    int w= tile.xmax - tile.xmin;
+                    int h= tile.ymax - tile.ymin;
+                    auto it= std::find(connection.tiles.begin(), connection.tiles.end(), tile.id);
+                    if(it != connection.tiles.end() && data.size() == sizeof(TileMessage) + 3 * w * h * sizeof(float))
+                    {
+                        const float *rgb= (const float *) (data.data() + sizeof(TileMessage));
+                        for(int y= 0; y < h; y++)
+                        for(int x= 0; x < w; x++)
+                        {
+                            const float *pixel= rgb + 3 * (y * w + x);
+                            image(tile.xmin + x, tile.ymin + y)= Color(pixel[0], pixel[1], pixel[2]);
+                        }
+
+                        connection.tiles.erase(it);
+                        connection.done++;
+                        if(!finished[tile.id])
+                        {
+                            finished[tile.id]= true;
+                            done++;
+                        }
+
+                        error= !dispatch(connection);
+                    }
+                }
+            }
+
+            if(error)
+                disconnect(connection);
+        }
+
+        // les blocs redistribues sont envoyes aux processus restants
+        for(int i= 0; i < int(connections.size()); i++)
+            if(connections[i].fd >= 0 && !dispatch(connections[i]))
+                disconnect(connections[i]);
+
+        for(int i= 0; i < int(connections.size()); i++)
+            if(connections[i].fd < 0)
+            {
+                printf("worker disconnected, %d tiles\n", connections[i].done);
+                connections.erase(connections.begin() + i);
+                i--;
+            }
+    }
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    int time= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+
+    // termine les processus de rendu
+    for(int i= 0; i < int(connections.size()); i++)
+    {
+        printf("worker %d: %d tiles\n", i, connections[i].done);
+        send_message(connections[i].fd, MESSAGE_QUIT);
+        close(connections[i].fd);
+    }
+
+    for(int i= 0; i < int(children.size()); i++)
+        waitpid(children[i], nullptr, 0);
+
+    close(server);
+    if(address.local)
+        unlink(address.path.c_str());
+
+    if(code != 0)
+        return code;
+
+    printf("render %ds %03dms\n", int(time / 1000), int(time % 1000));
+    write_image_hdr(image, "farm.hdr");
+    return 0;
+}
+
+
+int main( const int argc, const char **argv )
+{
+    // une ecriture sur une connexion fermee renvoie une erreur, au lieu de terminer le processus
+    signal(SIGPIPE, SIG_IGN);
+
+    if(argc > 2 && strcmp(argv[1], "worker") == 0)
+        return worker(Address(argv[2]));
+
+    if(argc > 2 && strcmp(argv[1], "coordinator") == 0)
+    {
+        const char *mesh_filename= "data/cornell.obj";
+        const char *orbiter_filename= "data/cornell_orbiter.txt";
+        if(argc > 3) mesh_filename= argv[3];
+        if(argc > 4) orbiter_filename= argv[4];
+
+        int workers= 0;
+        if(argc > 5) workers= std::max(0, atoi(argv[5]));
+        int samples= 16;
+        if(argc > 6) samples= std::max(1, atoi(argv[6]));
+        int tile= 32;
+        if(argc > 7) tile= std::max(1, atoi(argv[7]));
+
+        return coordinator(argv[0], Address(argv[2]), mesh_filename, orbiter_filename, workers, samples, tile);
+    }
+
+    printf("usage: %s coordinator <address> [mesh] [orbiter] [workers] [samples] [tile]\n", argv[0]);
+    printf("       %s worker <address>\n", argv[0]);
+    printf("  address: unix:/tmp/rt_farm.sock, host:port or port\n");
+    return 1;
+}
+
+#else
+
+int main( const int argc, const char **argv )
+{
+    printf("%s: posix sockets only...\n", argv[0]);
+    return 1;
+}
+
+#endif
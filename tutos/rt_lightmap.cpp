@@ -0,0 +1,67 @@
+//! \file rt_lightmap.cpp pre-calcul de l'eclairage d'un objet dans une lightmap, a afficher avec tuto9_texture1.
+
+/*  utilisation :
+        rt_lightmap [mesh] [resolution] [samples] [indirect]
+
+    ecrit lightmap.hdr, en valeurs lineaires, lightmap.png, corrigee (gamma 2.2), et lightmap.obj, l'objet avec les coordonnees de texture de la lightmap.
+    [samples] est le nombre d'echantillons par source et par texel, [indirect] le nombre de directions par texel pour l'eclairage indirect, 0 par defaut.
+    pour afficher le resultat :
+        tuto9_texture1 lightmap.obj lightmap.png
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+
+#include "mesh.h"
+#include "wavefront.h"
+#include "image.h"
+#include "image_io.h"
+#include "image_hdr.h"
+
+#include "bvh.h"
+#include "sources.h"
+#include "texture_cache.h"
+#include "lightmap.h"
+
+
+int main( const int argc, const char **argv )
+{
+    const char *mesh_filename= "data/cornell.obj";
+    if(argc > 1) mesh_filename= argv[1];
+
+    LightmapParams params;
+    if(argc > 2) params.resolution= std::max(16, atoi(argv[2]));
+    if(argc > 3) params.samples= std::max(1, atoi(argv[3]));
+    if(argc > 4) params.indirect= std::max(0, atoi(argv[4]));
+
+    Mesh mesh= read_mesh(mesh_filename);
+    if(mesh.triangle_count() == 0)
+        // erreur de chargement, pas de triangles
+        return 1;
+
+    BVH bvh(mesh);
+    printf("%d triangles\n", mesh.triangle_count());
+    Sources sources(mesh);
+    TextureCache textures(mesh.materials());
+
+    auto start= std::chrono::high_resolution_clock::now();
+
+    LightmapStats stats;
+    Image lightmap= bake_lightmap(mesh, bvh, sources, &textures, params, &stats);
+    if(lightmap.size() == 0)
+        // erreur, les cartes ne tiennent pas dans la lightmap
+        return 1;
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    int cpu_time= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+    printf("bake %ds %03dms\n", int(cpu_time / 1000), int(cpu_time % 1000));
+    printf("lightmap: %d charts, %.2f texels per unit\n", stats.charts, stats.scale);
+    printf("lightmap: %dx%d texels, %.1f%% covered\n", params.resolution, params.resolution, 100.f * stats.coverage);
+
+    write_image_hdr(lightmap, "lightmap.hdr");
+    write_image(gamma_correct(lightmap), "lightmap.png");
+    write_mesh(mesh, "lightmap.obj");
+    return 0;
+}
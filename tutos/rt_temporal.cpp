@@ -0,0 +1,129 @@
+//! \file rt_temporal.cpp rendu d'une animation, camera en orbite ou sequence d'objets, avec accumulation temporelle des echantillons.
+
+/*  utilisation :
+        rt_temporal [mesh] [orbiter] [images] [samples] [rotation]
+
+    mesh peut etre un modele de nom de fichier, "data/Robot/Robot_%06d.obj" charge un objet different pour chaque image, en commencant par 1.
+    la camera tourne de [rotation] degres autour de l'objet entre 2 images, 0 pour une camera fixe.
+    chaque image utilise [samples] echantillons par source et par pixel, et reutilise les echantillons des images precedentes, cf temporal_accumulate().
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <chrono>
+
+#include "orbiter.h"
+#include "image.h"
+#include "image_io.h"
+
+#include "render_tile.h"
+#include "temporal.h"
+
+
+// compte les conversions d'un modele de nom de fichier, "data/Robot/Robot_%06d.obj", par exemple.
+// seules les conversions d'entiers, %d, %i ou %u, avec drapeaux et largeur, et %% sont acceptees, renvoie -1 pour les autres.
+static int pattern_conversions( const char *pattern )
+{
+    int count= 0;
+    for(const char *c= strchr(pattern, '%'); c != nullptr; c= strchr(c, '%'))
+    {
+        c++;
+        if(*c == '%')
+        {
+            c++;
+            continue;
+        }
+
+        while(*c && strchr("-+ #0", *c))
+            c++;
+        while(*c >= '0' && *c <= '9')
+            c++;
+        if(*c != 'd' && *c != 'i' && *c != 'u')
+            return -1;
+
+        count++;
+    }
+
+    return count;
+}
+
+
+int main( const int argc, const char **argv )
+{
+    const char *mesh_filename= "data/cornell.obj";
+    const char *orbiter_filename= "data/cornell_orbiter.txt";
+    if(argc > 1) mesh_filename= argv[1];
+    if(argc > 2) orbiter_filename= argv[2];
+
+    int frames= 30;
+    if(argc > 3) frames= std::max(1, atoi(argv[3]));
+    int samples= 1;
+    if(argc > 4) samples= std::max(1, atoi(argv[4]));
+    float rotation= 1;
+    if(argc > 5) rotation= atof(argv[5]);
+
+    // sequence d'objets ? le modele utilise une seule conversion, le numero de l'image
+    int conversions= pattern_conversions(mesh_filename);
+    if(conversions < 0 || conversions > 1)
+    {
+        printf("[error] mesh sequence '%s': expected a single %%d conversion...\n", mesh_filename);
+        return 1;
+    }
+    bool sequence= (conversions == 1);
+
+    Orbiter camera;
+    if(camera.read_orbiter(orbiter_filename))
+        // erreur, pas de camera
+        return 1;
+
+    const int width= 1024;
+    const int height= 640;
+
+    RenderScene scene;
+    TemporalHistory history;
+    TemporalParams params;
+
+    for(int frame= 0; frame < frames; frame++)
+    {
+        if(sequence || frame == 0)
+        {
+            // le modele est verifie, cf pattern_conversions()
+            char filename[1024];
+            snprintf(filename, sizeof(filename), mesh_filename, frame +1);
+            if(scene.load(filename) < 0)
+                // fin de la sequence, ou erreur
+                break;
+        }
+
+        Transform view= camera.view();
+        Transform projection= camera.projection(width, height, 45);
+        RenderView render(view, projection, width, height, samples, unsigned(frame));
+
+        auto start= std::chrono::high_resolution_clock::now();
+
+        Image positions;
+        Image normals;
+        Image color= render_image(scene, render, positions, normals);
+
+        float render_time= elapsed(start);
+        start= std::chrono::high_resolution_clock::now();
+
+        TemporalStats stats;
+        Image accumulated= temporal_accumulate(history, color, positions, normals, view, projection, params, &stats);
+
+        float accumulate_time= elapsed(start);
+        printf("frame %d: render %.2fms, accumulate %.2fms, %.1f%% pixels reused, %.2f frames per pixel, %.2f samples per source\n",
+            frame, render_time, accumulate_time, stats.pixels ? 100.f * stats.reused / stats.pixels : 0.f, stats.history, stats.history * samples);
+
+        char filename[1024];
+        sprintf(filename, "temporal_%03d.png", frame);
+        write_image(gamma_correct(accumulated), filename);
+
+        // image suivante
+        camera.rotation(rotation, 0);
+    }
+
+    return 0;
+}
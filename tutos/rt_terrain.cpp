@@ -0,0 +1,113 @@
+//! \file rt_terrain.cpp lancer de rayons sur un terrain, carte d'altitude + pyramide min / max, sans triangles.
+
+/*  utilisation :
+        rt_terrain [heightmap] [texture] [altitude]
+
+    le terrain occupe un carre de cote 2, [altitude] est l'altitude maximale, 0.25 par defaut.
+    eclairage direct par un soleil, avec ombres, et un ciel uniforme. ecrit terrain.png.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+
+#include "orbiter.h"
+#include "image.h"
+#include "image_io.h"
+
+#include "sources.h"
+#include "heightfield.h"
+
+
+int main( const int argc, const char **argv )
+{
+    const char *heightmap_filename= "data/terrain/terrain.png";
+    const char *texture_filename= "data/terrain/terrain_texture.png";
+    float altitude= 0.25f;
+    if(argc > 1) heightmap_filename= argv[1];
+    if(argc > 2) texture_filename= argv[2];
+    if(argc > 3) altitude= atof(argv[3]);
+
+    Image heightmap= read_image(heightmap_filename);
+    if(heightmap.size() == 0)
+        // erreur de chargement
+        return 1;
+    // texture srgb, convertie en valeurs lineaires pour les calculs d'eclairage
+    Image texture= linear_image(read_image(texture_filename));
+
+    // conserve les proportions de la carte
+    float aspect= float(heightmap.height()) / float(heightmap.width());
+    Heightfield terrain(heightmap, Point(-1, 0, -aspect), Point(1, altitude, aspect));
+    if(terrain.width() == 0)
+        // erreur, carte d'altitude trop petite
+        return 1;
+
+    printf("heightfield: %dx%d samples, %d levels, %.2f floats per sample\n", terrain.width(), terrain.height(), terrain.levels(),
+        float(terrain.memory()) / float(sizeof(float) * terrain.width() * terrain.height()));
+
+    Point pmin, pmax;
+    terrain.bounds(pmin, pmax);
+    Orbiter camera;
+    camera.lookat(pmin, pmax);
+    camera.rotation(30, 35);
+
+    Image image(1024, 640);
+    Transform view= camera.view();
+    Transform projection= camera.projection(image.width(), image.height(), 45);
+    Transform inv= Inverse(Viewport(image.width(), image.height()) * projection * view);
+
+    // soleil et ciel
+    const Vector sun= normalize(Vector(1, 1.2f, 0.6f));
+    const Color sun_color= Color(2.5f, 2.3f, 2.f);
+    const Color sky= Color(0.35f, 0.45f, 0.6f);
+
+    HeightfieldStats stats;
+    auto start= std::chrono::high_resolution_clock::now();
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int py= 0; py < image.height(); py++)
+    {
+        HeightfieldStats line;
+        for(int px= 0; px < image.width(); px++)
+        {
+            Point o= inv(Point(px + 0.5f, py + 0.5f, 0));
+            Point e= inv(Point(px + 0.5f, py + 0.5f, 1));
+            Ray ray(o, e);
+
+            Color color= sky;
+            if(Hit hit= terrain.intersect(ray, &line))
+            {
+                Point p= point(hit, ray);
+                Vector n= terrain.normal(hit);
+
+                Color albedo= Color(0.6f);
+                if(texture.size())
+                {
+                    vec2 uv= terrain.texcoord(p);
+                    albedo= texture.texture(uv.x, uv.y);
+                }
+
+                color= albedo * sky * (0.5f + 0.5f * n.y);
+                float cos_theta= dot(n, sun);
+                if(cos_theta > 0 && terrain.visible(Ray(p + 0.0001f * n, sun), &line))
+                    color= color + albedo * sun_color * cos_theta;
+            }
+
+            image(px, py)= color;
+        }
+
+    #pragma omp critical
+        stats+= line;
+    }
+
+    auto stop= std::chrono::high_resolution_clock::now();
+    int cpu_time= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+    printf("cpu  %ds %03dms\n", int(cpu_time / 1000), int(cpu_time % 1000));
+    printf("%ld rays, %.1f nodes, %.1f cells per ray\n", stats.rays, float(stats.nodes) / stats.rays, float(stats.cells) / stats.rays);
+    printf("terrain %dKB, %d triangles would use %dKB\n", int(terrain.memory() / 1024),
+        2 * (terrain.width() -1) * (terrain.height() -1), int(2 * (terrain.width() -1) * (terrain.height() -1) * sizeof(Triangle) / 1024));
+
+    write_image(gamma_correct(image), "terrain.png");
+    return 0;
+}
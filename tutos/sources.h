@@ -0,0 +1,209 @@
+//! \file sources.h sources de lumiere et utilitaires partages par les tutos de lancer de rayons.
+
+#ifndef _SOURCES_H
+#define _SOURCES_H
+
+#include <cmath>
+#include <cstdio>
+#include <cassert>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+
+#include "vec.h"
+#include "color.h"
+#include "mesh.h"
+#include "image.h"
+
+
+//! source de lumiere, triangle emissif.
+struct Source
+{
+    Point a, b, c;
+    Color emission;
+    Vector n;
+    float area;
+
+    Source( ) : a(), b(), c(), emission(), n(), area() {}
+
+    Source( const TriangleData& data, const Color& color ) : a(data.a), b(data.b), c(data.c), emission(color)
+    {
+       // normale geometrique du triangle abc, produit vectoriel des aretes ab et ac
+        Vector ng= cross(Vector(a, b), Vector(a, c));
+        n= normalize(ng);
+        area= length(ng) / 2;
+    }
+
+    Point sample( const float u1, const float u2 ) const
+    {
+        // cf GI compemdium eq 18
+        float r1= std::sqrt(u1);
+        float alpha= 1 - r1;
+        float beta= (1 - u2) * r1;
+        float gamma= u2 * r1;
+        return alpha*a + beta*b + gamma*c;
+    }
+
+    float pdf( const Point& p ) const
+    {
+        // todo : devrait renvoyer 0 pour les points a l'exterieur du triangle...
+        return 1.f / area;
+    }
+};
+
+
+//! ensemble de sources de lumiere, les triangles emissifs d'un mesh.
+struct Sources
+{
+    std::vector<Source> sources;
+    std::vector<float> cdf;     // fonction de repartition de l'emission des sources, aire * puissance
+    float emission;     // emission totale des sources
+    float area;         // aire totale des sources
+
+    Sources( ) : sources(), cdf(), emission(0), area(0) {}
+
+    Sources( const Mesh& mesh ) : sources(), cdf()
+    {
+        build(mesh);
+
+        printf("%d sources\n", int(sources.size()));
+        assert(sources.size());
+    }
+
+    void build( const Mesh& mesh )
+    {
+        area= 0;
+        emission= 0;
+        sources.clear();
+        cdf.clear();
+        for(int id= 0; id < mesh.triangle_count(); id++)
+        {
+            const TriangleData& data= mesh.triangle(id);
+            const Material& material= mesh.triangle_material(id);
+            if(material.emission.power() > 0)
+            {
+                Source source(data, material.emission);
+                emission= (emission + source.area * source.emission.power());
+                area= area + source.area;
+
+                sources.push_back(source);
+                cdf.push_back(emission);
+            }
+        }
+    }
+
+    int size( ) const { return int(sources.size()); }
+    const Source& operator() ( const int id ) const { return sources[id]; }
+
+    /*! emission d'un chemin parmi count : choisit une source proportionnellement a son emission, un point sur la source et une direction distribuee selon cos theta / pi.
+        renvoie l'origine o et la direction d du rayon, et le flux transporte par le chemin. renvoie false si les sources n'emettent pas de lumiere.
+     */
+    bool sample_emission( const int count, std::default_random_engine& rng, std::uniform_real_distribution<float>& u01, Point& o, Vector& d, Color& flux ) const;
+};
+
+
+// utilitaires
+// construit un repere ortho tbn, a partir d'un seul vecteur, la normale d'un point d'intersection, par exemple.
+// permet de transformer un vecteur / une direction dans le repere du monde.
+
+// cf "generating a consistently oriented tangent space"
+// http://people.compute.dtu.dk/jerf/papers/abstracts/onb.html
+// cf "Building an Orthonormal Basis, Revisited", Pixar, 2017
+// http://jcgt.org/published/0006/01/01/
+struct World
+{
+    World( const Vector& _n ) : n(_n)
+    {
+        float sign= std::copysign(1.0f, n.z);
+        float a= -1.0f / (sign + n.z);
+        float d= n.x * n.y * a;
+        t= Vector(1.0f + sign * n.x * n.x * a, sign * d, -sign * n.x);
+        b= Vector(d, sign + n.y * n.y * a, -n.y);
+    }
+
+    // transforme le vecteur du repere local vers le repere du monde
+    Vector operator( ) ( const Vector& local )  const { return local.x * t + local.y * b + local.z * n; }
+
+    // transforme le vecteur du repere du monde vers le repere local
+    Vector inverse( const Vector& global ) const { return Vector(dot(global, t), dot(global, b), dot(global, n)); }
+
+    Vector t;
+    Vector b;
+    Vector n;
+};
+
+//! genere une direction distribuee selon cos theta / pi, dans le repere local de la normale (0, 0, 1).
+inline Vector sample_cosine( const float u1, const float u2 )
+{
+    // cf GI compemdium eq 35
+    float phi= float(2 * M_PI) * u1;
+    float cos_theta= std::sqrt(u2);
+    float sin_theta= std::sqrt(1 - cos_theta * cos_theta);
+    return Vector(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta, cos_theta);
+}
+
+//! renvoie la densite de proba de la direction generee par sample_cosine().
+inline float pdf_cosine( const Vector& w ) { return std::max(0.f, w.z) / float(M_PI); }
+
+inline bool Sources::sample_emission( const int count, std::default_random_engine& rng, std::uniform_real_distribution<float>& u01, Point& o, Vector& d, Color& flux ) const
+{
+    if(sources.empty() || emission <= 0)
+        return false;
+
+    int si= int(std::upper_bound(cdf.begin(), cdf.end(), u01(rng) * emission) - cdf.begin());
+    si= std::min(si, size() -1);
+    const Source& source= sources[si];
+
+    Point s= source.sample(u01(rng), u01(rng));
+    o= s + 0.00001f * source.n;
+    d= World(source.n)(sample_cosine(u01(rng), u01(rng)));
+
+    // flux transporte par le chemin : emission * cos / (pdf source * pdf point * pdf direction * count), les cos se simplifient
+    flux= source.emission * (float(M_PI) * emission / (source.emission.power() * count));
+    return true;
+}
+
+//! initialisation du generateur de nombres aleatoires du pixel / texel (x, y), ou du chemin x, cf "hash functions for gpu rendering", Jarzynski 2020.
+inline unsigned hash_seed( const unsigned seed, const int x, const int y= 0 )
+{
+    unsigned v= seed * 0x9E3779B9u + unsigned(y) * 0x85EBCA6Bu + unsigned(x);
+    v= v * 747796405u + 2891336453u;
+    v= ((v >> ((v >> 28u) + 4u)) ^ v) * 277803737u;
+    return (v >> 22u) ^ v;
+}
+
+//! correction gamma, les calculs d'eclairage sont faits en valeurs lineaires.
+inline Image gamma_correct( const Image& image, const float gamma= 2.2f )
+{
+    Image tmp(image.width(), image.height());
+    for(int i= 0; i < int(image.size()); i++)
+    {
+        Color color= image(size_t(i));
+        tmp(size_t(i))= Color(std::pow(color.r, 1 / gamma), std::pow(color.g, 1 / gamma), std::pow(color.b, 1 / gamma));
+    }
+
+    return tmp;
+}
+
+//! conversion inverse de gamma_correct(), pour utiliser une image srgb, une texture de couleur par exemple, dans les calculs d'eclairage.
+inline Image linear_image( const Image& image, const float gamma= 2.2f )
+{
+    Image tmp(image.width(), image.height());
+    for(int i= 0; i < int(image.size()); i++)
+    {
+        Color color= image(size_t(i));
+        tmp(size_t(i))= Color(std::pow(color.r, gamma), std::pow(color.g, gamma), std::pow(color.b, gamma), color.a);
+    }
+
+    return tmp;
+}
+
+//! renvoie le temps d'execution depuis start, en millisecondes.
+inline float elapsed( const std::chrono::high_resolution_clock::time_point& start )
+{
+    auto stop= std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count() / 1000.f;
+}
+
+#endif
@@ -0,0 +1,135 @@
+//! \file temporal.cpp
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "temporal.h"
+
+
+Image temporal_accumulate( TemporalHistory& history, const Image& color, const Image& positions, const Image& normals,
+    const Transform& view, const Transform& projection, const TemporalParams& params, TemporalStats *stats )
+{
+    const int width= color.width();
+    const int height= color.height();
+    assert(positions.width() == width && positions.height() == height);
+    assert(normals.width() == width && normals.height() == height);
+
+    // l'historique n'est utilisable que pour une image de meme taille
+    bool valid= !history.empty() && history.color.width() == width && history.color.height() == height;
+
+    // position des cameras, pour comparer les distances
+    Point camera= Inverse(view)(Point(0, 0, 0));
+    Point previous_camera= Inverse(history.view)(Point(0, 0, 0));
+    // passage repere du monde vers l'image precedente
+    Transform previous= Viewport(width, height) * history.projection * history.view;
+
+    TemporalHistory next;
+    next.color= Image(width, height);
+    next.depth.assign(width * height, 0);
+    next.normal.assign(width * height, Vector());
+    next.count.assign(width * height, 0);
+    next.view= view;
+    next.projection= projection;
+
+    int pixels= 0;
+    int reused= 0;
+    double sum= 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+: pixels, reused, sum)
+    for(int py= 0; py < height; py++)
+    for(int px= 0; px < width; px++)
+    {
+        const int i= py * width + px;
+        const Color& sample= color(size_t(i));
+
+        Color n= normals(size_t(i));
+        Vector pn= Vector(n.r, n.g, n.b);
+        if(pn.x == 0 && pn.y == 0 && pn.z == 0)
+        {
+            // pas d'intersection, pas d'historique
+            next.color(size_t(i))= sample;
+            continue;
+        }
+
+        Color position= positions(size_t(i));
+        Point p= Point(position.r, position.g, position.b);
+        pixels++;
+
+        // reprojette le point dans l'image precedente, et interpole les pixels voisins qui representent le meme point
+        Color previous_color;
+        float previous_count= 0;
+        if(valid)
+        {
+            vec4 h= previous(vec4(p.x, p.y, p.z, 1));
+            float expected= distance(previous_camera, p);
+            if(h.w > 0)
+            {
+                float x= h.x / h.w - 0.5f;
+                float y= h.y / h.w - 0.5f;
+                float fx= std::floor(x);
+                float fy= std::floor(y);
+                int x0= int(fx);
+                int y0= int(fy);
+                float a= x - fx;
+                float b= y - fy;
+
+                float weights[4]= { (1 - a) * (1 - b), a * (1 - b), (1 - a) * b, a * b };
+                int offsets[4][2]= { {0, 0}, {1, 0}, {0, 1}, {1, 1} };
+
+                Color sum_color= Color(0, 0, 0, 0);
+                float sum_count= 0;
+                float sum_w= 0;
+                for(int k= 0; k < 4; k++)
+                {
+                    int qx= x0 + offsets[k][0];
+                    int qy= y0 + offsets[k][1];
+                    if(qx < 0 || qy < 0 || qx >= width || qy >= height)
+                        continue;
+
+                    int q= qy * width + qx;
+                    float depth= history.depth[q];
+                    if(depth <= 0 || std::abs(depth - expected) > params.depth_tolerance * expected)
+                        continue;
+                    if(dot(history.normal[q], pn) < params.normal_tolerance)
+                        continue;
+
+                    sum_color= sum_color + history.color(size_t(q)) * weights[k];
+                    sum_count+= history.count[q] * weights[k];
+                    sum_w+= weights[k];
+                }
+
+                // ignore les historiques reconstruits a partir d'une trop petite partie des voisins
+                if(sum_w > 0.1f)
+                {
+                    previous_color= sum_color / sum_w;
+                    previous_count= sum_count / sum_w;
+                }
+            }
+        }
+
+        // moyenne des images accumulees, puis moyenne glissante sur les max_history dernieres images
+        float count= std::min(previous_count + 1, float(std::max(1, params.max_history)));
+        Color accumulated= sample;
+        if(previous_count > 0)
+        {
+            accumulated= previous_color + (sample - previous_color) / count;
+            reused++;
+        }
+
+        next.color(size_t(i))= Color(accumulated, 1);
+        next.depth[i]= distance(camera, p);
+        next.normal[i]= pn;
+        next.count[i]= count;
+        sum+= count;
+    }
+
+    if(stats)
+    {
+        stats->pixels= pixels;
+        stats->reused= reused;
+        stats->history= pixels ? float(sum / pixels) : 0;
+    }
+
+    history= next;
+    return history.color;
+}
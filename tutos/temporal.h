@@ -0,0 +1,64 @@
+//! \file temporal.h accumulation temporelle : reutilise les echantillons des images precedentes d'une animation, par reprojection.
+
+#ifndef _TEMPORAL_H
+#define _TEMPORAL_H
+
+#include <vector>
+
+#include "vec.h"
+#include "mat.h"
+#include "image.h"
+
+
+//! parametres de l'accumulation.
+struct TemporalParams
+{
+    float depth_tolerance;      //!< ecart relatif accepte entre la distance a la camera du point et celle de l'historique
+    float normal_tolerance;     //!< cos minimum de l'angle entre la normale du point et celle de l'historique
+    int max_history;            //!< nombre maximum d'images accumulees, limite le temps de reaction aux changements d'eclairage
+
+    TemporalParams( ) : depth_tolerance(0.02f), normal_tolerance(0.9f), max_history(32) {}
+};
+
+//! historique : image accumulee et point visible de chaque pixel dans l'image precedente.
+struct TemporalHistory
+{
+    Image color;                    //!< couleurs accumulees
+    std::vector<float> depth;       //!< distance entre la camera et le point visible, 0 pour les pixels sans intersection
+    std::vector<Vector> normal;     //!< normale du point visible
+    std::vector<float> count;       //!< nombre d'images accumulees, interpole par la reprojection
+    Transform view;                 //!< camera de l'image precedente
+    Transform projection;
+
+    TemporalHistory( ) : color(), depth(), normal(), count(), view(), projection() {}
+
+    //! renvoie vrai si l'historique est vide, pour la premiere image d'une sequence.
+    bool empty( ) const { return depth.empty(); }
+    //! vide l'historique, apres un changement de scene, par exemple.
+    void clear( ) { *this= TemporalHistory(); }
+};
+
+//! statistiques de la derniere image.
+struct TemporalStats
+{
+    int pixels;             //!< pixels avec une intersection
+    int reused;             //!< pixels qui reutilisent l'historique
+    float history;          //!< nombre moyen d'images accumulees par pixel
+
+    TemporalStats( ) : pixels(0), reused(0), history(0) {}
+};
+
+/*! accumule l'image courante avec l'historique.
+    le point visible de chaque pixel est reprojete dans l'image precedente avec les transformations view et projection de l'historique,
+    les 4 pixels voisins sont interpoles s'ils representent le meme point : meme distance a la camera precedente et meme orientation,
+    cf params.depth_tolerance et params.normal_tolerance. sinon, le point n'etait pas visible dans l'image precedente, ou il s'est deplace,
+    et l'historique du pixel est abandonne.
+
+    color contient les echantillons de l'image courante, positions et normals decrivent le point visible de chaque pixel, normale nulle pour les pixels
+    sans intersection, cf render_image(). view et projection sont les transformations de la camera de l'image courante.
+    renvoie l'image accumulee et met a jour l'historique.
+ */
+Image temporal_accumulate( TemporalHistory& history, const Image& color, const Image& positions, const Image& normals,
+    const Transform& view, const Transform& projection, const TemporalParams& params= TemporalParams(), TemporalStats *stats= nullptr );
+
+#endif
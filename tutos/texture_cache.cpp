@@ -0,0 +1,347 @@
+//! \file texture_cache.cpp
+
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+#include "image_io.h"
+#include "texture_cache.h"
+
+
+// gamma des textures srgb, le meme que gamma_correct() des tutos
+static const float texture_gamma= 2.2f;
+
+// tables de conversion texel 8 bits vers valeur lineaire
+static const float *decode_table( const bool srgb )
+{
+    struct Tables
+    {
+        float linear[256];
+        float srgb[256];
+
+        Tables( )
+        {
+            for(int i= 0; i < 256; i++)
+            {
+                linear[i]= float(i) / 255;
+                srgb[i]= std::pow(float(i) / 255, texture_gamma);
+            }
+        }
+    };
+
+    static const Tables tables;
+    return srgb ? tables.srgb : tables.linear;
+}
+
+static unsigned char encode( const float v, const bool srgb )
+{
+    float x= std::min(1.f, std::max(0.f, v));
+    if(srgb)
+        x= std::pow(x, 1 / texture_gamma);
+    return (unsigned char) (x * 255 + 0.5f);
+}
+
+TextureLevel::TextureLevel( const Image& image, const bool srgb ) : texels(), decode(decode_table(srgb)),
+    width(image.width()), height(image.height()), tiles_x((image.width() + 7) / 8)
+{
+    int tiles_y= (height + 7) / 8;
+    texels.resize(tiles_x * tiles_y * 64);
+
+    for(int y= 0; y < height; y++)
+    for(int x= 0; x < width; x++)
+    {
+        Color color= image(x, y);
+        Texel& t= texels[((y >> 3) * tiles_x + (x >> 3)) * 64 + (y & 7) * 8 + (x & 7)];
+        t.r= encode(color.r, srgb);
+        t.g= encode(color.g, srgb);
+        t.b= encode(color.b, srgb);
+        t.a= encode(color.a, false);
+    }
+}
+
+
+// niveau suivant, filtre boite 2x2
+static Image downsample( const Image& image )
+{
+    int w= std::max(1, image.width() / 2);
+    int h= std::max(1, image.height() / 2);
+
+    Image tmp(w, h);
+    for(int y= 0; y < h; y++)
+    for(int x= 0; x < w; x++)
+        // Image::operator() limite les coordonnees aux bords de l'image, pour les dimensions impaires ou egales a 1
+        tmp(x, y)= (image(2*x, 2*y) + image(2*x +1, 2*y) + image(2*x, 2*y +1) + image(2*x +1, 2*y +1)) * 0.25f;
+
+    return tmp;
+}
+
+
+TextureCache::TextureCache( const Materials& materials, const size_t budget ) : m_textures(materials.filename_count()), m_entries(), m_lru(), m_lock(),
+    m_id(0), m_budget(budget), m_memory(0), m_peak(0), m_hits(0), m_misses(0), m_loads(0), m_evictions(0)
+{
+    static std::atomic<long int> ids(0);
+    m_id= ++ids;
+
+    for(int i= 0; i < materials.filename_count(); i++)
+        m_textures[i].filename= materials.filename(i);
+
+    // les textures diffuses sont des couleurs, en srgb
+    for(int i= 0; i < materials.count(); i++)
+    {
+        int id= materials.material(i).diffuse_texture;
+        if(id >= 0 && id < count())
+            m_textures[id].srgb= true;
+    }
+}
+
+
+bool TextureCache::info( const int texture, int& width, int& height, int& levels )
+{
+    const Texture& info= m_textures[texture];
+    if(info.levels.load(std::memory_order_acquire) == 0 && !info.error)
+        // premiere utilisation, charge tous les niveaux
+        load(texture, 0);
+
+    levels= info.levels.load(std::memory_order_acquire);
+    if(levels == 0)
+        return false;
+
+    // width et height ne sont plus modifies une fois levels initialise
+    width= info.width;
+    height= info.height;
+    return true;
+}
+
+
+// cache local de chaque thread, quelques niveaux, sans verrou
+static const int local_size= 16;
+
+struct LocalCache
+{
+    long int owner;         // identifiant du TextureCache
+    long int hits;          // pas encore comptes dans TextureCache::m_hits
+    long int keys[local_size];
+    std::shared_ptr<const TextureLevel> levels[local_size];
+
+    LocalCache( ) : owner(0), hits(0), keys(), levels() {}
+};
+
+const TextureLevel *TextureCache::local_level( const int texture, const int level )
+{
+    static thread_local LocalCache local;
+    if(local.owner != m_id)
+    {
+        // le thread utilise un autre cache
+        local= LocalCache();
+        local.owner= m_id;
+    }
+
+    // 2 niveaux consecutifs de la meme texture n'utilisent jamais la meme entree
+    long int k= key(texture, level);
+    int slot= (texture * 7 + level) & (local_size -1);
+    if(local.keys[slot] == k && local.levels[slot] != nullptr)
+    {
+        // regroupe les compteurs, un increment atomique par acces serait aussi lent qu'un verrou
+        if(++local.hits == 1024)
+        {
+            m_hits.fetch_add(local.hits, std::memory_order_relaxed);
+            local.hits= 0;
+        }
+        return local.levels[slot].get();
+    }
+
+    local.keys[slot]= k;
+    local.levels[slot]= this->level(texture, level);
+    return local.levels[slot].get();
+}
+
+
+std::shared_ptr<const TextureLevel> TextureCache::level( const int texture, const int level )
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        auto it= m_entries.find(key(texture, level));
+        if(it != m_entries.end())
+        {
+            // deplace le niveau en tete de la liste lru
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second.level;
+        }
+
+        m_misses++;
+    }
+
+    // le fichier est relu sans bloquer les autres threads
+    return load(texture, level);
+}
+
+
+std::shared_ptr<const TextureLevel> TextureCache::load( const int texture, const int level )
+{
+    // filename et srgb ne sont pas modifies apres la construction du cache
+    const std::string& filename= m_textures[texture].filename;
+    const bool srgb= m_textures[texture].srgb;
+
+    Image image= read_image(filename.c_str());
+    if(image == Image::error() || image.size() == 0)
+    {
+        if(!m_textures[texture].error.exchange(true))
+            printf("[error] texture '%s'...\n", filename.c_str());
+        return nullptr;
+    }
+
+    // convertit les couleurs en valeurs lineaires, les mipmaps sont filtrees en lineaire
+    if(srgb)
+    {
+        for(size_t i= 0; i < image.size(); i++)
+        {
+            Color& color= image(i);
+            color= Color(std::pow(color.r, texture_gamma), std::pow(color.g, texture_gamma), std::pow(color.b, texture_gamma), color.a);
+        }
+    }
+
+    int width= image.width();
+    int height= image.height();
+    int levels= 1;
+    while((width >> (levels -1)) > 1 || (height >> (levels -1)) > 1)
+        levels++;
+
+    // construit les niveaux [level .. levels)
+    std::vector< std::shared_ptr<const TextureLevel> > chain;
+    for(int i= 0; i < levels; i++)
+    {
+        if(i >= level)
+            chain.push_back( std::make_shared<const TextureLevel>(image, srgb) );
+        if(i +1 < levels)
+            image= downsample(image);
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if(m_textures[texture].levels.load(std::memory_order_relaxed) == 0)
+    {
+        // publie les dimensions, une seule fois, info() les lit sans verrou
+        m_textures[texture].width= width;
+        m_textures[texture].height= height;
+        m_textures[texture].levels.store(levels, std::memory_order_release);
+    }
+    m_loads++;
+
+    // insere les niveaux absents du cache, un autre thread a pu charger la meme texture
+    for(int i= int(chain.size()) -1; i >= 0; i--)
+    {
+        long int k= key(texture, level + i);
+        auto it= m_entries.find(k);
+        if(it != m_entries.end())
+        {
+            chain[i]= it->second.level;
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+            continue;
+        }
+
+        m_lru.push_front(k);
+        m_entries[k]= { chain[i], m_lru.begin() };
+        m_memory+= chain[i]->memory();
+    }
+    m_peak= std::max(m_peak, m_memory);
+
+    evict();
+    // le niveau demande est conserve par le shared_ptr, meme s'il vient d'etre evince
+    return chain.front();
+}
+
+
+void TextureCache::evict( )
+{
+    // conserve au moins le dernier niveau insere
+    while(m_memory > m_budget && m_lru.size() > 1)
+    {
+        long int k= m_lru.back();
+        m_lru.pop_back();
+
+        auto it= m_entries.find(k);
+        m_memory-= it->second.level->memory();
+        m_entries.erase(it);
+        m_evictions++;
+    }
+}
+
+
+Color TextureCache::sample( const int texture, const vec2& uv, const vec2& duvdx, const vec2& duvdy )
+{
+    int texture_width, texture_height, levels;
+    if(texture < 0 || texture >= count() || !info(texture, texture_width, texture_height, levels))
+        return White();
+
+    // empreinte du pixel en texels, choisit le niveau de detail
+    float dx= std::sqrt(duvdx.x * duvdx.x * texture_width * texture_width + duvdx.y * duvdx.y * texture_height * texture_height);
+    float dy= std::sqrt(duvdy.x * duvdy.x * texture_width * texture_width + duvdy.y * duvdy.y * texture_height * texture_height);
+    float width= std::max(dx, dy);
+    float lod= (width > 1) ? std::log2(width) : 0;
+    lod= std::min(lod, float(levels -1));
+
+    int l0= int(lod);
+    float f= lod - l0;
+
+    const TextureLevel *level0= local_level(texture, l0);
+    if(level0 == nullptr)
+        return White();
+
+    Color color= level0->sample(uv.x, uv.y);
+    if(f > 0 && l0 +1 < levels)
+    {
+        const TextureLevel *level1= local_level(texture, l0 +1);
+        if(level1 != nullptr)
+            color= color * (1 - f) + level1->sample(uv.x, uv.y) * f;
+    }
+
+    return color;
+}
+
+
+void TextureCache::print( ) const
+{
+    printf("texture cache: %d textures, %d loads, %ld hits, %ld misses, %ld evictions\n", count(), int(m_loads), m_hits.load(), m_misses, m_evictions);
+    printf("  memory %.2fMB, peak %.2fMB, budget %.2fMB\n", m_memory / 1024.0 / 1024.0, m_peak / 1024.0 / 1024.0, m_budget / 1024.0 / 1024.0);
+}
+
+
+void texcoord_differentials( const TriangleData& triangle, const Hit& hit, const Ray& rx, const Ray& ry, vec2& uv, vec2& duvdx, vec2& duvdy )
+{
+    float w= 1 - hit.u - hit.v;
+    uv= vec2(w * triangle.ta.x + hit.u * triangle.tb.x + hit.v * triangle.tc.x, w * triangle.ta.y + hit.u * triangle.tb.y + hit.v * triangle.tc.y);
+    duvdx= vec2(0, 0);
+    duvdy= vec2(0, 0);
+
+    Point p= point(hit, triangle);
+    Vector e1= Vector(Point(triangle.a), Point(triangle.b));
+    Vector e2= Vector(Point(triangle.a), Point(triangle.c));
+    Vector n= cross(e1, e2);
+
+    // intersection des rayons voisins avec le plan du triangle
+    float nx= dot(n, rx.d);
+    float ny= dot(n, ry.d);
+    if(std::abs(nx) < 1e-12f || std::abs(ny) < 1e-12f)
+        return;
+
+    Vector dpdx= Vector(p, rx.o + dot(n, Vector(rx.o, p)) / nx * rx.d);
+    Vector dpdy= Vector(p, ry.o + dot(n, Vector(ry.o, p)) / ny * ry.d);
+
+    // variations des coordonnees barycentriques, dp= du * e1 + dv * e2, moindres carres
+    float a= dot(e1, e1);
+    float b= dot(e1, e2);
+    float c= dot(e2, e2);
+    float det= a * c - b * b;
+    if(std::abs(det) < 1e-20f)
+        return;
+
+    float dux= (c * dot(e1, dpdx) - b * dot(e2, dpdx)) / det;
+    float dvx= (a * dot(e2, dpdx) - b * dot(e1, dpdx)) / det;
+    float duy= (c * dot(e1, dpdy) - b * dot(e2, dpdy)) / det;
+    float dvy= (a * dot(e2, dpdy) - b * dot(e1, dpdy)) / det;
+
+    vec2 t1= vec2(triangle.tb.x - triangle.ta.x, triangle.tb.y - triangle.ta.y);
+    vec2 t2= vec2(triangle.tc.x - triangle.ta.x, triangle.tc.y - triangle.ta.y);
+    duvdx= vec2(dux * t1.x + dvx * t2.x, dux * t1.y + dvx * t2.y);
+    duvdy= vec2(duy * t1.x + dvy * t2.x, duy * t1.y + dvy * t2.y);
+}
@@ -0,0 +1,159 @@
+//! \file texture_cache.h cache de textures mip-mappees, chargees a la demande, pour les tutos de lancer de rayons.
+
+#ifndef _TEXTURE_CACHE_H
+#define _TEXTURE_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "vec.h"
+#include "color.h"
+#include "image.h"
+#include "materials.h"
+
+#include "bvh.h"
+
+
+//! texel, 8 bits par composante.
+struct Texel
+{
+    unsigned char r, g, b, a;
+};
+
+/*! niveau de mipmap. les texels sont ranges par blocs de 8x8, les 4 texels du filtrage bilineaire se trouvent
+    le plus souvent dans le meme bloc, et un bloc occupe 4 lignes de cache.
+    les coordonnees sont repetees en dehors de [0 .. width]x[0 .. height].
+
+    les textures de couleur sont stockees en srgb, 8 bits ne suffisent pas pour les valeurs sombres en lineaire. texel() renvoie
+    toujours une valeur lineaire, decodee par une table.
+ */
+struct TextureLevel
+{
+    std::vector<Texel> texels;
+    const float *decode;    // valeur lineaire des 256 valeurs d'un texel
+    int width;
+    int height;
+    int tiles_x;
+
+    //! image en valeurs lineaires, srgb pour stocker les texels en srgb.
+    TextureLevel( const Image& image, const bool srgb );
+
+    //! renvoie la couleur d'un texel, en valeur lineaire.
+    Color texel( const int x, const int y ) const
+    {
+        int px= x % width; if(px < 0) px+= width;
+        int py= y % height; if(py < 0) py+= height;
+        const Texel& t= texels[((py >> 3) * tiles_x + (px >> 3)) * 64 + (py & 7) * 8 + (px & 7)];
+        return Color(decode[t.r], decode[t.g], decode[t.b], t.a / 255.f);
+    }
+
+    //! renvoie la couleur interpolee aux coordonnees normalisees (u, v).
+    Color sample( const float u, const float v ) const
+    {
+        float x= u * width - 0.5f;
+        float y= v * height - 0.5f;
+        float fx= std::floor(x);
+        float fy= std::floor(y);
+        float a= x - fx;
+        float b= y - fy;
+        int ix= int(fx);
+        int iy= int(fy);
+        return texel(ix, iy) * ((1 - a) * (1 - b))
+            + texel(ix +1, iy) * (a * (1 - b))
+            + texel(ix, iy +1) * ((1 - a) * b)
+            + texel(ix +1, iy +1) * (a * b);
+    }
+
+    //! renvoie la memoire utilisee par le niveau, en octets.
+    size_t memory( ) const { return texels.size() * sizeof(Texel); }
+};
+
+
+/*! cache de textures : charge les textures de Materials::texture_filenames lors de leur premiere utilisation, construit leurs mipmaps
+    et conserve les niveaux les plus recemment utilises dans la limite d'un budget memoire. un niveau evince est reconstruit a partir du fichier
+    s'il est de nouveau necessaire, avec les niveaux moins detailles qui ne sont pas dans le cache.
+
+    les textures diffuses sont en srgb, elles sont converties en valeurs lineaires au chargement, avant de construire les mipmaps.
+
+    le cache peut etre utilise par plusieurs threads : chaque thread conserve les derniers niveaux utilises dans un petit cache local,
+    sans verrou. le cache partage n'est verrouille que si le niveau n'est pas dans le cache local. un niveau evince du cache partage
+    reste en memoire tant qu'il est dans le cache local d'un thread.
+ */
+struct TextureCache
+{
+    //! prepare le cache pour les textures des matieres, budget en octets.
+    TextureCache( const Materials& materials, const size_t budget= size_t(256) * 1024 * 1024 );
+
+    //! renvoie le nombre de textures.
+    int count( ) const { return int(m_textures.size()); }
+
+    //! filtrage trilineaire, duvdx et duvdy sont les variations des coordonnees uv entre 2 pixels voisins, cf texcoord_differentials().
+    //! renvoie blanc si la texture n'est pas chargee.
+    Color sample( const int texture, const vec2& uv, const vec2& duvdx, const vec2& duvdy );
+
+    //! filtrage bilineaire sur le niveau le plus detaille.
+    Color sample( const int texture, const vec2& uv ) { return sample(texture, uv, vec2(0, 0), vec2(0, 0)); }
+
+    //! affiche les statistiques d'utilisation du cache.
+    void print( ) const;
+
+protected:
+    struct Texture
+    {
+        std::string filename;
+        int width;
+        int height;
+        std::atomic<int> levels;    // 0 tant que la texture n'est pas chargee, width et height sont valides ensuite
+        std::atomic<bool> error;    // le fichier n'est pas lisible
+        bool srgb;                  // texture de couleur, a convertir en valeurs lineaires
+
+        Texture( ) : filename(), width(0), height(0), levels(0), error(false), srgb(false) {}
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<const TextureLevel> level;
+        std::list<long int>::iterator lru;
+    };
+
+    static long int key( const int texture, const int level ) { return long(texture) * 64 + level; }
+
+    //! renvoie les dimensions et le nombre de niveaux de la texture, la charge lors du premier acces.
+    bool info( const int texture, int& width, int& height, int& levels );
+    //! renvoie un niveau de mipmap, cherche dans le cache local du thread, puis dans le cache partage.
+    const TextureLevel *local_level( const int texture, const int level );
+    //! renvoie un niveau de mipmap, le reconstruit s'il n'est pas dans le cache partage.
+    std::shared_ptr<const TextureLevel> level( const int texture, const int level );
+    //! lit le fichier et insere les niveaux [level .. levels) dans le cache, renvoie le niveau demande.
+    std::shared_ptr<const TextureLevel> load( const int texture, const int level );
+    //! supprime les niveaux les moins recemment utilises pour respecter le budget.
+    void evict( );
+
+    std::vector<Texture> m_textures;
+    std::unordered_map<long int, Entry> m_entries;
+    std::list<long int> m_lru;          // cles des niveaux, du plus recent au plus ancien
+    std::mutex m_lock;
+    long int m_id;                      // identifiant du cache, pour les caches locaux des threads
+
+    size_t m_budget;
+    size_t m_memory;
+    size_t m_peak;
+    std::atomic<long int> m_hits;
+    long int m_misses;
+    long int m_loads;
+    long int m_evictions;
+};
+
+
+/*! coordonnees de texture du point d'intersection, et leurs variations pour un deplacement d'un pixel dans l'image.
+    rx et ry sont les rayons des pixels voisins (x+1, y) et (x, y+1), ils sont intersectes avec le plan du triangle.
+    cf "ray tracing with ray differentials", Igehy 1999.
+ */
+void texcoord_differentials( const TriangleData& triangle, const Hit& hit, const Ray& rx, const Ray& ry, vec2& uv, vec2& duvdx, vec2& duvdy );
+
+#endif
@@ -18,17 +18,17 @@ class TP : public App
 {
 public:
     // constructeur : donner les dimensions de l'image, et eventuellement la version d'openGL.
-    TP( ) : App(1024, 640) {}
+    TP( const char *mesh_filename, const char *texture_filename ) : App(1024, 640), m_mesh_filename(mesh_filename), m_texture_filename(texture_filename) {}
     
     int init( )
     {
-        m_objet= read_mesh("data/cube.obj");
+        m_objet= read_mesh(m_mesh_filename);
         
         Point pmin, pmax;
         m_objet.bounds(pmin, pmax);
         m_camera.lookat(pmin, pmax);
         
-        m_texture= read_texture(0, "data/debug2x2red.png");
+        m_texture= read_texture(0, m_texture_filename);
         
         // etape 1 : creer le shader program
         m_program= read_program("tutos/tuto9_texture1.glsl");
@@ -99,6 +99,8 @@ public:
     }
 
 protected:
+    const char *m_mesh_filename;
+    const char *m_texture_filename;
     Mesh m_objet;
     Orbiter m_camera;
     GLuint m_texture;
@@ -108,7 +110,13 @@ protected:
 
 int main( int argc, char **argv )
 {
-    TP tp;
+    // objet et texture, une lightmap calculee par rt_lightmap, par exemple : tuto9_texture1 lightmap.obj lightmap.png
+    const char *mesh_filename= "data/cube.obj";
+    const char *texture_filename= "data/debug2x2red.png";
+    if(argc > 1) mesh_filename= argv[1];
+    if(argc > 2) texture_filename= argv[2];
+    
+    TP tp(mesh_filename, texture_filename);
     tp.run();
     
     return 0;
@@ -1,5 +1,5 @@
 
-//! \file tuto_englobant.cpp
+//! \file tuto_bvh.cpp
 
 #include <algorithm>
 #include <vector>
@@ -16,262 +16,77 @@
 #include "mesh.h"
 #include "wavefront.h"
 
+#include "bvh.h"
+#include "bvh_quality.h"
 
-struct RayHit
-{
-    Point o;            // origine
-    float t;            // p(t)= o + td, position du point d'intersection sur le rayon
-    Vector d;           // direction
-    int triangle_id;    // indice du triangle dans le mesh
-    float u, v;
-    int x, y;
-    
-    RayHit( const Point& _o, const Point& _e ) :  o(_o), t(1), d(Vector(_o, _e)), triangle_id(-1), u(), v(), x(), y() {}
-    RayHit( const Point& _o, const Point& _e, const int _x, const int _y ) :  o(_o), t(1), d(Vector(_o, _e)), triangle_id(-1), u(), v(), x(_x), y(_y) {}
-    operator bool ( ) { return (triangle_id != -1); }
-};
+// statistiques de parcours : compiler avec -DBVH_STATS, ou decommenter la ligne suivante, pour enregistrer les heatmaps.
+//~ #define BVH_STATS
 
 
-struct Triangle
+#ifdef BVH_STATS
+// fausses couleurs, bleu, cyan, vert, jaune, rouge, v dans [0 .. 1]
+Color heat( const float v )
 {
-    Point p;            // sommet a du triangle
-    Vector e1, e2;      // aretes ab, ac du triangle
-    int id;
-    
-    Triangle( const TriangleData& data, const int _id ) : p(data.a), e1(Vector(data.a, data.b)), e2(Vector(data.a, data.c)), id(_id) {}
-    
-    /* calcule l'intersection ray/triangle
-        cf "fast, minimum storage ray-triangle intersection" 
-        
-        renvoie faux s'il n'y a pas d'intersection valide (une intersection peut exister mais peut ne pas se trouver dans l'intervalle [0 tmax] du rayon.)
-        renvoie vrai + les coordonnees barycentriques (u, v) du point d'intersection + sa position le long du rayon (t).
-        convention barycentrique : p(u, v)= (1 - u - v) * a + u * b + v * c
-    */
-    void intersect( RayHit &ray ) const
-    {
-        Vector pvec= cross(ray.d, e2);
-        float det= dot(e1, pvec);
-        
-        float inv_det= 1 / det;
-        Vector tvec(p, ray.o);
-        
-        float u= dot(tvec, pvec) * inv_det;
-        if(u < 0 || u > 1) return;
-        
-        Vector qvec= cross(tvec, e1);
-        float v= dot(ray.d, qvec) * inv_det;
-        if(v < 0 || u + v > 1) return;
-        
-        float t= dot(e2, qvec) * inv_det;
-        if(t < 0 || t > ray.t) return;
-        
-        // touche !!
-        ray.t= t;
-        ray.triangle_id= id;
-        ray.u= u;
-        ray.v= v;
-    }
-};
-
-
-struct BBox
-{
-    Point pmin, pmax;
-    
-    BBox( ) : pmin(), pmax() {}
-    
-    BBox( const Point& p ) : pmin(p), pmax(p) {}
-    BBox& insert( const Point& p ) { pmin= min(pmin, p); pmax= max(pmax, p); return *this; }
-    
-    float centroid( const int axis ) const { return (pmin(axis) + pmax(axis)) / 2; }
-    
-    bool intersect( const RayHit& ray ) const
-    {
-        Vector invd= Vector(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
-        return intersect(ray, invd);
-    }
-    
-    bool intersect( const RayHit& ray, const Vector& invd ) const
-    {
-        Point rmin= pmin;
-        Point rmax= pmax;
-        if(ray.d.x < 0) std::swap(rmin.x, rmax.x);
-        if(ray.d.y < 0) std::swap(rmin.y, rmax.y);
-        if(ray.d.z < 0) std::swap(rmin.z, rmax.z);
-        Vector dmin= (rmin - ray.o) * invd;
-        Vector dmax= (rmax - ray.o) * invd;
-        
-        float tmin= std::max(dmin.z, std::max(dmin.y, std::max(dmin.x, 0.f)));
-        float tmax= std::min(dmax.z, std::min(dmax.y, std::min(dmax.x, ray.t)));
-        return (tmin <= tmax);
-    }
-};
-
-
+    const Color colors[]= { Blue(), Color(0, 1, 1), Green(), Yellow(), Red() };
+    float x= std::min(1.f, std::max(0.f, v)) * 4;
+    int i= std::min(int(x), 3);
+    float t= x - i;
+    return colors[i] * (1 - t) + colors[i+1] * t;
+}
 
-// construction de l'arbre / BVH
-struct Node
+// enregistre une valeur par pixel en fausses couleurs, normalisee par le max
+void write_heatmap( const std::vector<int>& values, const int width, const int height, const char *filename )
 {
-    BBox bounds;
-    int left;
-    int right;
+    int vmax= 1;
+    for(int i= 0; i < int(values.size()); i++)
+        vmax= std::max(vmax, values[i]);
     
-    bool internal( ) const { return right > 0; }                        // renvoie vrai si le noeud est un noeud interne
-    int internal_left( ) const { assert(internal()); return left; }     // renvoie le fils gauche du noeud interne 
-    int internal_right( ) const { assert(internal()); return right; }   // renvoie le fils droit
+    Image image(width, height);
+    for(int i= 0; i < int(values.size()); i++)
+        image(i % width, i / width)= Color(heat(float(values[i]) / float(vmax)), 1);
     
-    bool leaf( ) const { return right < 0; }                            // renvoie vrai si le noeud est une feuille
-    int leaf_begin( ) const { assert(leaf()); return -left; }           // renvoie le premier objet de la feuille
-    int leaf_end( ) const { assert(leaf()); return -right; }            // renvoie le dernier objet
-};
-
-// creation d'un noeud interne
-Node make_node( const BBox& bounds, const int left, const int right )
-{
-    Node node { bounds, left, right };
-    assert(node.internal());    // verifie que c'est bien un noeud...
-    return node;
+    printf("%s: max %d\n", filename, vmax);
+    write_image(image, filename);
 }
 
-// creation d'une feuille
-Node make_leaf( const BBox& bounds, const int begin, const int end )
+// affiche un resume et un histogramme des valeurs
+void print_histogram( const char *name, const std::vector<int>& values )
 {
-    Node node { bounds, -begin, -end };
-    assert(node.leaf());        // verifie que c'est bien une feuille...
-    return node;
-}
-
-
-struct triangle_less1
-{
-    int axis;
-    float cut;
-    
-    triangle_less1( const int _axis, const float _cut ) : axis(_axis), cut(_cut) {}
+    const int buckets= 16;
     
-    bool operator() ( const Triangle& triangle ) const
+    int vmin= values[0];
+    int vmax= values[0];
+    double sum= 0;
+    for(int i= 0; i < int(values.size()); i++)
     {
-        // re-construit l'englobant du triangle
-        BBox bounds(triangle.p);
-        bounds.insert(triangle.p + triangle.e1);
-        bounds.insert(triangle.p + triangle.e2);
-        return bounds.centroid(axis) < cut;
+        vmin= std::min(vmin, values[i]);
+        vmax= std::max(vmax, values[i]);
+        sum= sum + values[i];
     }
-};
-
-
-struct BVH
-{
-    std::vector<Node> nodes;
-    std::vector<Triangle> triangles;
-    int root;
     
-    int direct_tests;
+    // largeur des intervalles, au moins 1
+    int size= (vmax - vmin + buckets) / buckets;
+    int n= (vmax - vmin) / size + 1;
     
-    // construit un bvh pour l'ensemble de triangles
-    int build( const BBox& _bounds, const std::vector<Triangle>& _triangles )
-    {
-        triangles= _triangles;  // copie les triangles pour les trier
-        nodes.clear();          // efface les noeuds
-        nodes.reserve(triangles.size());
-        
-        // construit l'arbre... 
-        root= build(_bounds, 0, triangles.size());
-        // et renvoie la racine
-        return root;
-    }
+    int histogram[buckets]= {};
+    for(int i= 0; i < int(values.size()); i++)
+        histogram[(values[i] - vmin) / size]++;
     
-    void intersect( RayHit& ray ) const
-    {
-        intersect(root, ray);
-    }
+    int hmax= 1;
+    for(int i= 0; i < n; i++)
+        hmax= std::max(hmax, histogram[i]);
     
-protected:
-    // construction d'un noeud
-    int build( const BBox& bounds, const int begin, const int end )
+    printf("%s: min %d, avg %.2f, max %d\n", name, vmin, sum / values.size(), vmax);
+    for(int i= 0; i < n; i++)
     {
-        if(end - begin <= 2)
-        {
-            // inserer une feuille et renvoyer son indice
-            int index= nodes.size();
-            nodes.push_back(make_leaf(bounds, begin, end));
-            return index;
-        }
+        char bar[41]= {};
+        for(int k= 0; k < histogram[i] * 40 / hmax; k++)
+            bar[k]= '#';
         
-        // axe le plus etire de l'englobant
-        Vector d= Vector(bounds.pmin, bounds.pmax);
-        int axis;
-        if(d.x > d.y && d.x > d.z)  // x plus grand que y et z ?
-            axis= 0;
-        else if(d.y > d.z)          // y plus grand que z ? (et que x implicitement)
-            axis= 1;
-        else                        // x et y ne sont pas les plus grands...
-            axis= 2;
-
-        // coupe l'englobant au milieu
-        float cut= bounds.centroid(axis);
-        
-        // repartit les triangles 
-        Triangle *pm= std::partition(triangles.data() + begin, triangles.data() + end, triangle_less1(axis, cut));
-        int m= std::distance(triangles.data(), pm);
-        
-        // la repartition des triangles peut echouer, et tous les triangles sont dans la meme partie... 
-        // forcer quand meme un decoupage en 2 ensembles 
-        if(m == begin || m == end)
-            m= (begin + end) / 2;
-        assert(m != begin);
-        assert(m != end);
-        
-        // construire le fils gauche
-        // les triangles se trouvent dans [begin .. m)
-        BBox bounds_left(triangles[begin].p);                                         // englobant du premier triangle
-        bounds_left.insert(triangles[begin].p + triangles[begin].e1);                // on insere les 3 sommets...
-        bounds_left.insert(triangles[begin].p + triangles[begin].e2);
-        for(int i= begin+1; i < m; i++)                                        // insere les sommets des autres triangles
-        {
-            bounds_left.insert(triangles[i].p);
-            bounds_left.insert(triangles[i].p + triangles[i].e1);
-            bounds_left.insert(triangles[i].p + triangles[i].e2);
-        }
-        int left= build(bounds_left, begin, m);
-        
-        // on recommence pour le fils droit
-        // les triangles se trouvent dans [m .. end)
-        BBox bounds_right(triangles[m].p);
-        bounds_right.insert(triangles[m].p + triangles[m].e1);
-        bounds_right.insert(triangles[m].p + triangles[m].e2);
-        for(int i= m+1; i < end; i++)
-        {
-            bounds_right.insert(triangles[i].p);
-            bounds_right.insert(triangles[i].p + triangles[i].e1);
-            bounds_right.insert(triangles[i].p + triangles[i].e2);
-        }
-        int right= build(bounds_right, m, end);
-        
-        int index= nodes.size();
-        nodes.push_back(make_node(bounds, left, right));
-        return index;
+        printf("  [%5d .. %5d) %8d %s\n", vmin + i * size, vmin + (i + 1) * size, histogram[i], bar);
     }
-    
-    void intersect( const int index, RayHit& ray ) const
-    {
-        const Node& node= nodes[index];
-        if(node.bounds.intersect(ray))
-        {
-            if(node.leaf())
-            {
-                for(int i= node.leaf_begin(); i < node.leaf_end(); i++)
-                    triangles[i].intersect(ray);
-            }
-            else // if(node.internal())
-            {
-                intersect(node.internal_left(), ray);
-                intersect(node.internal_right(), ray);
-            }
-        }
-    }
-};
-
+}
+#endif
 
 
 int main( const int argc, const char **argv )
@@ -311,7 +126,7 @@ int main( const int argc, const char **argv )
     Transform inv= Inverse(viewport * projection * view * model);
     
     // genere un rayon par pixel de l'image
-    std::vector<RayHit> rays;
+    std::vector<Ray> rays;
     for(int y= 0; y < image.height(); y++)
     for(int x= 0; x < image.width(); x++)
     {
@@ -319,9 +134,12 @@ int main( const int argc, const char **argv )
         Point origine= inv(Point(x + .5f, y + .5f, 0));
         Point extremite= inv(Point(x + .5f, y + .5f, 1));
         
-        rays.emplace_back(origine, extremite, x, y);
+        rays.emplace_back(origine, extremite);
     }
     
+    // intersections, une par rayon / pixel
+    std::vector<Hit> hits(rays.size());
+    
 // mesure les temps d'execution 
     {
         BVH bvh;
@@ -335,6 +153,11 @@ int main( const int argc, const char **argv )
             auto stop= std::chrono::high_resolution_clock::now();
             int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
             printf("build %dms\n", cpu);
+            
+            // qualite de l'arbre
+            BVHQuality quality= bvh_quality(bvh);
+            bvh_measure(bvh, rays, quality);
+            bvh_print(quality);
         }
         
         {
@@ -343,7 +166,7 @@ int main( const int argc, const char **argv )
             // intersection
             const int n= int(rays.size());
             for(int i= 0; i < n; i++)
-                bvh.intersect(rays[i]);
+                hits[i]= bvh.intersect(rays[i]);
             
             auto stop= std::chrono::high_resolution_clock::now();
             int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
@@ -357,23 +180,52 @@ int main( const int argc, const char **argv )
             const int n= int(rays.size());
             #pragma omp parallel for schedule(dynamic, 1024)
             for(int i= 0; i < n; i++)
-                bvh.intersect(rays[i]);
+                hits[i]= bvh.intersect(rays[i]);
             
             auto stop= std::chrono::high_resolution_clock::now();
             int cpu= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
             printf("bvh %dms\n", cpu);
         }
+        
+    #ifdef BVH_STATS
+        {
+            // statistiques de parcours, par rayon / pixel
+            const int n= int(rays.size());
+            std::vector<RayStats> stats(n);
+            #pragma omp parallel for schedule(dynamic, 1024)
+            for(int i= 0; i < n; i++)
+                bvh.intersect(rays[i], stats[i]);
+            
+            std::vector<int> nodes(n);
+            std::vector<int> boxes(n);
+            std::vector<int> tests(n);
+            for(int i= 0; i < n; i++)
+            {
+                nodes[i]= stats[i].nodes;
+                boxes[i]= stats[i].boxes;
+                tests[i]= stats[i].triangles;
+            }
+            
+            print_histogram("nodes", nodes);
+            print_histogram("boxes", boxes);
+            print_histogram("triangles", tests);
+            
+            write_heatmap(nodes, image.width(), image.height(), "bvh_nodes.png");
+            write_heatmap(boxes, image.width(), image.height(), "bvh_boxes.png");
+            write_heatmap(tests, image.width(), image.height(), "bvh_triangles.png");
+        }
+    #endif
     }
     
     // reconstruit l'image
-    for(int i= 0; i < rays.size(); i++)
+    for(int i= 0; i < int(hits.size()); i++)
     {
-        if(rays[i])
+        if(hits[i])
         {
-            int x= rays[i].x;
-            int y= rays[i].y;
-            float u= rays[i].u;
-            float v= rays[i].v;
+            int x= i % image.width();
+            int y= i / image.width();
+            float u= hits[i].u;
+            float v= hits[i].v;
             float w= 1 - u - v;
             image(x, y)= Color(w, u, v);
         }
@@ -0,0 +1,102 @@
+//! \file tuto_clusters.cpp lancer de rayons sur un objet decoupe en clusters sur disque, charges a la demande dans un cache de taille limitee.
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <chrono>
+
+#include "vec.h"
+#include "mat.h"
+#include "orbiter.h"
+#include "image.h"
+#include "image_io.h"
+#include "files.h"
+
+#include "cluster_bvh.h"
+
+
+int main( const int argc, const char **argv )
+{
+    const char *mesh_filename= "data/bigguy.obj";
+    const char *orbiter_filename= nullptr;
+    if(argc > 1) mesh_filename= argv[1];
+    if(argc > 2 && argv[2][0]) orbiter_filename= argv[2];       // "" pour placer la camera sur l'englobant
+
+    // taille des clusters en triangles, et budget du cache en Mo
+    int cluster_size= 65536;
+    if(argc > 3) cluster_size= std::max(1, atoi(argv[3]));
+    size_t budget= 1024;
+    if(argc > 4) budget= std::max(1, atoi(argv[4]));
+
+    // decoupe l'objet, si necessaire. les clusters sont conserves a cote du fichier .obj, un fichier par taille de cluster
+    std::string clusters_filename= std::string(mesh_filename) + "." + std::to_string(cluster_size) + ".clusters";
+    double source= timestamp(mesh_filename);
+    double clusters= timestamp(clusters_filename.c_str());
+    if(clusters < 0 || clusters < source)
+    {
+        auto start= std::chrono::high_resolution_clock::now();
+
+        if(build_clusters(mesh_filename, clusters_filename.c_str(), cluster_size) < 0)
+            return 1;
+
+        auto stop= std::chrono::high_resolution_clock::now();
+        int time= std::chrono::duration_cast<std::chrono::milliseconds>(stop - start).count();
+        printf("build clusters %ds %03dms\n", int(time / 1000), int(time % 1000));
+    }
+
+    ClusterBVH bvh(clusters_filename.c_str(), budget * 1024 * 1024);
+    if(!bvh.valid())
+        return 1;
+
+    // camera
+    Image image(1024, 640);
+
+    Orbiter camera;
+    if(orbiter_filename == nullptr)
+        camera.lookat(bvh.bounds().pmin, bvh.bounds().pmax);
+    else if(camera.read_orbiter(orbiter_filename))
+        // erreur, pas de camera
+        return 1;
+
+    Transform view= camera.view();
+    Transform projection= camera.projection(image.width(), image.height(), 45);
+    Transform viewport= Viewport(image.width(), image.height());
+    Transform inv= Inverse(viewport * projection * view);
+
+    auto cpu_start= std::chrono::high_resolution_clock::now();
+
+    // les pixels voisins utilisent les memes clusters : un thread par bloc de 32x32 pixels, pour limiter les chargements
+    const int tile= 32;
+    const int tiles_x= (image.width() + tile -1) / tile;
+    const int tiles_y= (image.height() + tile -1) / tile;
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int t= 0; t < tiles_x * tiles_y; t++)
+    {
+        int xmin= (t % tiles_x) * tile;
+        int ymin= (t / tiles_x) * tile;
+        for(int py= ymin; py < std::min(image.height(), ymin + tile); py++)
+        for(int px= xmin; px < std::min(image.width(), xmin + tile); px++)
+        {
+            Point o= camera.position();
+            Point e= inv(Point(px + 0.5f, py + 0.5f, 1));
+
+            Ray ray(o, e);
+            Vector n;
+            if(Hit hit= bvh.intersect(ray, n))
+            {
+                // eclairage "frontal", la source de lumiere est sur la camera
+                float cos_theta= std::abs(dot(normalize(n), normalize(ray.d)));
+                image(px, py)= Color(cos_theta);
+            }
+        }
+    }
+
+    auto cpu_stop= std::chrono::high_resolution_clock::now();
+    int cpu_time= std::chrono::duration_cast<std::chrono::milliseconds>(cpu_stop - cpu_start).count();
+    printf("cpu  %ds %03dms\n", int(cpu_time / 1000), int(cpu_time % 1000));
+    bvh.print();
+
+    write_image(image, "clusters.png");
+    return 0;
+}
@@ -1,7 +1,8 @@
 
-//! \file tuto_cubemap.cpp reflets miroirs cubemap / envmap. 
+//! \file tuto_cubemap.cpp reflets cubemap / envmap, diffus et glossy. 
 
 #include <memory>
+#include <chrono>
 
 #include "wavefront.h"
 #include "texture.h"
@@ -10,6 +11,9 @@
 #include "program.h"
 #include "uniforms.h"
 #include "draw.h"
+#include "envmap.h"
+#include "envmap_sh.h"
+#include "envmap_prefilter.h"
 
 #include "app_camera.h"        // classe Application a deriver
 
@@ -76,6 +80,48 @@ GLuint read_cubemap( const int unit, const char *filename,  const GLenum texel_t
     return texture;
 }
     
+//! cree une texture cubemap, level i de la texture est levels[i].
+GLuint make_cubemap( const int unit, const std::vector<Envmap>& levels, const GLenum texel_type = GL_RGBA32F )
+{
+    if(levels.empty())
+        return 0;
+    
+    GLuint texture= 0;
+    glGenTextures(1, &texture);
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    
+    for(int level= 0; level < int(levels.size()); level++)
+    {
+        int w= levels[level].width();
+        std::vector<Color> pixels(w * w);
+        for(int i= 0; i < 6; i++)
+        {
+            // les faces de l'envmap sont deja orientees comme les faces openGL, cf Envmap::texture()
+            for(int y= 0; y < w; y++)
+            for(int x= 0; x < w; x++)
+                pixels[y * w + x]= levels[level](i, x, y);
+            
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X +i, level,
+                texel_type, w, w, 0,
+                GL_RGBA, GL_FLOAT, pixels.data());
+        }
+    }
+    
+    // parametres de filtrage, utilise les niveaux prefiltres
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, int(levels.size()) -1);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    
+    printf("  cubemap faces %dx%d, %d levels\n", levels[0].width(), levels[0].height(), int(levels.size()));
+    return texture;
+}
+
 class TP : public AppCamera
 {
 public:
@@ -89,9 +135,30 @@ public:
         m_objet= read_mesh("data/bigguy.obj");
         // m_objet= read_mesh("data/ccbigguy.obj");
         
-        m_texture= read_cubemap(0, "tutos/cubemap_debug_cross.png");
+        //~ m_texture= read_cubemap(0, "tutos/cubemap_debug_cross.png");
         // m_texture= read_cubemap(0, "canyon2.jpg");
         
+        // reflets glossy : mipmaps prefiltrees de la cubemap, calculees une seule fois et conservees sur disque
+        std::vector<Envmap> levels= read_prefiltered_cubemap("tutos/cubemap_debug_cross.png");
+        m_texture= make_cubemap(0, levels);
+        
+        // eclairage diffus : projection de la cubemap sur les harmoniques spheriques
+        if(!levels.empty())
+        {
+            const Envmap& envmap= levels[0];
+            
+            auto start= std::chrono::high_resolution_clock::now();
+            EnvmapSH sh= envmap_sh(envmap);
+            auto stop= std::chrono::high_resolution_clock::now();
+            int time= std::chrono::duration_cast<std::chrono::microseconds>(stop - start).count();
+            printf("  sh projection %dus\n", time);
+            
+            m_sh= sh.irradiance_coefficients();
+        }
+        // reflet miroir seul par defaut, touche 'd' pour ajouter le diffus, touche 'g' pour un reflet glossy
+        m_diffuse_weight= 0;
+        m_roughness= 0;
+        
         m_program_draw= read_program("tutos/draw_cubemap.glsl");
         program_print_errors(m_program_draw);
         m_program= read_program("tutos/cubemap.glsl");
@@ -144,6 +211,9 @@ public:
         program_uniform(m_program, "mvpMatrix", mvp);
         program_uniform(m_program, "modelMatrix", model);
         program_uniform(m_program, "camera_position", camera_position);
+        program_uniform(m_program, "sh", m_sh);
+        program_uniform(m_program, "diffuse_weight", m_diffuse_weight);
+        program_uniform(m_program, "roughness", m_roughness);
         
         glBindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
         program_uniform(m_program, "texture0", int(0));
@@ -180,6 +250,20 @@ public:
             program_print_errors(m_program);
         }
         
+        if(key_state('d'))
+        {
+            clear_key_state('d');
+            m_diffuse_weight= (m_diffuse_weight > 0) ? 0.f : 0.8f;
+            printf("diffuse %.1f\n", m_diffuse_weight);
+        }
+        
+        if(key_state('g'))
+        {
+            clear_key_state('g');
+            m_roughness= (m_roughness > 0) ? 0.f : 0.3f;
+            printf("roughness %.1f\n", m_roughness);
+        }
+        
         if(key_state('s'))
         {
             clear_key_state('s');
@@ -194,6 +278,9 @@ public:
 protected:
     Mesh m_objet;
     GLuint m_texture;
+    std::vector<vec3> m_sh;
+    float m_diffuse_weight;
+    float m_roughness;
     GLuint m_program_draw;
     GLuint m_program;
     GLuint m_vao;
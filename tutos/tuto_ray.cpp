@@ -1,427 +1,293 @@
-
-#include <cfloat>
-#include <random>
-#include <chrono>
-
-#include "vec.h"
-#include "mesh.h"
-#include "wavefront.h"
-#include "orbiter.h"
-
-#include "image.h"
-#include "image_io.h"
-#include "image_hdr.h"
-
-
-struct Ray
-{
-    Point o;
-    float pad;
-    Vector d;
-    float tmax;
-    
-    Ray( ) : o(), d(), tmax(0) {}
-    Ray( const Point& _o, const Point& _e ) : o(_o), d(Vector(_o, _e)), tmax(1) {}
-    Ray( const Point& _o, const Vector& _d ) : o(_o), d(_d), tmax(FLT_MAX) {}
-};
-
-
-// intersection rayon / triangle.
-struct Hit
-{
-    int triangle_id;
-    float t;
-    float u, v;
-    
-    Hit( ) : triangle_id(-1), t(0), u(0), v(0) {}       // pas d'intersection
-    Hit( const int _id, const float _t, const float _u, const float _v ) : triangle_id(_id), t(_t), u(_u), v(_v) {}
-    
-    operator bool( ) const { return (triangle_id != -1); }      // renvoie vrai si l'intersection est initialisee...
-};
-
-// renvoie la normale interpolee d'un triangle.
-Vector normal( const Hit& hit, const TriangleData& triangle )
-{
-    return normalize((1 - hit.u - hit.v) * Vector(triangle.na) + hit.u * Vector(triangle.nb) + hit.v * Vector(triangle.nc));
-}
-
-// renvoie le point d'intersection sur le triangle.
-Point point( const Hit& hit, const TriangleData& triangle )
-{
-    return (1 - hit.u - hit.v) * Point(triangle.a) + hit.u * Point(triangle.b) + hit.v * Point(triangle.c);
-}
-
-// renvoie le point d'intersection sur le rayon
-Point point( const Hit& hit, const Ray& ray )
-{
-    return ray.o + hit.t * ray.d;
-}
-
-
-// triangle "intersectable".
-struct Triangle
-{
-    Point p;
-    Vector e1, e2;
-    int id;
-    
-    Triangle( const Point& _a, const Point& _b, const Point& _c, const int _id ) : p(_a), e1(Vector(_a, _b)), e2(Vector(_a, _c)), id(_id) {}
-    
-    /* calcule l'intersection ray/triangle
-        cf "fast, minimum storage ray-triangle intersection" 
-        http://www.graphics.cornell.edu/pubs/1997/MT97.pdf
-        
-        renvoie faux s'il n'y a pas d'intersection valide (une intersection peut exister mais peut ne pas se trouver dans l'intervalle [0 htmax] du rayon.)
-        renvoie vrai + les coordonnees barycentriques (u, v) du point d'intersection + sa position le long du rayon (t).
-        convention barycentrique : p(u, v)= (1 - u - v) * a + u * b + v * c
-    */
-    Hit intersect( const Ray &ray, const float htmax ) const
-    {
-        Vector pvec= cross(ray.d, e2);
-        float det= dot(e1, pvec);
-        
-        float inv_det= 1 / det;
-        Vector tvec(p, ray.o);
-
-        float u= dot(tvec, pvec) * inv_det;
-        if(u < 0 || u > 1) return Hit();
-
-        Vector qvec= cross(tvec, e1);
-        float v= dot(ray.d, qvec) * inv_det;
-        if(v < 0 || u + v > 1) return Hit();
-
-        float t= dot(e2, qvec) * inv_det;
-        if(t > htmax || t < 0) return Hit();
-        
-        return Hit(id, t, u, v);           // p(u, v)= (1 - u - v) * a + u * b + v * c
-    }
-};
-
-
-// ensemble de triangles. 
-// a remplacer par une vraie structure acceleratrice, un bvh, par exemple
-struct BVH
-{
-    std::vector<Triangle> triangles;
-    
-    BVH( ) = default;
-    BVH( const Mesh& mesh ) { build(mesh); }
-    
-    void build( const Mesh& mesh )
-    {
-        triangles.clear();
-        triangles.reserve(mesh.triangle_count());
-        for(int id= 0; id < mesh.triangle_count(); id++)
-        {
-            TriangleData data= mesh.triangle(id);
-            triangles.push_back( Triangle(data.a, data.b, data.c, id) );
-        }
-        
-        printf("%d triangles\n", int(triangles.size()));
-        assert(triangles.size());
-    }
-    
-    Hit intersect( const Ray& ray ) const
-    {
-        Hit hit;
-        float tmax= ray.tmax;
-        for(int id= 0; id < int(triangles.size()); id++)
-            // ne renvoie vrai que si l'intersection existe dans l'intervalle [0 tmax]
-            if(Hit h= triangles[id].intersect(ray, tmax))
-            {
-                hit= h;
-                tmax= h.t;
-            }
-        
-        return hit;        
-    }
-    
-    bool visible( const Ray& ray ) const
-    {
-        for(int id= 0; id < int(triangles.size()); id++)
-            if(triangles[id].intersect(ray, ray.tmax))
-                return false;
-        
-        return true;
-    }
-};
-
-
-struct Source
-{
-    Point a, b, c;
-    Color emission;
-    Vector n;
-    float area;
-    
-    Source( ) : a(), b(), c(), emission(), n(), area() {}
-    
-    Source( const TriangleData& data, const Color& color ) : a(data.a), b(data.b), c(data.c), emission(color)
-    {
-       // normale geometrique du triangle abc, produit vectoriel des aretes ab et ac
-        Vector ng= cross(Vector(a, b), Vector(a, c));
-        n= normalize(ng);
-        area= length(ng) / 2;
-    }
-    
-    Point sample( const float u1, const float u2 ) const
-    {
-        // cf GI compemdium eq 18
-        float r1= std::sqrt(u1);
-        float alpha= 1 - r1;
-        float beta= (1 - u2) * r1;
-        float gamma= u2 * r1;
-        return alpha*a + beta*b + gamma*c;
-    }
-    
-    float pdf( const Point& p ) const
-    {
-        // todo : devrait renvoyer 0 pour les points a l'exterieur du triangle...
-        return 1.f / area;
-    }
-};
-
-
-struct Sources
-{
-    std::vector<Source> sources;
-    float emission;     // emission totale des sources
-    float area;         // aire totale des sources
-    
-    Sources( const Mesh& mesh ) : sources()
-    {
-        build(mesh);
-        
-        printf("%d sources\n", int(sources.size()));
-        assert(sources.size());
-    }
-    
-    void build( const Mesh& mesh )
-    {
-        area= 0;
-        emission= 0;
-        sources.clear();
-        for(int id= 0; id < mesh.triangle_count(); id++)
-        {
-            const TriangleData& data= mesh.triangle(id);
-            const Material& material= mesh.triangle_material(id);
-            if(material.emission.power() > 0)
-            {
-                Source source(data, material.emission);
-                emission= (emission + source.area * source.emission.power());
-                area= area + source.area;
-                
-                sources.push_back(source);
-            }
-        }
-    }
-    
-    int size( ) const { return int(sources.size()); }
-    const Source& operator() ( const int id ) const { return sources[id]; }
-};
-
-
-// utilitaires
-// construit un repere ortho tbn, a partir d'un seul vecteur, la normale d'un point d'intersection, par exemple.
-// permet de transformer un vecteur / une direction dans le repere du monde.
-
-// cf "generating a consistently oriented tangent space" 
-// http://people.compute.dtu.dk/jerf/papers/abstracts/onb.html
-// cf "Building an Orthonormal Basis, Revisited", Pixar, 2017
-// http://jcgt.org/published/0006/01/01/
-struct World
-{
-    World( const Vector& _n ) : n(_n) 
-    {
-        float sign= std::copysign(1.0f, n.z);
-        float a= -1.0f / (sign + n.z);
-        float d= n.x * n.y * a;
-        t= Vector(1.0f + sign * n.x * n.x * a, sign * d, -sign * n.x);
-        b= Vector(d, sign + n.y * n.y * a, -n.y);        
-    }
-    
-    // transforme le vecteur du repere local vers le repere du monde
-    Vector operator( ) ( const Vector& local )  const { return local.x * t + local.y * b + local.z * n; }
-    
-    // transforme le vecteur du repere du monde vers le repere local
-    Vector inverse( const Vector& global ) const { return Vector(dot(global, t), dot(global, b), dot(global, n)); }
-    
-    Vector t;
-    Vector b;
-    Vector n;
-};
-
-
-
-
-int main( const int argc, const char **argv )
-{
-    const char *mesh_filename= "data/cornell.obj";
-    //const char *mesh_filename= "data/emission.obj";
-    const char *orbiter_filename= "data/cornell_orbiter.txt";
-    //const char *orbiter_filename= "data/emission_orbiter.txt";
-    //const char *orbiter_filename= "data/orbiter.txt";
-    
-    if(argc > 1) mesh_filename= argv[1];
-    if(argc > 2) orbiter_filename= argv[2];
-    
-    printf("%s: '%s' '%s'\n", argv[0], mesh_filename, orbiter_filename);
-    
-    // creer l'image resultat
-    Image image(1024, 640);
-    
-    // charger un objet
-    Mesh mesh= read_mesh(mesh_filename);
-    if(mesh.triangle_count() == 0)
-        // erreur de chargement, pas de triangles
-        return 1;
-    
-    // creer l'ensemble de triangles / structure acceleratrice
-    BVH bvh(mesh);
-    Sources sources(mesh);
-    
-    // charger la camera
-    Orbiter camera;
-    if(camera.read_orbiter(orbiter_filename))
-        // erreur, pas de camera
-        return 1;
-    
-    // recupere les transformations view, projection et viewport pour generer les rayons
-    Transform model= Identity();
-    Transform view= camera.view();
-    Transform projection= camera.projection(image.width(), image.height(), 45);
-    Transform viewport= Viewport(image.width(), image.height());
-
-    auto cpu_start= std::chrono::high_resolution_clock::now();
-    
-    // parcourir tous les pixels de l'image
-    // en parallele avec openMP, un thread par bloc de 16 lignes
-#pragma omp parallel for schedule(dynamic, 1)
-    for(int py= 0; py < image.height(); py++)
-    {
-        // nombres aleatoires, version c++11
-        std::random_device seed;
-        // un generateur par thread... pas de synchronisation
-        std::default_random_engine rng(seed());
-        // nombres aleatoires entre 0 et 1
-        std::uniform_real_distribution<float> u01(0.f, 1.f);
-        
-        for(int px= 0; px < image.width(); px++)
-        {
-            Color color= Black();
-            
-            // generer le rayon pour le pixel (x, y)
-            float x= px + u01(rng);
-            float y= py + u01(rng);
-            
-            //Point o= { (viewport*projection*view).inverse()(Point(x,y,0)) }; // origine dans l'image
-            Point o= { camera.position() }; // origine dans l'image
-            Point e= { (viewport*projection*view).inverse()(Point(x,y,1)) }; // extremite dans l'image
-            
-            Ray ray(o, e);
-            Hit hit;
-            // calculer les intersections 
-            if(hit= bvh.intersect(ray))
-            {
-                const TriangleData& triangle= mesh.triangle(hit.triangle_id);           // recuperer le triangle
-                const Material& material= mesh.triangle_material(hit.triangle_id);      // et sa matiere
-                
-                // position du point d'intersection
-                //Point p= ray.o + hit.t * ray.d;
-                Point p= point(hit, ray);               // point d'intersection
-                Vector pn= normal(hit, triangle);       // normale interpolee du triangle au point d'intersection
-                // retourne la normale pour faire face a la camera / origine du rayon...
-                if(dot(pn, ray.d) > 0)
-                    pn= -pn;
-                int N_Source=2;
-                int N_point_Source=16;
-                for (int si=0;si<N_Source;si++){
-                    for (int p_si=0; p_si< N_point_Source;p_si++){
-                        // position et emission de la source de lumiere si
-                        float u1=u01(rng);
-                        float u2=u01(rng);
-
-                        //Point s= (Point(sources(si).a) + Point(sources(si).b) + Point(sources(si).c))/3.0;
-                        Point s= sources(si).sample(u1,u2);
-                        Color emission= sources(si).emission;
-                        
-                        //Point p= (Point(data.a) + Point(data.b) + Point(data.c)) / 3;
-                        // interpoler la normale au point d'intersection
-                        //Vector pn= normal(mesh, hit);
-                        // direction de p vers la source s
-                        Vector l= Vector(p, s);
-
-                        // visibilite entre p et s
-                        float v= 1;
-
-                        Ray shadow_ray(p + 0.00001f * pn, l);//+ 0.001f * pn
-                        shadow_ray.tmax = 1 - .00001f ;//
-
-        
-                        //if(bvh.visible(shadow_ray) != 1)
-                        if(Hit hit2= bvh.intersect(shadow_ray))
-                        {
-                            // on vient de trouver un triangle entre p et s. p est donc a l'ombre
-                            v= 0;
-                
-                        }
-
-                        Vector sn= sources(si).n;// normale du triangle au point de la source  interpolee ?
-
-
-                        // accumuler la couleur de l'echantillon
-                        float cos_theta= std::max(0.f, dot(pn, normalize(l)));
-                        float cos_theta_s= std::max(0.f, dot(sn, normalize(-l)));
-                        color= color + 1.f / float(M_PI) * material.diffuse* cos_theta_s* cos_theta * v *sources(si).pdf(s) * 1.f / (length2(l)*N_Source*N_point_Source);
-
-                        //     break;  // pas la peine de continuer
-                    }
-
-                }
-                float gamma = 2.2;
-                color.r=pow(color.r,1.0/gamma);
-                color.g=pow(color.g,1.0/gamma);
-                color.b=pow(color.b,1.0/gamma);
-                color =  color;
-
-            }
-
-
-            // if(hit)
-            // {
-
-                
-            //     // visibilite entre p et s
-            //     float v= 1;
-            // #if 1
-            //     Ray shadow_ray(p + 0.001f * pn, s);
-            //     for(int i= 0; i < int(triangles.size()); i++)
-            //     {
-            //         if(triangles[i].intersect(shadow_ray, 1 - .001f))
-            //         {
-            //             // on vient de trouver un triangle entre p et s. p est donc a l'ombre
-            //             v= 0;
-            //             break;  // pas la peine de continuer
-            //         }
-            //     }
-            // #endif
-                
-            //     // calculer la lumiere reflechie vers la camera / l'origine du rayon
-            //     //float cos_theta= std::abs(dot(pn, normalize(l)));
-            //     //Color fr= diffuse_color(mesh, hit) / M_PI;
-                
-            //     //Color color= v * emission * fr * cos_theta / length2(l);
-            //     Color color = v * color;
-        image(px, py)= Color(color, 1);
-        }
-    }
-    
-    auto cpu_stop= std::chrono::high_resolution_clock::now();
-    int cpu_time= std::chrono::duration_cast<std::chrono::milliseconds>(cpu_stop - cpu_start).count();
-    printf("cpu  %ds %03dms\n", int(cpu_time / 1000), int(cpu_time % 1000));
-    
-    // enregistrer l'image resultat
-    write_image(image, "render.png");
-    write_image_hdr(image, "render.hdr");
-    return 0;
-}
+
+#include <cfloat>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <chrono>
+
+#include "vec.h"
+#include "mesh.h"
+#include "wavefront.h"
+#include "orbiter.h"
+
+#include "image.h"
+#include "image_io.h"
+#include "image_hdr.h"
+#include "envmap.h"
+#include "envmap_sampler.h"
+
+#include "bvh.h"
+#include "sources.h"
+#include "render_tile.h"
+#include "denoise.h"
+#include "ao.h"
+#include "texture_cache.h"
+#include "lightcuts.h"
+#include "photon_map.h"
+
+
+int main( const int argc, const char **argv )
+{
+    const char *mesh_filename= "data/cornell.obj";
+    //const char *mesh_filename= "data/emission.obj";
+    const char *orbiter_filename= "data/cornell_orbiter.txt";
+    //const char *orbiter_filename= "data/emission_orbiter.txt";
+    //const char *orbiter_filename= "data/orbiter.txt";
+    
+    if(argc > 1) mesh_filename= argv[1];
+    if(argc > 2) orbiter_filename= argv[2];
+    
+    // nombre d'echantillons par source, filtrer l'image permet d'en utiliser beaucoup moins
+    int N_point_Source= 16;
+    if(argc > 3) N_point_Source= std::max(1, atoi(argv[3]));
+    
+    // mode de rendu : eclairage direct, ou occultation ambiante "ao", avec la longueur des rayons d'occultation en option
+    bool ambient_occlusion= (argc > 4 && strcmp(argv[4], "ao") == 0);
+    float ao_distance= 0;
+    if(argc > 5) ao_distance= atof(argv[5]);
+    
+    // ou eclairage par une envmap "envmap", avec le nom de la cubemap en option
+    bool environment= (argc > 4 && strcmp(argv[4], "envmap") == 0);
+    const char *envmap_filename= "data/cubemap/cubemap_BlueSkyRainbow.png";
+    if(environment && argc > 5) envmap_filename= argv[5];
+    
+    // ou eclairage direct + indirect par radiosite instantanee "vpl", avec le nombre de vpls en option
+    bool instant_radiosity= (argc > 4 && strcmp(argv[4], "vpl") == 0);
+    int vpl_count= 4096;
+    if(instant_radiosity && argc > 5) vpl_count= std::max(1, atoi(argv[5]));
+    
+    // ou eclairage direct + caustiques et indirect par photon mapping "photons", avec le nombre de photons en option
+    bool photon_mapping= (argc > 4 && strcmp(argv[4], "photons") == 0);
+    PhotonParams photon_params;
+    if(photon_mapping && argc > 5) photon_params.photons= std::max(1, atoi(argv[5]));
+    
+    printf("%s: '%s' '%s' %d samples%s\n", argv[0], mesh_filename, orbiter_filename, N_point_Source, 
+        ambient_occlusion ? ", ambient occlusion" : (environment ? ", envmap" : (instant_radiosity ? ", instant radiosity" : (photon_mapping ? ", photon mapping" : ""))));
+    
+    // creer l'image resultat
+    Image image(1024, 640);
+    // et les buffers auxiliaires pour le filtrage : normale, position et couleur diffuse du point visible de chaque pixel
+    Image normals(image.width(), image.height());
+    Image positions(image.width(), image.height());
+    Image albedos(image.width(), image.height(), White());
+    
+    // charger un objet
+    Mesh mesh= read_mesh(mesh_filename);
+    if(mesh.triangle_count() == 0)
+        // erreur de chargement, pas de triangles
+        return 1;
+    
+    // construire la structure acceleratrice
+    BVH bvh(mesh);
+    printf("%d triangles\n", mesh.triangle_count());
+    
+    // charger la camera
+    Orbiter camera;
+    if(camera.read_orbiter(orbiter_filename))
+        // erreur, pas de camera
+        return 1;
+    
+    // recupere les transformations view, projection et viewport pour generer les rayons
+    Transform model= Identity();
+    Transform view= camera.view();
+    Transform projection= camera.projection(image.width(), image.height(), 45);
+    Transform viewport= Viewport(image.width(), image.height());
+    
+    if(ambient_occlusion)
+    {
+        // pas besoin des sources de lumiere, ni du filtrage
+        AOParams params;
+        params.samples= N_point_Source;
+        params.distance= ao_distance;
+        
+        auto ao_start= std::chrono::high_resolution_clock::now();
+        
+        Image ao= render_ao(mesh, bvh, view, projection, image.width(), image.height(), params);
+        
+        auto ao_stop= std::chrono::high_resolution_clock::now();
+        int ao_time= std::chrono::duration_cast<std::chrono::milliseconds>(ao_stop - ao_start).count();
+        printf("ao  %ds %03dms\n", int(ao_time / 1000), int(ao_time % 1000));
+        
+        write_image_hdr(ao, "ao.hdr");
+        write_image(gamma_correct(ao), "ao.png");
+        return 0;
+    }
+    
+    // sources de lumiere : triangles emissifs ou envmap
+    Sources sources;
+    Envmap envmap;
+    EnvmapSampler envmap_sampler;
+    if(environment)
+    {
+        envmap= read_cubemap(envmap_filename);
+        if(envmap.empty())
+            // erreur, pas d'envmap
+            return 1;
+        if(!is_hdr_image(envmap_filename))
+            envmap.linear();
+        
+        envmap_sampler.build(envmap);
+    }
+    else
+        sources= Sources(mesh);
+    
+    // textures des matieres, chargees a la demande
+    TextureCache textures(mesh.materials());
+    
+    // eclairage indirect : vpls sur les surfaces eclairees par les sources, regroupes dans l'arbre des lightcuts
+    Lightcuts lightcuts;
+    LightcutsParams lightcuts_params;
+    LightcutsStats lightcuts_stats;
+    if(instant_radiosity)
+    {
+        auto vpl_start= std::chrono::high_resolution_clock::now();
+        
+        lightcuts.build(trace_vpls(mesh, bvh, sources, vpl_count, 0, &textures));
+        
+        auto vpl_stop= std::chrono::high_resolution_clock::now();
+        int vpl_time= std::chrono::duration_cast<std::chrono::milliseconds>(vpl_stop - vpl_start).count();
+        printf("vpl %dms, %d vpls\n", vpl_time, lightcuts.size());
+    }
+    
+    // ou photons stockes sur les surfaces diffuses
+    PhotonMaps photons;
+    if(photon_mapping)
+    {
+        auto photon_start= std::chrono::high_resolution_clock::now();
+        
+        trace_photons(photons, mesh, bvh, sources, photon_params, 0, &textures);
+        
+        auto photon_stop= std::chrono::high_resolution_clock::now();
+        int photon_time= std::chrono::duration_cast<std::chrono::milliseconds>(photon_stop - photon_start).count();
+        printf("photons %dms, %d caustic photons, %d global photons\n", photon_time, photons.caustics.size(), photons.global.size());
+    }
+    
+    // passage repere image vers repere du monde
+    Transform inv= Inverse(viewport * projection * view);
+
+    auto cpu_start= std::chrono::high_resolution_clock::now();
+    
+    // parcourir tous les pixels de l'image
+    // en parallele avec openMP, un thread par bloc de 16 lignes
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int py= 0; py < image.height(); py++)
+    {
+        // nombres aleatoires, version c++11
+        std::random_device seed;
+        // un generateur par thread... pas de synchronisation
+        std::default_random_engine rng(seed());
+        // nombres aleatoires entre 0 et 1
+        std::uniform_real_distribution<float> u01(0.f, 1.f);
+        // statistiques des lightcuts de la ligne
+        LightcutsStats stats;
+        
+        for(int px= 0; px < image.width(); px++)
+        {
+            Color color= Black();
+            
+            // generer le rayon pour le pixel (x, y)
+            float x= px + u01(rng);
+            float y= py + u01(rng);
+            
+            //Point o= { (viewport*projection*view).inverse()(Point(x,y,0)) }; // origine dans l'image
+            Point o= { camera.position() }; // origine dans l'image
+            Point e= { inv(Point(x,y,1)) }; // extremite dans l'image
+            
+            Ray ray(o, e);
+            Hit hit;
+            // calculer les intersections 
+            if(hit= bvh.intersect(ray))
+            {
+                const TriangleData& triangle= mesh.triangle(hit.triangle_id);           // recuperer le triangle
+                const Material& material= mesh.triangle_material(hit.triangle_id);      // et sa matiere
+                
+                // position du point d'intersection
+                //Point p= ray.o + hit.t * ray.d;
+                Point p= point(hit, ray);               // point d'intersection
+                Vector pn= normal(hit, triangle);       // normale interpolee du triangle au point d'intersection
+                // retourne la normale pour faire face a la camera / origine du rayon...
+                if(dot(pn, ray.d) > 0)
+                    pn= -pn;
+                
+                // couleur diffuse, filtre la texture sur l'empreinte du pixel, estimee par les rayons des pixels voisins
+                Color diffuse= material.diffuse;
+                if(material.diffuse_texture != -1 && mesh.has_texcoord())
+                {
+                    Ray rx(o, inv(Point(x +1, y, 1)));
+                    Ray ry(o, inv(Point(x, y +1, 1)));
+                    
+                    vec2 uv, duvdx, duvdy;
+                    texcoord_differentials(triangle, hit, rx, ry, uv, duvdx, duvdy);
+                    diffuse= diffuse * textures.sample(material.diffuse_texture, uv, duvdx, duvdy);
+                }
+                
+                normals(px, py)= Color(pn.x, pn.y, pn.z);
+                positions(px, py)= Color(p.x, p.y, p.z);
+                albedos(px, py)= diffuse;
+                
+                if(environment)
+                {
+                    // directions choisies en fonction de l'emission de l'envmap
+                    for(int i= 0; i < N_point_Source; i++)
+                    {
+                        float pdf;
+                        Vector l= envmap_sampler.sample(u01(rng), u01(rng), pdf);
+                        float cos_theta= dot(pn, l);
+                        if(cos_theta <= 0 || pdf <= 0)
+                            continue;
+                        
+                        if(bvh.visible(Ray(p + 0.00001f * pn, l)))
+                            color= color + diffuse / float(M_PI) * envmap_sampler.radiance(l) * cos_theta / (pdf * N_point_Source);
+                    }
+                }
+                
+                // sources emissives, pas de sources en mode envmap
+                color= color + diffuse / float(M_PI) * direct_irradiance(bvh, sources, p, pn, N_point_Source, rng, u01);
+                
+                // eclairage indirect, un rebond, par les vpls
+                if(instant_radiosity)
+                    color= color + lightcuts.shade(bvh, p, pn, diffuse, color, lightcuts_params, &stats);
+                
+                // caustiques et eclairage indirect, estimation de densite des photons, sans final gather
+                if(photon_mapping)
+                    color= color + diffuse / float(M_PI) * (photons.caustics.irradiance(p, pn, photon_params.k) + photons.global.irradiance(p, pn, photon_params.k));
+            }
+            else if(environment)
+                // pas d'intersection, le rayon "voit" l'envmap
+                color= envmap.texture(ray.d);
+            
+            image(px, py)= Color(color, 1);
+        }
+        
+#pragma omp critical
+        lightcuts_stats+= stats;
+    }
+    
+    auto cpu_stop= std::chrono::high_resolution_clock::now();
+    int cpu_time= std::chrono::duration_cast<std::chrono::milliseconds>(cpu_stop - cpu_start).count();
+    printf("cpu  %ds %03dms\n", int(cpu_time / 1000), int(cpu_time % 1000));
+    if(textures.count())
+        textures.print();
+    if(lightcuts_stats.points)
+        printf("lightcuts: %d vpls, %.1f groups, %.1f shadow rays per point\n", lightcuts.size(), 
+            float(lightcuts_stats.cut) / lightcuts_stats.points, float(lightcuts_stats.rays) / lightcuts_stats.points);
+    
+    // filtrer l'image
+    auto denoise_start= std::chrono::high_resolution_clock::now();
+    
+    Image denoised= denoise(image, normals, positions, albedos);
+    
+    auto denoise_stop= std::chrono::high_resolution_clock::now();
+    int denoise_time= std::chrono::duration_cast<std::chrono::milliseconds>(denoise_stop - denoise_start).count();
+    printf("denoise %dms\n", denoise_time);
+    
+    // enregistrer l'image resultat
+    image= gamma_correct(image);
+    write_image(image, "render.png");
+    write_image_hdr(image, "render.hdr");
+    
+    denoised= gamma_correct(denoised);
+    write_image(denoised, "render_denoised.png");
+    write_image_hdr(denoised, "render_denoised.hdr");
+    return 0;
+}